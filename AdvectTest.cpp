@@ -0,0 +1,150 @@
+#include "DenseTrack.h"
+#include "Advection.h"
+
+// AdvectPoints at -V 0, 1 and 2 against the per-track code it replaced: random
+// flows of several sizes, points inside, on the borders, on half pixels, outside
+// the frame, NaN and infinite, in batches which leave a scalar tail after the
+// vector lanes. With nearest sampling the new positions and the inside flags must
+// match the old loop bit for bit, with -b they are compared to a per-point
+// bilinear interpolation within 1e-4 pixels (the vector paths may fuse the
+// multiply and add).
+//
+// usage: AdvectTest
+
+using namespace cv;
+
+static const float tolerance = 1e-4f;
+
+static float RandomFloat(float low, float high)
+{
+	return low + (high - low)*(rand()/(float)RAND_MAX);
+}
+
+// the tracking loop before the batch advection: the flow of the nearest pixel
+static bool AdvectNearest(const Mat& flow, const Point2f& prev_point, Point2f& point)
+{
+	int width = flow.cols, height = flow.rows;
+	int x = std::min<int>(std::max<int>(cvRound(prev_point.x), 0), width-1);
+	int y = std::min<int>(std::max<int>(cvRound(prev_point.y), 0), height-1);
+
+	point.x = prev_point.x + flow.ptr<float>(y)[2*x];
+	point.y = prev_point.y + flow.ptr<float>(y)[2*x+1];
+
+	return !(point.x <= 0 || point.x >= width || point.y <= 0 || point.y >= height);
+}
+
+// the same with the flow interpolated between the four pixels around the point,
+// positions out of the frame or not finite are read at the nearest border
+static bool AdvectBilinear(const Mat& flow, const Point2f& prev_point, Point2f& point)
+{
+	int width = flow.cols, height = flow.rows;
+	float px = prev_point.x > 0 ? std::min(prev_point.x, (float)(width-1)) : 0.f;
+	float py = prev_point.y > 0 ? std::min(prev_point.y, (float)(height-1)) : 0.f;
+	int x0 = (int)px, y0 = (int)py;
+	int x1 = std::min(x0+1, width-1), y1 = std::min(y0+1, height-1);
+	double a = px - x0, b = py - y0;
+
+	for(int c = 0; c < 2; c++) {
+		double f = (1-b)*((1-a)*flow.ptr<float>(y0)[2*x0+c] + a*flow.ptr<float>(y0)[2*x1+c]) +
+			b*((1-a)*flow.ptr<float>(y1)[2*x0+c] + a*flow.ptr<float>(y1)[2*x1+c]);
+		(c == 0 ? point.x : point.y) = (float)(c == 0 ? prev_point.x + f : prev_point.y + f);
+	}
+
+	return !(point.x <= 0 || point.x >= width || point.y <= 0 || point.y >= height);
+}
+
+static bool Same(float a, float b)
+{
+	return a == b || (a != a && b != b);
+}
+
+static bool Close(float a, float b)
+{
+	return Same(a, b) || std::abs(a - b) <= tolerance;
+}
+
+// a point close to a border may land on either side of it within the tolerance
+static bool NearBorder(float v, int size)
+{
+	return std::abs(v) <= tolerance || std::abs(v - size) <= tolerance;
+}
+
+static float RandomCoord(int size)
+{
+	static const float inf = std::numeric_limits<float>::infinity();
+	static const float nan = std::numeric_limits<float>::quiet_NaN();
+	switch(rand()%12) {
+	case 0: return 0.f;
+	case 1: return (float)(size-1);
+	case 2: return (float)size;
+	case 3: return (float)(rand()%size) + 0.5f;
+	case 4: return RandomFloat(-8.f, 0.f);
+	case 5: return RandomFloat((float)size, (float)size + 8.f);
+	case 6: return rand()%2 ? inf : -inf;
+	case 7: return nan;
+	default: return RandomFloat(0.f, (float)size);
+	}
+}
+
+// returns the number of points which differ from the per-track code
+static int Check(int width, int height, int n, bool bilinear)
+{
+	Mat flow(height, width, CV_32FC2);
+	for(int y = 0; y < height; y++)
+		for(int x = 0; x < 2*width; x++)
+			flow.ptr<float>(y)[x] = RandomFloat(-6.f, 6.f);
+	// a NaN flow marks the points which read it as lost, the old loop kept them
+	if(rand()%2)
+		flow.ptr<float>(rand()%height)[2*(rand()%width)] = std::numeric_limits<float>::quiet_NaN();
+
+	std::vector<float> x(n), y(n), nx(n), ny(n);
+	std::vector<uchar> inside(n);
+	for(int i = 0; i < n; i++) {
+		x[i] = RandomCoord(width);
+		y[i] = RandomCoord(height);
+	}
+
+	AdvectPoints(flow, &x[0], &y[0], &nx[0], &ny[0], &inside[0], n, bilinear);
+
+	int failed = 0;
+	for(int i = 0; i < n; i++) {
+		Point2f point;
+		bool same;
+		if(!bilinear) {
+			bool in = AdvectNearest(flow, Point2f(x[i], y[i]), point);
+			same = Same(nx[i], point.x) && Same(ny[i], point.y) && inside[i] == in;
+		}
+		else {
+			bool in = AdvectBilinear(flow, Point2f(x[i], y[i]), point);
+			same = Close(nx[i], point.x) && Close(ny[i], point.y) &&
+				(inside[i] == in || NearBorder(point.x, width) || NearBorder(point.y, height));
+		}
+		if(!same) {
+			fprintf(stderr, "-V %d%s, %dx%d: point %d (%g, %g) went to (%g, %g) instead of (%g, %g)\n",
+				simd_limit, bilinear ? " -b" : "", width, height, i, x[i], y[i], nx[i], ny[i], point.x, point.y);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	static const Size sizes[] = { Size(1, 1), Size(2, 3), Size(17, 9), Size(160, 120), Size(321, 241) };
+
+	int failed = 0, total = 0;
+	srand(0);
+	for(int level = my::SIMD_NONE; level <= my::SIMD_AVX512; level++) {
+		simd_limit = level;
+		for(int bilinear = 0; bilinear < 2; bilinear++)
+			for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+				for(int n = 1; n <= 70; n += 3) {
+					failed += Check(sizes[s].width, sizes[s].height, n, bilinear != 0);
+					total += n;
+				}
+	}
+	simd_limit = INT_MAX;
+
+	printf("AdvectPoints: %d points, %d failed\n", total, failed);
+	return failed == 0 ? 0 : 1;
+}
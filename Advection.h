@@ -0,0 +1,204 @@
+#ifndef ADVECTION_H_
+#define ADVECTION_H_
+
+#include "DenseTrack.h"
+#include "FarnebackSIMD.h"
+
+#include <immintrin.h>
+
+using namespace cv;
+
+// Moves a batch of points by the optical flow in one pass: the positions come in
+// as arrays (x, y), the new ones go to (nx, ny) and inside[i] is 1 if point i is
+// still strictly inside the frame. The flow is read at the nearest pixel, like the
+// tracking loop always did, or bilinearly interpolated for sub-pixel accuracy. The
+// vector paths gather the flow of 8 or 16 points at a time; with nearest sampling
+// they match the scalar code bit for bit.
+
+// scalar reference for the points [begin, end), also the tail of the vector kernels
+static void
+AdvectPointsRange( const Mat& flow, const float* x, const float* y, float* nx, float* ny, uchar* inside,
+                   int begin, int end, bool bilinear )
+{
+    int width = flow.cols, height = flow.rows;
+
+    for( int i = begin; i < end; i++ )
+    {
+        float fx, fy;
+        if( !bilinear )
+        {
+            int ix = std::min<int>(std::max<int>(cvRound(x[i]), 0), width-1);
+            int iy = std::min<int>(std::max<int>(cvRound(y[i]), 0), height-1);
+            const float* f = flow.ptr<float>(iy) + ix*2;
+            fx = f[0];
+            fy = f[1];
+        }
+        else
+        {
+            // NaN and -inf go to 0 like max_ps in the vector paths, never to the index
+            float px = x[i] > 0 ? std::min(x[i], (float)(width-1)) : 0.f;
+            float py = y[i] > 0 ? std::min(y[i], (float)(height-1)) : 0.f;
+            int x0 = (int)px, y0 = (int)py;
+            int x1 = std::min(x0+1, width-1), y1 = std::min(y0+1, height-1);
+            float a = px - x0, b = py - y0;
+            const float* r0 = flow.ptr<float>(y0);
+            const float* r1 = flow.ptr<float>(y1);
+            fx = (1-b)*((1-a)*r0[x0*2] + a*r0[x1*2]) + b*((1-a)*r1[x0*2] + a*r1[x1*2]);
+            fy = (1-b)*((1-a)*r0[x0*2+1] + a*r0[x1*2+1]) + b*((1-a)*r1[x0*2+1] + a*r1[x1*2+1]);
+        }
+
+        nx[i] = x[i] + fx;
+        ny[i] = y[i] + fy;
+        inside[i] = !(nx[i] <= 0 || nx[i] >= width || ny[i] <= 0 || ny[i] >= height);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+AdvectPoints_AVX2( const Mat& flow, const float* x, const float* y, float* nx, float* ny, uchar* inside,
+                   int n, bool bilinear )
+{
+    int width = flow.cols, height = flow.rows;
+    const float* base = (const float*)flow.data;
+    const __m256i vstep = _mm256_set1_epi32((int)(flow.step/sizeof(float)));
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32(1);
+    const __m256i xmax = _mm256_set1_epi32(width-1), ymax = _mm256_set1_epi32(height-1);
+    const __m256 fxmax = _mm256_set1_ps((float)(width-1)), fymax = _mm256_set1_ps((float)(height-1));
+    const __m256 fwidth = _mm256_set1_ps((float)width), fheight = _mm256_set1_ps((float)height);
+    const __m256 fzero = _mm256_setzero_ps(), fone = _mm256_set1_ps(1.f);
+
+    int i = 0;
+    for( ; i <= n - 8; i += 8 )
+    {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+        __m256 fx, fy;
+
+        if( !bilinear )
+        {
+            // round to nearest even as cvRound, then clamp to the frame
+            __m256i ix = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(px), zero), xmax);
+            __m256i iy = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(py), zero), ymax);
+            __m256i ofs = _mm256_add_epi32(_mm256_mullo_epi32(iy, vstep), _mm256_slli_epi32(ix, 1));
+            fx = _mm256_i32gather_ps(base, ofs, 4);
+            fy = _mm256_i32gather_ps(base + 1, ofs, 4);
+        }
+        else
+        {
+            __m256 cx = _mm256_min_ps(_mm256_max_ps(px, fzero), fxmax);
+            __m256 cy = _mm256_min_ps(_mm256_max_ps(py, fzero), fymax);
+            __m256i x0 = _mm256_cvttps_epi32(cx), y0 = _mm256_cvttps_epi32(cy);
+            __m256i x1 = _mm256_min_epi32(_mm256_add_epi32(x0, one), xmax);
+            __m256i y1 = _mm256_min_epi32(_mm256_add_epi32(y0, one), ymax);
+            __m256 a = _mm256_sub_ps(cx, _mm256_cvtepi32_ps(x0)), b = _mm256_sub_ps(cy, _mm256_cvtepi32_ps(y0));
+            __m256 a1 = _mm256_sub_ps(fone, a), b1 = _mm256_sub_ps(fone, b);
+
+            __m256i r0 = _mm256_mullo_epi32(y0, vstep), r1 = _mm256_mullo_epi32(y1, vstep);
+            __m256i o00 = _mm256_add_epi32(r0, _mm256_slli_epi32(x0, 1)), o01 = _mm256_add_epi32(r0, _mm256_slli_epi32(x1, 1));
+            __m256i o10 = _mm256_add_epi32(r1, _mm256_slli_epi32(x0, 1)), o11 = _mm256_add_epi32(r1, _mm256_slli_epi32(x1, 1));
+
+            __m256 top = _mm256_add_ps(_mm256_mul_ps(a1, _mm256_i32gather_ps(base, o00, 4)), _mm256_mul_ps(a, _mm256_i32gather_ps(base, o01, 4)));
+            __m256 bot = _mm256_add_ps(_mm256_mul_ps(a1, _mm256_i32gather_ps(base, o10, 4)), _mm256_mul_ps(a, _mm256_i32gather_ps(base, o11, 4)));
+            fx = _mm256_add_ps(_mm256_mul_ps(b1, top), _mm256_mul_ps(b, bot));
+
+            top = _mm256_add_ps(_mm256_mul_ps(a1, _mm256_i32gather_ps(base + 1, o00, 4)), _mm256_mul_ps(a, _mm256_i32gather_ps(base + 1, o01, 4)));
+            bot = _mm256_add_ps(_mm256_mul_ps(a1, _mm256_i32gather_ps(base + 1, o10, 4)), _mm256_mul_ps(a, _mm256_i32gather_ps(base + 1, o11, 4)));
+            fy = _mm256_add_ps(_mm256_mul_ps(b1, top), _mm256_mul_ps(b, bot));
+        }
+
+        __m256 qx = _mm256_add_ps(px, fx), qy = _mm256_add_ps(py, fy);
+        _mm256_storeu_ps(nx + i, qx);
+        _mm256_storeu_ps(ny + i, qy);
+
+        // not (q <= 0 or q >= size), so that NaN stays inside as in the scalar code
+        __m256 in = _mm256_and_ps(_mm256_cmp_ps(qx, fzero, _CMP_NLE_UQ), _mm256_cmp_ps(qx, fwidth, _CMP_NGE_UQ));
+        in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(qy, fzero, _CMP_NLE_UQ), _mm256_cmp_ps(qy, fheight, _CMP_NGE_UQ)));
+        int mask = _mm256_movemask_ps(in);
+        for( int k = 0; k < 8; k++ )
+            inside[i+k] = (mask >> k) & 1;
+    }
+
+    AdvectPointsRange( flow, x, y, nx, ny, inside, i, n, bilinear );
+}
+
+__attribute__((target("avx512f")))
+static void
+AdvectPoints_AVX512( const Mat& flow, const float* x, const float* y, float* nx, float* ny, uchar* inside,
+                     int n, bool bilinear )
+{
+    int width = flow.cols, height = flow.rows;
+    const float* base = (const float*)flow.data;
+    const __m512i vstep = _mm512_set1_epi32((int)(flow.step/sizeof(float)));
+    const __m512i zero = _mm512_setzero_si512(), one = _mm512_set1_epi32(1);
+    const __m512i xmax = _mm512_set1_epi32(width-1), ymax = _mm512_set1_epi32(height-1);
+    const __m512 fxmax = _mm512_set1_ps((float)(width-1)), fymax = _mm512_set1_ps((float)(height-1));
+    const __m512 fwidth = _mm512_set1_ps((float)width), fheight = _mm512_set1_ps((float)height);
+    const __m512 fzero = _mm512_setzero_ps(), fone = _mm512_set1_ps(1.f);
+
+    int i = 0;
+    for( ; i <= n - 16; i += 16 )
+    {
+        __m512 px = _mm512_loadu_ps(x + i), py = _mm512_loadu_ps(y + i);
+        __m512 fx, fy;
+
+        if( !bilinear )
+        {
+            __m512i ix = _mm512_min_epi32(_mm512_max_epi32(_mm512_cvtps_epi32(px), zero), xmax);
+            __m512i iy = _mm512_min_epi32(_mm512_max_epi32(_mm512_cvtps_epi32(py), zero), ymax);
+            __m512i ofs = _mm512_add_epi32(_mm512_mullo_epi32(iy, vstep), _mm512_slli_epi32(ix, 1));
+            fx = _mm512_i32gather_ps(ofs, base, 4);
+            fy = _mm512_i32gather_ps(ofs, base + 1, 4);
+        }
+        else
+        {
+            __m512 cx = _mm512_min_ps(_mm512_max_ps(px, fzero), fxmax);
+            __m512 cy = _mm512_min_ps(_mm512_max_ps(py, fzero), fymax);
+            __m512i x0 = _mm512_cvttps_epi32(cx), y0 = _mm512_cvttps_epi32(cy);
+            __m512i x1 = _mm512_min_epi32(_mm512_add_epi32(x0, one), xmax);
+            __m512i y1 = _mm512_min_epi32(_mm512_add_epi32(y0, one), ymax);
+            __m512 a = _mm512_sub_ps(cx, _mm512_cvtepi32_ps(x0)), b = _mm512_sub_ps(cy, _mm512_cvtepi32_ps(y0));
+            __m512 a1 = _mm512_sub_ps(fone, a), b1 = _mm512_sub_ps(fone, b);
+
+            __m512i r0 = _mm512_mullo_epi32(y0, vstep), r1 = _mm512_mullo_epi32(y1, vstep);
+            __m512i o00 = _mm512_add_epi32(r0, _mm512_slli_epi32(x0, 1)), o01 = _mm512_add_epi32(r0, _mm512_slli_epi32(x1, 1));
+            __m512i o10 = _mm512_add_epi32(r1, _mm512_slli_epi32(x0, 1)), o11 = _mm512_add_epi32(r1, _mm512_slli_epi32(x1, 1));
+
+            __m512 top = _mm512_add_ps(_mm512_mul_ps(a1, _mm512_i32gather_ps(o00, base, 4)), _mm512_mul_ps(a, _mm512_i32gather_ps(o01, base, 4)));
+            __m512 bot = _mm512_add_ps(_mm512_mul_ps(a1, _mm512_i32gather_ps(o10, base, 4)), _mm512_mul_ps(a, _mm512_i32gather_ps(o11, base, 4)));
+            fx = _mm512_add_ps(_mm512_mul_ps(b1, top), _mm512_mul_ps(b, bot));
+
+            top = _mm512_add_ps(_mm512_mul_ps(a1, _mm512_i32gather_ps(o00, base + 1, 4)), _mm512_mul_ps(a, _mm512_i32gather_ps(o01, base + 1, 4)));
+            bot = _mm512_add_ps(_mm512_mul_ps(a1, _mm512_i32gather_ps(o10, base + 1, 4)), _mm512_mul_ps(a, _mm512_i32gather_ps(o11, base + 1, 4)));
+            fy = _mm512_add_ps(_mm512_mul_ps(b1, top), _mm512_mul_ps(b, bot));
+        }
+
+        __m512 qx = _mm512_add_ps(px, fx), qy = _mm512_add_ps(py, fy);
+        _mm512_storeu_ps(nx + i, qx);
+        _mm512_storeu_ps(ny + i, qy);
+
+        __mmask16 in = _mm512_cmp_ps_mask(qx, fzero, _CMP_NLE_UQ) & _mm512_cmp_ps_mask(qx, fwidth, _CMP_NGE_UQ) &
+                       _mm512_cmp_ps_mask(qy, fzero, _CMP_NLE_UQ) & _mm512_cmp_ps_mask(qy, fheight, _CMP_NGE_UQ);
+        _mm_storeu_si128((__m128i*)(inside + i), _mm512_cvtepi32_epi8(_mm512_maskz_set1_epi32(in, 1)));
+    }
+
+    AdvectPointsRange( flow, x, y, nx, ny, inside, i, n, bilinear );
+}
+
+// advect the n points on the best instruction set allowed by simd_limit
+static void
+AdvectPoints( const Mat& flow, const float* x, const float* y, float* nx, float* ny, uchar* inside,
+              int n, bool bilinear )
+{
+    switch( my::FarnebackSimdLevel() )
+    {
+    case my::SIMD_AVX512:
+        AdvectPoints_AVX512( flow, x, y, nx, ny, inside, n, bilinear );
+        break;
+    case my::SIMD_AVX2:
+        AdvectPoints_AVX2( flow, x, y, nx, ny, inside, n, bilinear );
+        break;
+    default:
+        AdvectPointsRange( flow, x, y, nx, ny, inside, 0, n, bilinear );
+    }
+}
+
+#endif /*ADVECTION_H_*/
@@ -0,0 +1,257 @@
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "ThreadPool.h"
+#include "Pipeline.h"
+
+#include <errno.h>
+#include <signal.h>
+
+// The steady state of the frame loop must not allocate. malloc and its relatives
+// are replaced here, so every allocation is seen: operator new, cv::Mat through
+// fastMalloc and the scratch buffers of OpenCV's own functions. After a warm-up
+// - several threads submit work to one thread pool,
+// - slot indices go around a ring of SlotQueues as in FramePipeline,
+// - FrameStages expands and computes the flow of a moving frame in a ring of slots,
+//   at one and at several scales, with and without the cascaded pyramid, the
+//   cached float pyramid and the warm start;
+// and no allocation may be counted. The colour conversion and the grey levels of
+// Prepare() are OpenCV's and are not counted.
+//
+// usage: AllocTest
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+}
+
+static volatile bool counting = false;
+static int allocations = 0;
+
+static inline void Count()
+{
+	if(counting)
+		__sync_fetch_and_add(&allocations, 1);
+}
+
+extern "C" void* malloc(size_t size) throw()
+{
+	Count();
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) throw()
+{
+	Count();
+	return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) throw()
+{
+	Count();
+	return __libc_realloc(p, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) throw()
+{
+	Count();
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** p, size_t alignment, size_t size) throw()
+{
+	Count();
+	*p = __libc_memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+extern "C" void free(void* p) throw()
+{
+	__libc_free(p);
+}
+
+class SumBody : public ParallelBody
+{
+public:
+	SumBody(int* sum_) : sum(sum_) {}
+
+	void operator()(int begin, int end) const
+	{
+		for(int i = begin; i < end; i++)
+			__sync_fetch_and_add(sum, i);
+	}
+
+private:
+	int* sum;
+};
+
+static const int num_submitters = 3;
+static const int num_runs = 2000;
+static const int num_slots = 4;
+static const int num_passes = 20000;
+static const int warm_frames = 4;
+static const int num_frames = 12;
+
+static pthread_barrier_t start;
+
+// pushes num_runs ranges through the shared pool
+static void* Submitter(void* arg)
+{
+	int* errors = (int*)arg;
+	pthread_barrier_wait(&start);
+	for(int run = 0; run < num_runs; run++) {
+		int sum = 0;
+		int end = run % 100;
+		ParallelFor(0, end, SumBody(&sum));
+		if(sum != end*(end - 1)/2)
+			(*errors)++;
+	}
+	return NULL;
+}
+
+// returns the number of wrong sums; the creation of the threads is not counted,
+// only the runs
+static int RunPool(bool count)
+{
+	pthread_t threads[num_submitters];
+	int errors[num_submitters] = {0};
+	pthread_barrier_init(&start, NULL, num_submitters + 1);
+	for(int i = 0; i < num_submitters; i++)
+		pthread_create(&threads[i], NULL, Submitter, &errors[i]);
+
+	counting = count;
+	pthread_barrier_wait(&start);
+	for(int i = 0; i < num_submitters; i++)
+		pthread_join(threads[i], NULL);
+	counting = false;
+	pthread_barrier_destroy(&start);
+
+	int total = 0;
+	for(int i = 0; i < num_submitters; i++)
+		total += errors[i];
+	return total;
+}
+
+// forwards every index of in to out, and the -1 at the end
+static void* Forward(void* arg)
+{
+	SlotQueue** queues = (SlotQueue**)arg;
+	int index;
+	while((index = queues[0]->pop()) >= 0)
+		queues[1]->push(index);
+	queues[1]->push(-1);
+	return NULL;
+}
+
+// sends the slots num_passes times around free -> busy -> done -> free, returns
+// the number of indices which came back out of order; only the passes are
+// counted, not the setup of the queues
+static int RunQueues(bool count)
+{
+	SlotQueue free_slots, busy_slots, done_slots;
+	free_slots.reserve(num_slots + 1);
+	busy_slots.reserve(num_slots + 1);
+	done_slots.reserve(num_slots + 1);
+	for(int i = 0; i < num_slots; i++)
+		free_slots.push(i);
+
+	SlotQueue* queues[2] = { &busy_slots, &done_slots };
+	pthread_t thread;
+	pthread_create(&thread, NULL, Forward, queues);
+
+	int errors = 0;
+	counting = count;
+	for(int pass = 0; pass < num_passes; pass++) {
+		// all slots are out, wait for the oldest one
+		if(pass >= num_slots) {
+			int done = done_slots.pop();
+			if(done != (pass - num_slots) % num_slots)
+				errors++;
+			free_slots.push(done);
+		}
+		busy_slots.push(free_slots.pop());
+	}
+	busy_slots.push(-1);
+	counting = false;
+	pthread_join(thread, NULL);
+	return errors;
+}
+
+// a textured frame moving by (t, t/2) pixels
+static void DrawFrame(Mat& frame, int t)
+{
+	for(int y = 0; y < frame.rows; y++) {
+		uchar* p = frame.ptr<uchar>(y);
+		for(int x = 0; x < frame.cols; x++) {
+			int u = x - t, v = y - t/2;
+			uchar c = (uchar)(128 + 60*sin(u*0.31)*cos(v*0.23) + 40*sin((u + v)*0.07));
+			p[3*x] = p[3*x+1] = p[3*x+2] = c;
+		}
+	}
+}
+
+// sends num_frames frames through the slots as FramePipeline does, returns the
+// allocations of Expand() and Flow() after the warm-up
+static int RunStages(const TrackParams& params, const char* name)
+{
+	FrameStages stages(params);
+	FrameSlot slots[num_slots];
+	for(int i = 0; i < num_slots; i++)
+		slots[i].frame.create(120, 160, CV_8UC3);
+
+	int before = allocations;
+	for(int t = 0; t < num_frames; t++) {
+		FrameSlot& slot = slots[t % num_slots];
+		DrawFrame(slot.frame, t);
+		stages.Prepare(slot, t);
+
+		counting = t >= warm_frames;
+		stages.Expand(slot);
+		if(t > 0)
+			stages.Flow(slots[(t - 1) % num_slots], slot);
+		counting = false;
+	}
+
+	int count = allocations - before;
+	if(count > 0)
+		fprintf(stderr, "%d allocations in the flow stages (%s)\n", count, name);
+	return count;
+}
+
+static void Timeout(int)
+{
+	fprintf(stderr, "a queue did not return\n");
+	_exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	signal(SIGALRM, Timeout);
+	alarm(30);
+
+	InitThreadPool(4);
+	int errors = RunPool(false) + RunQueues(false);
+	errors += RunPool(true) + RunQueues(true);
+
+	TrackParams params;
+	InitTrackParams(&params);
+	params.scale_num = 1;
+	RunStages(params, "one scale");
+	params.scale_num = 8;
+	params.pyramid_cascade = 0;
+	RunStages(params, "8 scales");
+	params.pyramid_cascade = 1;
+	params.cache_pyramid = 1;
+	RunStages(params, "8 scales, cascaded and cached");
+	params.cache_pyramid = 0;
+	params.warm_iterations = 1;
+	params.warm_check_gap = 2;
+	RunStages(params, "8 scales, warm started");
+
+	ReleaseThreadPool();
+
+	printf("Alloc: %d allocations after the warm-up, %d errors\n", allocations, errors);
+	return allocations == 0 && errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "ThreadPool.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sstream>
+
+using namespace cv;
+
+// one video of the manifest: the video, the directory of its output files and the
+// options which override the ones of the command line for this video
+typedef struct {
+	std::string video;
+	std::string output;
+	std::vector<std::string> options;
+	pid_t pid;
+	int pipe;       // reading end, the worker sends its number of frames
+	double start;   // wall clock in seconds
+	double seconds;
+	int frames;
+	int status;     // 0 if the video was processed
+}BatchJob;
+
+// extracts the trajectories of one video in the current directory and returns 0 on
+// success, frames receives the number of decoded frames
+typedef int (*VideoProcessor)(char* video, bool flag, int* frames);
+
+double WallClock()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+// one video per line: video_file output_dir [options], separated by blanks;
+// empty lines and lines starting with # are skipped
+bool ReadManifest(const char* file, std::vector<BatchJob>& jobs)
+{
+	std::ifstream manifest(file);
+	if(!manifest)
+		return false;
+
+	std::string line;
+	for(int line_num = 1; std::getline(manifest, line); line_num++) {
+		std::istringstream tokens(line);
+		BatchJob job;
+		if(!(tokens >> job.video) || job.video[0] == '#')
+			continue;
+		if(!(tokens >> job.output)) {
+			fprintf(stderr, "%s:%d: no output directory for %s\n", file, line_num, job.video.c_str());
+			return false;
+		}
+
+		std::string option;
+		while(tokens >> option)
+			job.options.push_back(option);
+
+		job.pid = -1;
+		job.pipe = -1;
+		job.start = job.seconds = 0;
+		job.frames = 0;
+		job.status = -1;
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+// mkdir -p
+bool MakeDirs(const std::string& path)
+{
+	for(size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+		std::string dir = path.substr(0, pos);
+		if(!dir.empty() && mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+			return false;
+		if(pos == std::string::npos)
+			return true;
+	}
+}
+
+// the output files of a video are written to its directory, an absolute name would
+// be shared by all the workers; returns the first absolute one of the options, or NULL
+const char* AbsoluteOutputFile()
+{
+	const char* files[] = { track_file, debug_file, segm_file, feature_file };
+	for(size_t i = 0; i < sizeof(files)/sizeof(files[0]); i++)
+		if(files[i] && files[i][0] == '/')
+			return files[i];
+	return NULL;
+}
+
+// runs in the forked worker: moves into the output directory, so the fixed names of
+// the output files do not clash between the videos, and applies the options of the
+// manifest on top of the inherited ones
+int RunBatchJob(const BatchJob& job, bool flag, VideoProcessor process, int* frames)
+{
+	// the video may be given relative to the directory of the batch
+	char path[PATH_MAX];
+	std::string video = realpath(job.video.c_str(), path) ? std::string(path) : job.video;
+
+	if(!MakeDirs(job.output) || chdir(job.output.c_str()) != 0) {
+		fprintf(stderr, "Could not create %s\n", job.output.c_str());
+		return -1;
+	}
+
+	// the messages of the workers would be interleaved otherwise
+	if(!freopen("DenseTrack.log", "w", stdout))
+		return -1;
+	dup2(fileno(stdout), fileno(stderr));
+
+	std::vector<char*> argv;
+	argv.push_back((char*)"DenseTrack");
+	for(size_t i = 0; i < job.options.size(); i++)
+		argv.push_back((char*)job.options[i].c_str());
+	argv.push_back(NULL);
+
+	optind = 0; // restart getopt
+	if(arg_parse(argv.size() - 1, &argv[0]))
+		flag = true;
+
+	if(const char* file = AbsoluteOutputFile()) {
+		fprintf(stderr, "%s: the output files of a video must be relative to its directory\n", file);
+		return -1;
+	}
+
+	InitThreadPool(num_threads);
+	int code = process((char*)video.c_str(), flag, frames);
+	ReleaseThreadPool();
+	return code;
+}
+
+void StartBatchJob(BatchJob& job, bool flag, VideoProcessor process)
+{
+	int fds[2];
+	if(pipe(fds) != 0) {
+		fprintf(stderr, "Could not start %s\n", job.video.c_str());
+		return;
+	}
+
+	// the buffers would be written by the parent and the worker
+	fflush(stdout);
+	fflush(stderr);
+
+	job.start = WallClock();
+	job.pid = fork();
+	if(job.pid == 0) {
+		close(fds[0]);
+		int frames = 0;
+		int code = RunBatchJob(job, flag, process, &frames);
+		if(write(fds[1], &frames, sizeof(frames)) != sizeof(frames))
+			code = -1;
+		close(fds[1]);
+		fflush(stdout);
+		_exit(code == 0 ? 0 : 1);
+	}
+
+	close(fds[1]);
+	if(job.pid < 0) {
+		fprintf(stderr, "Could not start %s\n", job.video.c_str());
+		close(fds[0]);
+		return;
+	}
+	job.pipe = fds[0];
+}
+
+void FinishBatchJob(BatchJob& job, int status)
+{
+	job.seconds = WallClock() - job.start;
+	if(read(job.pipe, &job.frames, sizeof(job.frames)) != sizeof(job.frames))
+		job.frames = 0;
+	close(job.pipe);
+	job.pipe = -1;
+	job.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// one line of the report for a finished job or one which could not be started
+void ReportBatchJob(FILE* report, const BatchJob& job, int index, int count)
+{
+	double fps = job.seconds > 0 ? job.frames/job.seconds : 0;
+	fprintf(report, "%s\t%s\t%s\t%d\t%f\t%f\n", job.video.c_str(), job.output.c_str(),
+		job.status == 0 ? "ok" : "failed", job.frames, job.seconds, fps);
+	fflush(report);
+	fprintf(stderr, "[%d/%d] %s: %d frames, %f fps%s\n", index + 1, count, job.video.c_str(),
+		job.frames, fps, job.status == 0 ? "" : " (failed)");
+}
+
+// processes the videos of the manifest on batch_workers processes, the global state
+// of the extraction is copied into every worker by fork(), and writes a line per
+// video with its frames per second to batch_report
+int RunBatch(const char* manifest, bool flag, VideoProcessor process)
+{
+	std::vector<BatchJob> jobs;
+	if(!ReadManifest(manifest, jobs)) {
+		fprintf(stderr, "Could not read %s\n", manifest);
+		return -1;
+	}
+
+	if(const char* file = AbsoluteOutputFile()) {
+		fprintf(stderr, "%s: the output files of -B must be relative to the output directory of a video\n", file);
+		return -1;
+	}
+
+	FILE* report = fopen(batch_report, "w");
+	if(!report) {
+		fprintf(stderr, "Could not create %s\n", batch_report);
+		return -1;
+	}
+
+	// the cores are shared between the workers unless -T is given
+	int cores = GetNumThreads(0);
+	int workers = batch_workers > 0 ? batch_workers : cores;
+	if(num_threads == 0)
+		num_threads = std::max(cores/workers, 1);
+
+	double start = WallClock();
+	int num_jobs = jobs.size();
+	int next = 0, running = 0, failed = 0;
+	long total_frames = 0;
+	while(next < num_jobs || running > 0) {
+		for(; running < workers && next < num_jobs; next++) {
+			StartBatchJob(jobs[next], flag, process);
+			if(jobs[next].pid > 0)
+				running++;
+			else {
+				failed++;
+				ReportBatchJob(report, jobs[next], next, num_jobs);
+			}
+		}
+		if(running == 0)
+			continue;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if(pid < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		for(int i = 0; i < next; i++) {
+			BatchJob& job = jobs[i];
+			if(job.pid != pid || job.pipe < 0)
+				continue;
+
+			FinishBatchJob(job, status);
+			running--;
+			if(job.status != 0)
+				failed++;
+			total_frames += job.frames;
+			ReportBatchJob(report, job, i, num_jobs);
+			break;
+		}
+	}
+	fclose(report);
+
+	double seconds = WallClock() - start;
+	fprintf(stderr, "Batch: %d videos (%d failed), %ld frames in %f s, %f fps on %d workers\n",
+		num_jobs, failed, total_frames, seconds, seconds > 0 ? total_frames/seconds : 0, workers);
+	return failed == 0 ? 0 : -1;
+}
+
+#endif /*BATCH_H_*/
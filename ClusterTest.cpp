@@ -0,0 +1,106 @@
+#include "DenseTrack.h"
+#include "TrajHandSegm.h"
+
+// ClusterTrajectories against the all-pairs clustering it replaced: an adjacency
+// matrix of DoesTrajSame with a BFS over full rows. The labels must be the same
+// on random sets of trajectories, with means and variances on a coarse grid so
+// that many differences fall exactly on delta_mean and delta_var.
+//
+// usage: ClusterTest
+
+// the matrix and the BFS of GetMatrixOfTrajectories before the grid, they only
+// set arr[i][j] for j > i
+static void Reference(const list<TrackSegm>& segmTracks, vector<int>& clusters, int& clus)
+{
+	int size = segmTracks.size();
+	vector<vector<int> > arr(size, vector<int>(size, 0));
+
+	int i = 0, j;
+	for(list<TrackSegm>::const_iterator iTrack0 = segmTracks.begin(); iTrack0 != segmTracks.end(); iTrack0++) {
+		j = 0;
+		for(list<TrackSegm>::const_iterator iTrack1 = segmTracks.begin(); iTrack1 != segmTracks.end(); iTrack1++) {
+			if(j > i && DoesTrajSame(iTrack0, iTrack1))
+				arr[i][j] = 1;
+			j++;
+		}
+		i++;
+	}
+
+	vector<bool> visited(size, false);
+	vector<int> queue(size);
+	clusters.assign(size, 0);
+	clus = 0;
+	for(int root = 0; root < size; root++) {
+		if(visited[root])
+			continue;
+
+		int head = 0, count = 0;
+		queue[count++] = root;
+		visited[root] = true;
+		clusters[root] = clus;
+		while(head < count) {
+			int unit = queue[head++];
+			for(int k = 0; k < size; k++)
+				if(arr[unit][k] && !visited[k]) {
+					queue[count++] = k;
+					visited[k] = true;
+					clusters[k] = clus;
+				}
+		}
+		clus++;
+	}
+}
+
+// a value in [0, range) on a grid of step, or anywhere if step is 0
+static float RandomValue(float range, float step)
+{
+	float value = range*(rand()/(RAND_MAX + 1.f));
+	return step > 0 ? step*cvFloor(value/step) : value;
+}
+
+// returns 1 if the labels differ
+static int Check(int size, float range, float step)
+{
+	list<TrackSegm> segmTracks;
+	for(int i = 0; i < size; i++) {
+		TrackSegm track;
+		track.setFrameNum(0);
+		track.setMean(RandomValue(range, step), RandomValue(range, step));
+		track.setVariance(RandomValue(4*delta_var, step/4), RandomValue(4*delta_var, step/4));
+		segmTracks.push_back(track);
+	}
+
+	vector<int> expected;
+	int expected_clus;
+	Reference(segmTracks, expected, expected_clus);
+
+	int clus;
+	int* clusters = ClusterTrajectories(segmTracks, clus);
+	int failed = clus != expected_clus;
+	for(int i = 0; i < size && !failed; i++)
+		failed = clusters[i] != expected[i];
+	delete []clusters;
+
+	if(failed)
+		fprintf(stderr, "%d trajectories in %g, step %g: %d clusters instead of %d\n",
+			size, range, step, clus, expected_clus);
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	static const float ranges[] = { 60, 200, 600 };
+	static const float steps[] = { 0, delta_mean/4, delta_mean };
+
+	int failed = 0, runs = 0;
+	srand(0);
+	for(int size = 0; size <= 300; size += 7) {
+		for(int r = 0; r < 3; r++) {
+			for(int s = 0; s < 3; s++, runs++)
+				failed += Check(size, ranges[r], steps[s]);
+		}
+	}
+
+	printf("ClusterTrajectories: %d sets, %d failed\n", runs, failed);
+	return failed == 0 ? 0 : 1;
+}
@@ -5,6 +5,10 @@
 #include "Trajectories.h"
 #include "Constants.h"
 #include "TrajHandSegm.h"
+#include "Pipeline.h"
+#include "Features.h"
+#include "Tracker.h"
+#include "Batch.h"
 
 #include <time.h>
 
@@ -12,180 +16,103 @@ using namespace cv;
 
 int show_track = 0; // set show_track = 1, if you want to visualize the trajectories
 
-int main(int argc, char** argv)
+// extracts the trajectories of the frames of a source with the global parameters,
+// flag is set if the window of frames is given; frames receives the number of
+// decoded frames
+int ProcessFrames(FrameSource& source, char* video, bool flag, int* frames)
 {
-	VideoCapture capture;
-	char* video = argv[1];
-	int flag = arg_parse(argc, argv);
-	capture.open(video);
-
-	if(!capture.isOpened()) {
-		fprintf(stderr, "Could not initialize capturing..\n");
-		return -1;
-	}   
-
 	int frame_num = 0;
 	TrackInfo trackInfo;
+	TrackParams params;
 
 	InitTrackInfo(&trackInfo, track_length, init_gap);  
+	InitTrackParams(&params);
 	
 	SeqInfo seqInfo;
-	InitSeqInfo(&seqInfo, video);
+	InitSeqInfo(&seqInfo, video, source, probe_mode);
 
-	if(flag)
+	if(flag && end_frame != INT_MAX)
 		seqInfo.length = end_frame - start_frame + 1;
 
 	if(show_track == 1)
 	{
 		namedWindow("DenseTrack", 0);
-		resizeWindow("DenseTrack", capture.get(CV_CAP_PROP_FRAME_WIDTH) * 3, capture.get(CV_CAP_PROP_FRAME_HEIGHT) * 3);
+		resizeWindow("DenseTrack", seqInfo.width * 3, seqInfo.height * 3);
 	}
 
-	Mat image, prev_grey, grey, flow, prev_poly, poly;
-	std::list<Track> xyTracks;
-
-	int init_counter = 0; // indicate when to detect new feature points
-
-	ClearTrackPoints(trackInfo.length);
-
-	while(true) {
-		Mat frame;
-		int i, c;
-
-		// get a new frame
-		capture >> frame;
-		if(frame.empty())
-			break;
-
-		if(frame_num < start_frame || frame_num > end_frame)
-		{
-			frame_num++;
-			continue;
-		}
+	TrackSink* sink = CreateTrackSink(trackInfo.length);
+	if(!sink)
+		return -1;
 
-		if(frame_num == start_frame) {
-			image.create(frame.size(), CV_8UC3);
-			grey.create(frame.size(), CV_8UC1);
-			prev_grey.create(frame.size(), CV_8UC1);
+	// the descriptors are optional, they are computed for every point of every track
+	DescLayout descLayout;
+	InitDescLayout(&descLayout, patch_size, nxy_cell, nt_cell);
+	FrameTracker tracker(trackInfo, descLayout, params);
+	std::vector<TrackStore>& finishedTracks = tracker.finishedTracks;
+	std::vector<std::vector<TrackResult> >& results = tracker.results;
+	FeatureWriter features(descLayout, trackInfo);
+	if(compute_desc && !features.open(feature_file)) {
+		fprintf(stderr, "Could not create %s\n", feature_file);
+		return -1;
+	}
 
-			flow.create(frame.size(), CV_32FC2);
-			prev_poly.create(frame.size(),CV_32FC(5));
-			poly.create(frame.size(),CV_32FC(5));
+	// segment the trajectories while tracking instead of keeping all of them
+	StreamSegmenter segmenter(trackInfo.length);
+	if(stream_segm && !segmenter.open(segm_file)) {
+		fprintf(stderr, "Could not create %s\n", segm_file);
+		return -1;
+	}
 
-			frame.copyTo(image);
-			cvtColor(image, prev_grey, CV_BGR2GRAY);
+	// jump to the first frame of the window instead of decoding everything before it
+	int first_frame = SeekToFrame(source, start_frame);
 
-			std::vector<Point2f> points(0);
-			DenseSample(prev_grey, points, quality, min_distance);
+	// decoding, polynomial expansion and optical flow run ahead on their own threads
+	FramePipeline pipeline(params, source, first_frame, end_frame, pipeline_slots);
+	pipeline.start();
 
-			// save the feature points
-			for(i = 0; i < points.size(); i++)
-				xyTracks.push_back(Track(points[i]));
+	int slot, prev_slot = -1;
+	while((slot = pipeline.next()) >= 0) {
+		int i, c;
 
-			// compute polynomial expansion
-			my::FarnebackPolyExp2(prev_grey, prev_poly, 7, 1.5);
+		FrameSlot& cur = pipeline.slots[slot];
+		Mat& image = cur.frame;
+		frame_num = cur.frame_num;
+		Mat* draw_image = show_track == 1 ? &image : NULL;
 
-			frame_num++;
+		if(prev_slot < 0) {
+			UpdateSeqInfo(&seqInfo, image);
+			tracker.seed(cur, pipeline.fscales, draw_image);
+			prev_slot = slot;
 			continue;
 		}
 
-		init_counter++;
-		frame.copyTo(image);
-		cvtColor(image, grey, CV_BGR2GRAY);
-			  
-
 /////////////////////////////////////////////////////////////////////////////////
 
+		tracker.track(pipeline.slots[prev_slot], cur, pipeline.fscales, draw_image);
 
-		// compute optical flow for all scales once
-		my::FarnebackPolyExp2(grey, poly, 7, 1.5);
-		my::calcOpticalFlowFarneback2(prev_poly, poly, flow, 10, 2);
-
-		int width = grey.cols;
-		int height = grey.rows;
-
-		// track feature points
-		for (std::list<Track>::iterator iTrack = xyTracks.begin(); iTrack != xyTracks.end(); ++iTrack)
-		{
-			if(iTrack->tracking == true)
-			{
-				int index = iTrack->index;
-
-				Point2f prev_point = iTrack->point[index];
-				int x = std::min<int>(std::max<int>(cvRound(prev_point.x), 0), width-1);
-				int y = std::min<int>(std::max<int>(cvRound(prev_point.y), 0), height-1);
-
-				Point2f point;
-				point.x = prev_point.x + flow.ptr<float>(y)[2*x];
-				point.y = prev_point.y + flow.ptr<float>(y)[2*x+1];
-
-				//	printf("%f\n", point.x = prev_point.x);
-
-
-				if(point.x <= 0 || point.x >= width || point.y <= 0 || point.y >= height)
-				{
-					iTrack = xyTracks.erase(iTrack);
-					continue;
-				}
-
-				iTrack->addPoint(point);
-
-				
-				// if the trajectory achieves the maximal length
-				if(iTrack->index >= trackInfo.length)
-				{
-					// draw the trajectories at the first scale
-					if(show_track == 1)
-						DrawTrack(iTrack->point, iTrack->index, 1.0, 10, image);
-
-					std::vector<Point2f> trajectory(trackInfo.length+1);
-
-					for(int i = 0; i <= trackInfo.length; ++i)
-						trajectory[i] = iTrack->point[i];
-
-					float mean_x(0), mean_y(0), var_x(0), var_y(0), length(0);
-					
-					if(IsValid(trajectory, mean_x, mean_y, var_x, var_y, length))
-					{                       
-						// Here we are trying to segment trajectories belonding to hands
-						if(var_x > var_threshold || var_y > var_threshold)
-						{							
-							SaveTrackPoints(iTrack->point, trajectory, trackInfo.length, mean_x, mean_y, var_x, var_y, frame_num);
-
-							iTrack->tracking = false;
-							iTrack->frame_num = frame_num;
-						}
-					}
-					
-					if(iTrack->tracking)
-						iTrack = xyTracks.erase(iTrack);
-				}
+		// save in the order of the scales, so the output does not depend on the threads
+		for(size_t iScale = 0; iScale < results.size(); iScale++) {
+			for(i = 0; i < (int)results[iScale].size(); i++) {
+				TrackResult& result = results[iScale][i];
+				sink->write(finishedTracks[iScale].row(result.track), result.trajectory,
+					result.mean_x, result.mean_y, result.var_x, result.var_y, frame_num);
+				if(compute_desc)
+					features.write(result, frame_num, pipeline.fscales[iScale], seqInfo);
 			}
+			results[iScale].clear();
 		}
 
-		if(init_counter != trackInfo.gap)
-			continue;
-
-		// detect new feature points every initGap frames
-		std::vector<Point2f> points(0);
-		for(std::list<Track>::iterator iTrack = xyTracks.begin(); iTrack != xyTracks.end(); iTrack++)
-			if(iTrack->tracking == true)
-				points.push_back(iTrack->point[iTrack->index]);
- 
-
-		DenseSample(grey, points, quality, min_distance);
-		// save the new feature points
-		for(i = 0; i < points.size(); i++)
-			xyTracks.push_back(Track(points[i]));
-
+		if(stream_segm) {
+			for(size_t iScale = 0; iScale < finishedTracks.size(); iScale++)
+				segmenter.add(finishedTracks[iScale]);
+			segmenter.update(frame_num);
+		}
 
 /////////////////////////////////////////////////////////////////////////////////
 
-		init_counter = 0;
-		grey.copyTo(prev_grey);     
-		poly.copyTo(prev_poly);
-
-		frame_num++;
+		// the flow of the current frame is done, the previous slot can be refilled
+		pipeline.release(prev_slot);
+		prev_slot = slot;
 
 		//cvWaitKey(0);
 
@@ -193,21 +120,88 @@ int main(int argc, char** argv)
 		{
 			imshow( "DenseTrack", image);
 			c = cvWaitKey(3);
-			if((char)c == 27) break;
+			if((char)c == 27) {
+				// let the stages run dry before leaving
+				pipeline.stop();
+				while((slot = pipeline.next()) >= 0)
+					pipeline.release(slot);
+				break;
+			}
 
 		}
 	}
 
-	// Remove trajectories which not reached the needed length
-	for(std::list<Track>::iterator iTrack = xyTracks.begin(); iTrack != xyTracks.end(); iTrack++)
-			if(iTrack->tracking)
-				iTrack = xyTracks.erase(iTrack);
+	if(prev_slot >= 0)
+		pipeline.release(prev_slot);
+	pipeline.join();
+	*frames = pipeline.frame_count;
+
+	if(pipeline.end_of_stream && (!flag || end_frame == INT_MAX))
+		FinalizeSeqInfo(&seqInfo, first_frame, pipeline.frame_count);
+
+	// flush the trajectories before the segmentation
+	delete sink;
+
+	if(warm_iterations > 0 && pipeline.flow_count > 0) {
+		fprintf(stderr, "Warm-started flow: %d iterations instead of %d over %d frames\n",
+			pipeline.iteration_count, pipeline.flow_count*flow_iterations, pipeline.flow_count);
+		if(pipeline.epe_count > 0)
+			fprintf(stderr, "Mean end-point difference to the cold start: %f pixels (%d frames checked)\n",
+				pipeline.epe_sum/pipeline.epe_count, pipeline.epe_count);
+	}
+
+	if(pipeline.fscales.size() > 1 && pipeline.frame_count > 0)
+		fprintf(stderr, "Pyramid and polynomial expansion: %f ms per frame over %d levels (%s)\n",
+			pipeline.poly_time*1000/pipeline.frame_count, (int)pipeline.fscales.size(),
+			pyramid_cascade ? "cascaded" : "from the full frame");
+
+	if(compute_desc && compact_desc)
+		fprintf(stderr, "Compact histograms: cell sums within %f of the float ones\n", tracker.descExtractor.ErrorBound());
+
+	if(stream_segm)
+		segmenter.finish(frame_num);
+	else {
+		// trajectories which not reached the needed length are dropped, the finished
+		// ones go into one store, scale by scale
+		TrackStore xyTracks(trackInfo.length);
+		for(size_t iScale = 0; iScale < finishedTracks.size(); iScale++)
+			xyTracks.add(finishedTracks[iScale]);
 
-	ComputeTrajGraphs(xyTracks, trackInfo.length, &seqInfo);
+		ComputeTrajGraphs(xyTracks, trackInfo.length, &seqInfo);
+	}
 
 
 	if( show_track == 1 )
 		destroyWindow("DenseTrack");
 
 	return 0;
-}
\ No newline at end of file
+}
+
+// the video file, or the raw frames of -r
+int ProcessVideo(char* video, bool flag, int* frames)
+{
+	FrameSource* source = OpenFrameSource(video);
+	if(!source) {
+		fprintf(stderr, "Could not initialize capturing..\n");
+		return -1;
+	}
+	int code = ProcessFrames(*source, video, flag, frames);
+	delete source;
+	return code;
+}
+
+int main(int argc, char** argv)
+{
+	char* video = argv[1];
+	int flag = arg_parse(argc, argv);
+
+	// the workers of the batch start their own thread pools
+	if(batch_file)
+		return RunBatch(batch_file, flag, ProcessVideo);
+
+	InitThreadPool(num_threads);
+	int frames = 0;
+	int code = ProcessVideo(video, flag, &frames);
+	ReleaseThreadPool();
+	return code;
+}
@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <fstream>
 #include <iostream>
@@ -20,6 +21,14 @@ using namespace cv;
 int start_frame = 0;
 int end_frame = INT_MAX;
 int scale_num = 1;
+int probe_mode = 0;
+int raw_width = 0;      // read the video as raw I420 frames of this size, see RawYuvSource
+int raw_height = 0;
+int num_threads = 0;    // size of the shared thread pool, 0 means one per core
+int simd_limit = INT_MAX; // highest instruction set for the flow kernels, 0 forces the scalar code
+int pipeline_slots = 8; // frames in flight between the decoding, flow and tracking stages
+int pyramid_cascade = 1; // build each pyramid level from the one above instead of from the full frame
+int cache_pyramid = 0;   // sample new points on the float pyramid of the flow instead of resizing the grey frame
 const float scale_stride = sqrt(2);
 
 // parameters for descriptors
@@ -28,18 +37,48 @@ int nxy_cell = 2;
 int nt_cell = 3;
 float epsilon = 0.05;
 const float min_flow = 0.4;
+int compute_desc = 0; // compute the HOG, HOF and MBH descriptors of the trajectories
+const char* feature_file = "out_features.txt";
+int compact_desc = 0; // keep the integral histograms as 16-bit offsets in tiles, see CompactDescMat
+const int desc_tile = 32; // entries per side of a tile of a CompactDescMat
+
+// parameters for optical flow
+int flow_winsize = 10;
+int flow_iterations = 2;
+// iterations when starting from the previous flow, 0 to start from zero flow. Off by
+// default: with a single scale the warm flow feeds its own errors forward and drifts
+// from the cold one (6.5 pixels mean on the test videos), with -A 8 and 1 iteration
+// it saves about 30% of the flow time for 0.08 pixels
+int warm_iterations = 0;
+int warm_check_gap = 50; // compare a warm-started flow to the cold-started one every warm_check_gap frames
 
 // parameters for tracking
 double quality = 0.001;
 int min_distance = 5;
 int init_gap = 1;
 int track_length = 15;
+int track_bilinear = 0; // interpolate the flow at the sub-pixel track position instead of taking the nearest pixel
+int sparse_sample = 0;  // evaluate the corner response only at the empty cells of the sampling grid, see SparseSample
+
+// output of the accepted trajectories
+int output_format = 0;         // OUTPUT_TEXT, OUTPUT_BINARY or OUTPUT_COLUMNAR
+const char* track_file = NULL; // NULL for out_of_tracks.txt, .bin or .cols
+const char* debug_file = "out_of_tracks_debug.txt"; // points of the trajectories, text output only
+
+// segmentation of the hand trajectories
+int stream_segm = 0; // cluster every window as soon as its trajectories are finished instead of the densest one at the end
+const char* segm_file = "out_of_segments.txt"; // the clusters of the windows with stream_segm
 
 // parameters for rejecting trajectory
 const float min_var = sqrt(3);
 const float max_var = 50;
 const float max_dis = 20;
 
+// batch mode, the videos of a manifest on several processes
+const char* batch_file = NULL;                 // the manifest, see ReadManifest
+int batch_workers = 0;                         // videos processed at the same time, 0 for one per core
+const char* batch_report = "batch_report.txt"; // frames per second of every video
+
 typedef struct {
 	int x;       // top left corner
 	int y;
@@ -47,10 +86,23 @@ typedef struct {
 	int height;
 }RectInfo;
 
+// how InitSeqInfo gets the number of frames
+enum {
+    PROBE_HEADER = 0, // read it from the container headers, corrected at the end of the stream
+    PROBE_LAZY = 1    // leave it unknown (-1) until the end of the stream
+};
+
+// formats of the trajectory output, see Trajectories.h
+enum {
+    OUTPUT_TEXT = 0,    // out_of_tracks.txt and out_of_tracks_debug.txt
+    OUTPUT_BINARY = 1,  // one file of fixed-size little-endian records
+    OUTPUT_COLUMNAR = 2 // one array per field for mapping, see TrackFile.h
+};
+
 typedef struct {
     int width;   // resolution of the video
     int height;
-    int length;  // number of frames
+    int length;  // number of frames, -1 if not known yet
     char* video;
 }SeqInfo;
 
@@ -59,6 +111,27 @@ typedef struct {
     int gap;     // initialization gap for feature re-sampling 
 }TrackInfo;
 
+// the parameters of the pyramid, the flow, the sampling and the descriptors of one
+// video; DenseTrack takes them from the globals (InitTrackParams), the classes of the
+// frame loop keep their own copy, so that extractors with different ones can run
+// at the same time
+typedef struct {
+    int scale_num;       // at most, a small frame may have less levels
+    int patch_size;      // the smallest level is at least this large
+    int pyramid_cascade;
+    int cache_pyramid;
+    int flow_winsize;
+    int flow_iterations;
+    int warm_iterations;
+    int warm_check_gap;
+    int min_distance;
+    double quality;
+    int sparse_sample;
+    int track_bilinear;
+    int compute_desc;
+    int compact_desc;
+}TrackParams;
+
 typedef struct {
     int nBins;   // number of bins for vector quantization
     bool isHof; 
@@ -78,32 +151,245 @@ typedef struct {
     float* desc;
 }DescMat;
 
-class Track
+// integral histogram in tiles of desc_tile x desc_tile entries, for large frames:
+// the entries on the first row and the first column of every tile are kept in
+// float, an entry inside a tile is rebuilt from them and a 16-bit offset scaled
+// for its tile and bin, about 2.25 instead of 4 bytes per bin. The offset is the
+// sum over the tile part of the rectangle of the entry, so its rounding error is
+// at most half of the scale, which max_step collects for the error bound
+typedef struct {
+    int height;
+    int width;
+    int nBins;
+    int xTiles;
+    int yTiles;
+    float* rows;          // the first row of every row of tiles, height of yTiles
+    float* cols;          // the first column of every column of tiles, one after the other
+    float* scale;         // per tile and bin
+    unsigned short* offs; // the offsets of all entries, laid out as in DescMat
+    float* band;          // desc_tile+1 float rows while building, see DescRows
+    float max_step;       // the largest scale since the allocation
+}CompactDescMat;
+
+// the cells of min_distance pixels where DenseSample puts new points, with the
+// number of tracks whose last point is in each; a cell with a track gets no new
+// point. Cells are only counted once init() gave the grid a size.
+class SampleGrid
+{
+public:
+    int cell_size;
+    int width;              // cells in a row
+    int height;
+    std::vector<int> count; // tracks in each cell
+    float max_eig;          // maximum of the corner response, see SparseSample
+    int samples;            // calls of SparseSample since max_eig was taken from the whole frame
+
+    SampleGrid() : cell_size(0), width(0), height(0), max_eig(0), samples(0) {}
+
+    void init(int cols, int rows, int cell_size_)
+    {
+        cell_size = cell_size_;
+        width = cols/cell_size;
+        height = rows/cell_size;
+        count.assign(width*height, 0);
+        max_eig = 0;
+        samples = 0;
+    }
+
+    // the cell of a point, -1 outside of the grid
+    int cell(float x, float y) const
+    {
+        if(!cell_size)
+            return -1;
+        int cx = cvFloor(x);
+        int cy = cvFloor(y);
+        if(cx >= width*cell_size || cy >= height*cell_size)
+            return -1;
+        cx /= cell_size;
+        cy /= cell_size;
+        if(cx < 0 || cy < 0)
+            return -1;
+        return cy*width + cx;
+    }
+
+    void add(float x, float y)
+    {
+        int c = cell(x, y);
+        if(c >= 0)
+            count[c]++;
+    }
+
+    void remove(float x, float y)
+    {
+        int c = cell(x, y);
+        if(c >= 0)
+            count[c]--;
+    }
+
+    void move(float x, float y, float next_x, float next_y)
+    {
+        int c = cell(x, y), next = cell(next_x, next_y);
+        if(c != next) {
+            if(c >= 0)
+                count[c]--;
+            if(next >= 0)
+                count[next]++;
+        }
+    }
+};
+
+// tracks in structure-of-arrays layout: the last point of every track is kept in
+// the contiguous x/y arrays for the tracking loop, and all points of track i in a
+// fixed row of capacity = track_length+1 entries at row(i), which never wraps since
+// a track stops when its row is full. Tracks are stopped by clearing active[i] and
+// removed by Compact(), which keeps the order of the rest. With descriptors, every
+// track also has a slab at descRow(i) with desc_size floats for each point but the
+// last; the first index[i] of them are filled. Once initGrid() was called, the
+// last points of the tracks which are not removed yet are counted in grid.
+class TrackStore
 {
 public:
-    std::vector<Point2f> point;
-    //std::vector<float> hog;
-    //std::vector<float> hof;
-    //std::vector<float> mbhX;
-    //std::vector<float> mbhY;
-    int index;
-    bool tracking;
-    int frame_num;
+    int capacity;               // points per track
+    std::vector<float> x;       // last point of every track
+    std::vector<float> y;
+    std::vector<int> index;     // index of the last point in the row
+    std::vector<int> frame_num; // frame where the trajectory was finished
+    std::vector<uchar> active;  // 0 once the track stopped, until Compact()
+    std::vector<Point2f> points;
+    int desc_size;              // floats of descriptors per point, 0 without descriptors
+    std::vector<float> desc;
+    SampleGrid grid;
 
+    // output of the advection, kept so that tracking does not allocate every frame
+    std::vector<float> next_x;
+    std::vector<float> next_y;
+    std::vector<uchar> inside;
 
-    Track(const Point2f& point_/*, const TrackInfo& trackInfo, const DescInfo& hogInfo,
-          const DescInfo& hofInfo, const DescInfo& mbhInfo*/)
-        /*: point(trackInfo.length+1), hog(hogInfo.dim*trackInfo.length),
-          hof(hofInfo.dim*trackInfo.length), mbhX(mbhInfo.dim*trackInfo.length), mbhY(mbhInfo.dim*trackInfo.length)*/
-    {        
-        tracking = true;
-        point.push_back(point_);
+    TrackStore(int length = 0, int desc_size_ = 0) : capacity(length+1), desc_size(desc_size_) {}
+
+    int size() const
+    {
+        return x.size();
+    }
+
+    Point2f* row(int i)
+    {
+        return &points[(size_t)i*capacity];
+    }
+
+    const Point2f* row(int i) const
+    {
+        return &points[(size_t)i*capacity];
+    }
+
+    float* descRow(int i)
+    {
+        return &desc[(size_t)i*desc_size*(capacity-1)];
+    }
+
+    const float* descRow(int i) const
+    {
+        return &desc[(size_t)i*desc_size*(capacity-1)];
+    }
+
+    // count the tracks in a grid of cell_size pixels over a frame of cols x rows
+    void initGrid(int cols, int rows, int cell_size)
+    {
+        grid.init(cols, rows, cell_size);
+        for(int i = 0; i < size(); i++)
+            grid.add(x[i], y[i]);
+    }
+
+    // start a new track at point_
+    void add(const Point2f& point_)
+    {
+        grid.add(point_.x, point_.y);
+        x.push_back(point_.x);
+        y.push_back(point_.y);
+        index.push_back(0);
+        frame_num.push_back(0);
+        active.push_back(1);
+        points.resize(points.size() + capacity);
+        desc.resize(desc.size() + desc_size*(capacity-1));
+        row(size()-1)[0] = point_;
+    }
+
+    // copy all points of a full track, multiplied by scale
+    void add(const Point2f* point_, float scale, int frame_num_)
+    {
+        int last = capacity - 1;
+        add(point_[0]*scale);
+        Point2f* dst = row(size()-1);
+        for(int i = 1; i <= last; i++)
+            dst[i] = point_[i]*scale;
+        x.back() = dst[last].x;
+        y.back() = dst[last].y;
+        index.back() = last;
+        frame_num.back() = frame_num_;
+    }
+
+    // append all tracks of another store with the same capacity and descriptors
+    void add(const TrackStore& other)
+    {
+        x.insert(x.end(), other.x.begin(), other.x.end());
+        y.insert(y.end(), other.y.begin(), other.y.end());
+        index.insert(index.end(), other.index.begin(), other.index.end());
+        frame_num.insert(frame_num.end(), other.frame_num.begin(), other.frame_num.end());
+        active.insert(active.end(), other.active.begin(), other.active.end());
+        points.insert(points.end(), other.points.begin(), other.points.end());
+        desc.insert(desc.end(), other.desc.begin(), other.desc.end());
+        for(int i = 0; i < other.size(); i++)
+            grid.add(other.x[i], other.y[i]);
+    }
+
+    void addPoint(int i, const Point2f& point_)
+    {
+        grid.move(x[i], y[i], point_.x, point_.y);
+        x[i] = point_.x;
+        y[i] = point_.y;
+        row(i)[++index[i]] = point_;
+    }
+
+    // remove the stopped tracks
+    void Compact()
+    {
+        int n = size(), j = 0;
+        for(int i = 0; i < n; i++) {
+            if(!active[i]) {
+                grid.remove(x[i], y[i]);
+                continue;
+            }
+            if(i != j) {
+                x[j] = x[i];
+                y[j] = y[i];
+                index[j] = index[i];
+                frame_num[j] = frame_num[i];
+                active[j] = 1;
+                memcpy(row(j), row(i), (index[i]+1)*sizeof(Point2f));
+                if(desc_size)
+                    memcpy(descRow(j), descRow(i), index[i]*desc_size*sizeof(float));
+            }
+            j++;
+        }
+        resize(j);
+    }
+
+    void clear()
+    {
+        resize(0);
+        std::fill(grid.count.begin(), grid.count.end(), 0);
     }
 
-    void addPoint(const Point2f& point_)
+private:
+    void resize(int n)
     {
-        index++;
-        point.push_back(point_);
+        x.resize(n);
+        y.resize(n);
+        index.resize(n);
+        frame_num.resize(n);
+        active.resize(n);
+        points.resize((size_t)n*capacity);
+        desc.resize((size_t)n*desc_size*(capacity-1));
     }
 };
 
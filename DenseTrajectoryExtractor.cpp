@@ -0,0 +1,208 @@
+#include "DenseTrajectoryExtractor.h"
+
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "Descriptors.h"
+#include "OpticalFlow.h"
+#include "Trajectories.h"
+#include "Pipeline.h"
+#include "Features.h"
+#include "Tracker.h"
+
+#include <pthread.h>
+
+using namespace cv;
+
+// the extractors share the thread pool: the first one creates it, unless the
+// process has one already, and the last one releases it if it was created here
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int extractor_count = 0;
+static bool owns_pool = false;
+
+// the globals of the headers hold the defaults, the library never changes them
+// except simd_limit
+DenseTrackConfig::DenseTrackConfig()
+{
+	track_length = ::track_length;
+	init_gap = ::init_gap;
+	min_distance = ::min_distance;
+	quality = ::quality;
+	scale_num = ::scale_num;
+	sparse_sample = ::sparse_sample;
+	track_bilinear = ::track_bilinear;
+	pyramid_cascade = ::pyramid_cascade;
+	cache_pyramid = ::cache_pyramid;
+	flow_winsize = ::flow_winsize;
+	flow_iterations = ::flow_iterations;
+	warm_iterations = ::warm_iterations;
+	compute_desc = ::compute_desc;
+	compact_desc = ::compact_desc;
+	patch_size = ::patch_size;
+	nxy_cell = ::nxy_cell;
+	nt_cell = ::nt_cell;
+	simd_limit = ::simd_limit;
+	num_threads = ::num_threads;
+}
+
+static TrackParams MakeTrackParams(const DenseTrackConfig& config)
+{
+	TrackParams params;
+	params.scale_num = config.scale_num;
+	params.patch_size = config.patch_size;
+	params.pyramid_cascade = config.pyramid_cascade;
+	params.cache_pyramid = config.cache_pyramid;
+	params.flow_winsize = config.flow_winsize;
+	params.flow_iterations = config.flow_iterations;
+	params.warm_iterations = config.warm_iterations;
+	params.warm_check_gap = 0; // nobody reads the statistics
+	params.min_distance = config.min_distance;
+	params.quality = config.quality;
+	params.sparse_sample = config.sparse_sample;
+	params.track_bilinear = config.track_bilinear;
+	params.compute_desc = config.compute_desc;
+	params.compact_desc = config.compact_desc;
+	return params;
+}
+
+static TrackInfo MakeTrackInfo(const DenseTrackConfig& config)
+{
+	TrackInfo trackInfo;
+	InitTrackInfo(&trackInfo, config.track_length, config.init_gap);
+	return trackInfo;
+}
+
+static DescLayout MakeDescLayout(const DenseTrackConfig& config)
+{
+	DescLayout descLayout;
+	InitDescLayout(&descLayout, config.patch_size, config.nxy_cell, config.nt_cell);
+	return descLayout;
+}
+
+// the stages and the tracking of DenseTrack on two slots, the current frame and the
+// previous one whose polynomial expansion is the start of the flow
+struct DenseTrajectoryExtractor::Impl
+{
+	DenseTrackConfig config;
+	TrajectoryReceiver* receiver;
+	TrackParams params;
+	TrackInfo trackInfo;
+	DescLayout descLayout;
+	FrameStages stages;
+	FrameTracker tracker;
+	FrameSlot slots[2];
+	int frame_count;
+	std::vector<DenseTrajectory> finished; // of the last frame, for the receiver
+
+	Impl(const DenseTrackConfig& config_, TrajectoryReceiver* receiver_)
+		: config(config_), receiver(receiver_), params(MakeTrackParams(config_)), trackInfo(MakeTrackInfo(config_)),
+		  descLayout(MakeDescLayout(config_)), stages(params), tracker(trackInfo, descLayout, params), frame_count(0) {}
+
+	// the trajectories finished on this frame in the order of the scales, they are
+	// handed to the receiver once the frame is done
+	void Collect(int frame_num)
+	{
+		finished.clear();
+		for(size_t iScale = 0; iScale < tracker.results.size(); iScale++) {
+			std::vector<TrackResult>& results = tracker.results[iScale];
+			TrackStore& tracks = tracker.finishedTracks[iScale];
+
+			for(size_t i = 0; i < results.size(); i++) {
+				const TrackResult& result = results[i];
+				DenseTrajectory trajectory;
+				trajectory.frame_num = frame_num;
+				trajectory.scale = stages.fscales[iScale];
+				trajectory.mean_x = result.mean_x;
+				trajectory.mean_y = result.mean_y;
+				trajectory.var_x = result.var_x;
+				trajectory.var_y = result.var_y;
+				trajectory.length = result.length;
+
+				const Point2f* points = tracks.row(result.track);
+				trajectory.points.assign(points, points + trackInfo.length + 1);
+				trajectory.shape = result.trajectory;
+
+				if(config.compute_desc) {
+					const float* desc = &result.desc[0];
+					AverageDesc(desc, descLayout.size, descLayout.hogInfo, trackInfo, trajectory.hog);
+					AverageDesc(desc + descLayout.hofOffset, descLayout.size, descLayout.hofInfo, trackInfo, trajectory.hof);
+					AverageDesc(desc + descLayout.mbhXOffset, descLayout.size, descLayout.mbhInfo, trackInfo, trajectory.mbhx);
+					AverageDesc(desc + descLayout.mbhYOffset, descLayout.size, descLayout.mbhInfo, trackInfo, trajectory.mbhy);
+				}
+
+				finished.push_back(trajectory);
+			}
+
+			// nothing is kept for a segmentation at the end
+			results.clear();
+			tracks.clear();
+		}
+	}
+};
+
+DenseTrajectoryExtractor::DenseTrajectoryExtractor(const DenseTrackConfig& config, TrajectoryReceiver* receiver)
+{
+	pthread_mutex_lock(&pool_mutex);
+	if(extractor_count++ == 0) {
+		// the instruction sets are chosen for the whole process
+		simd_limit = config.simd_limit;
+		if(!thread_pool) {
+			InitThreadPool(config.num_threads);
+			owns_pool = true;
+		}
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	impl = new Impl(config, receiver);
+}
+
+DenseTrajectoryExtractor::~DenseTrajectoryExtractor()
+{
+	delete impl;
+
+	pthread_mutex_lock(&pool_mutex);
+	if(--extractor_count == 0 && owns_pool) {
+		ReleaseThreadPool();
+		owns_pool = false;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+bool DenseTrajectoryExtractor::pushFrame(const Mat& frame)
+{
+	if(frame.empty() || frame.type() != CV_8UC3)
+		return false;
+	if(impl->frame_count > 0 && frame.size() != impl->slots[0].grey_pyr[0].size())
+		return false;
+
+	int frame_num = impl->frame_count;
+	FrameSlot& cur = impl->slots[frame_num % 2];
+	FrameSlot& prev = impl->slots[(frame_num + 1) % 2];
+
+	// the grey pyramid is built from the frame of the caller, no copy is kept
+	cur.frame = frame;
+	impl->stages.Prepare(cur, frame_num);
+	impl->stages.Expand(cur);
+	cur.frame = Mat();
+
+	if(frame_num == 0)
+		impl->tracker.seed(cur, impl->stages.fscales, NULL);
+	else {
+		impl->stages.Flow(prev, cur);
+		impl->tracker.track(prev, cur, impl->stages.fscales, NULL);
+		impl->Collect(frame_num);
+	}
+
+	impl->frame_count++;
+
+	// the receiver may use other extractors
+	if(impl->receiver)
+		for(size_t i = 0; i < impl->finished.size(); i++)
+			impl->receiver->receive(impl->finished[i]);
+	impl->finished.clear();
+	return true;
+}
+
+int DenseTrajectoryExtractor::frameCount() const
+{
+	return impl->frame_count;
+}
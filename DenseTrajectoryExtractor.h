@@ -0,0 +1,94 @@
+#ifndef DENSETRAJECTORYEXTRACTOR_H_
+#define DENSETRAJECTORYEXTRACTOR_H_
+
+// The dense trajectories as a library: frames are pushed one by one and every
+// accepted trajectory is handed to a receiver as soon as it is finished. Only this
+// header is needed to use the library (release/DenseTrajectoryExtractor.so), the
+// other headers of DenseTrack are compiled into it.
+//
+// Each extractor has its own configuration and its own tracks. Extractors may push
+// frames from different threads at the same time, their work shares one thread
+// pool. The size of the pool and the instruction sets (num_threads, simd_limit)
+// are taken from the first extractor for the whole process.
+
+#include <opencv/cxcore.h>
+#include <vector>
+
+#define DENSETRACK_API __attribute__((visibility("default")))
+
+// the parameters of one extractor, the defaults are the ones of DenseTrack
+struct DENSETRACK_API DenseTrackConfig
+{
+	int track_length;    // -L
+	int init_gap;        // -I
+	int min_distance;    // -W
+	double quality;
+	int scale_num;       // -A
+	int sparse_sample;   // -M
+	int track_bilinear;  // -R
+	int pyramid_cascade; // -Y
+	int cache_pyramid;   // -C
+	int flow_winsize;
+	int flow_iterations;
+	int warm_iterations; // -F
+	int compute_desc;    // -X
+	int compact_desc;    // -H
+	int patch_size;      // -N
+	int nxy_cell;        // -s
+	int nt_cell;         // -t
+	int simd_limit;      // -V, for the whole process, taken from the first extractor
+	int num_threads;     // -T, the size of the pool shared by all extractors, taken from the first one
+
+	DenseTrackConfig();
+};
+
+// an accepted trajectory, in the coordinates of the full frame
+struct DenseTrajectory
+{
+	int frame_num;                   // the frame of its last point, counted from 0
+	float scale;                     // of the pyramid level it was tracked on
+	float mean_x;
+	float mean_y;
+	float var_x;
+	float var_y;
+	float length;
+	std::vector<cv::Point2f> points; // track_length+1 points
+	std::vector<cv::Point2f> shape;  // the track_length steps, normalized by the length
+	std::vector<float> hog;          // averaged over the temporal cells, empty without compute_desc
+	std::vector<float> hof;
+	std::vector<float> mbhx;
+	std::vector<float> mbhy;
+};
+
+class DENSETRACK_API TrajectoryReceiver
+{
+public:
+	virtual ~TrajectoryReceiver() {}
+
+	// called from pushFrame() once the frame is done, may push frames to other
+	// extractors but not to the one which calls it
+	virtual void receive(const DenseTrajectory& trajectory) = 0;
+};
+
+class DENSETRACK_API DenseTrajectoryExtractor
+{
+public:
+	DenseTrajectoryExtractor(const DenseTrackConfig& config, TrajectoryReceiver* receiver);
+	~DenseTrajectoryExtractor();
+
+	// a BGR frame (CV_8UC3) of the same size as the first one, returns false if it
+	// does not fit; the frame is not kept after the call
+	bool pushFrame(const cv::Mat& frame);
+
+	// the number of frames pushed so far
+	int frameCount() const;
+
+private:
+	struct Impl;
+	Impl* impl;
+
+	DenseTrajectoryExtractor(const DenseTrajectoryExtractor&);
+	DenseTrajectoryExtractor& operator=(const DenseTrajectoryExtractor&);
+};
+
+#endif /*DENSETRAJECTORYEXTRACTOR_H_*/
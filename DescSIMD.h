@@ -0,0 +1,308 @@
+#ifndef DESCSIMD_H_
+#define DESCSIMD_H_
+
+#include "DenseTrack.h"
+#include "FarnebackSIMD.h"
+
+#include <float.h>
+#include <immintrin.h>
+
+using namespace cv;
+
+// AVX2 and AVX-512 kernels for the rows of the integral histograms, see
+// BuildDescRow. Each row is done in two passes: the magnitude, the orientation and the two soft bins of
+// 8 or 16 pixels at a time, without branches (the zero bin of hof is a blend),
+// then the running sum of the row, whose bins fit in one register, is added to
+// the row above for every pixel. The orientation is the polynomial of OpenCV 2.4's
+// fastAtan2 evaluated without FMA, so with OpenCV 2.4 the histograms match the
+// scalar code bit for bit; newer fastAtan2 versions differ by a few 1e-3 degrees.
+
+// the two bins of the gradient (x, y) and the share of its magnitude in each,
+// the scalar reference of the first pass
+static inline void
+DescBins( float x, float y, bool isHof, int nBins, float angleBase,
+          int& bin0, int& bin1, float& mag0, float& mag1 )
+{
+    mag0 = sqrt(x*x + y*y);
+
+    // for the zero bin of hof, the last one
+    if( isHof && mag0 <= min_flow )
+    {
+        bin0 = nBins;
+        mag0 = 1.0;
+        bin1 = 0;
+        mag1 = 0;
+        return;
+    }
+
+    float angle = fastAtan2(y, x);
+    if( angle >= 360.f ) angle -= 360.f;
+
+    // split the mag to two adjacent bins, an angle just below 360 may round up to nBins
+    float fbin = angle * angleBase;
+    if( fbin >= nBins ) fbin -= nBins;
+    bin0 = cvFloor(fbin);
+    bin1 = (bin0+1)%nBins;
+
+    mag1 = (fbin - bin0)*mag0;
+    mag0 -= mag1;
+}
+
+static const float desc_atan2_p1 = 0.9997878412794807f*(float)(180/CV_PI);
+static const float desc_atan2_p3 = -0.3258083974640975f*(float)(180/CV_PI);
+static const float desc_atan2_p5 = 0.1555786518463281f*(float)(180/CV_PI);
+static const float desc_atan2_p7 = -0.04432655554792128f*(float)(180/CV_PI);
+
+__attribute__((target("avx2")))
+static void
+DescBins_AVX2( const float* xc, const float* yc, int width, bool isHof, int nBins, float angleBase,
+               int* bin0, int* bin1, float* mag0, float* mag1 )
+{
+    const __m256 sign = _mm256_set1_ps(-0.f), eps = _mm256_set1_ps((float)DBL_EPSILON), fzero = _mm256_setzero_ps();
+    const __m256 p1 = _mm256_set1_ps(desc_atan2_p1), p3 = _mm256_set1_ps(desc_atan2_p3);
+    const __m256 p5 = _mm256_set1_ps(desc_atan2_p5), p7 = _mm256_set1_ps(desc_atan2_p7);
+    const __m256 f90 = _mm256_set1_ps(90.f), f180 = _mm256_set1_ps(180.f), f360 = _mm256_set1_ps(360.f);
+    const __m256 fbins = _mm256_set1_ps((float)nBins), base = _mm256_set1_ps(angleBase);
+    const __m256 flow_min = _mm256_set1_ps(min_flow), fone = _mm256_set1_ps(1.f);
+    const __m256i ibins = _mm256_set1_epi32(nBins), ione = _mm256_set1_epi32(1), izero = _mm256_setzero_si256();
+    const __m256 hof = isHof ? _mm256_castsi256_ps(_mm256_set1_epi32(-1)) : fzero;
+
+    int j = 0;
+    for( ; j <= width - 8; j += 8 )
+    {
+        __m256 x = _mm256_loadu_ps(xc + j), y = _mm256_loadu_ps(yc + j);
+        __m256 mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+
+        // fastAtan2
+        __m256 ax = _mm256_andnot_ps(sign, x), ay = _mm256_andnot_ps(sign, y);
+        __m256 ge = _mm256_cmp_ps(ax, ay, _CMP_GE_OQ);
+        __m256 num = _mm256_blendv_ps(ax, ay, ge), den = _mm256_blendv_ps(ay, ax, ge);
+        __m256 c = _mm256_div_ps(num, _mm256_add_ps(den, eps)), c2 = _mm256_mul_ps(c, c);
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(p7, c2), p5);
+        a = _mm256_add_ps(_mm256_mul_ps(a, c2), p3);
+        a = _mm256_add_ps(_mm256_mul_ps(a, c2), p1);
+        a = _mm256_mul_ps(a, c);
+        a = _mm256_blendv_ps(_mm256_sub_ps(f90, a), a, ge);
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(f180, a), _mm256_cmp_ps(x, fzero, _CMP_LT_OQ));
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(f360, a), _mm256_cmp_ps(y, fzero, _CMP_LT_OQ));
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(a, f360), _mm256_cmp_ps(a, f360, _CMP_GE_OQ));
+
+        __m256 fbin = _mm256_mul_ps(a, base);
+        fbin = _mm256_blendv_ps(fbin, _mm256_sub_ps(fbin, fbins), _mm256_cmp_ps(fbin, fbins, _CMP_GE_OQ));
+        __m256 ffloor = _mm256_floor_ps(fbin);
+        __m256i b0 = _mm256_cvttps_epi32(ffloor);
+        __m256i b1 = _mm256_add_epi32(b0, ione);
+        b1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(b1, ibins), b1);
+
+        __m256 m1 = _mm256_mul_ps(_mm256_sub_ps(fbin, ffloor), mag);
+        __m256 m0 = _mm256_sub_ps(mag, m1);
+
+        // the zero bin of hof
+        __m256 zero_bin = _mm256_and_ps(hof, _mm256_cmp_ps(mag, flow_min, _CMP_LE_OQ));
+        __m256i izb = _mm256_castps_si256(zero_bin);
+        b0 = _mm256_blendv_epi8(b0, ibins, izb);
+        b1 = _mm256_blendv_epi8(b1, izero, izb);
+        m0 = _mm256_blendv_ps(m0, fone, zero_bin);
+        m1 = _mm256_blendv_ps(m1, fzero, zero_bin);
+
+        _mm256_storeu_si256((__m256i*)(bin0 + j), b0);
+        _mm256_storeu_si256((__m256i*)(bin1 + j), b1);
+        _mm256_storeu_ps(mag0 + j, m0);
+        _mm256_storeu_ps(mag1 + j, m1);
+    }
+
+    for( ; j < width; j++ )
+        DescBins(xc[j], yc[j], isHof, nBins, angleBase, bin0[j], bin1[j], mag0[j], mag1[j]);
+}
+
+// the first pass of a row, one entry per pixel
+class DescRowBuffer
+{
+public:
+    std::vector<int> bin0;
+    std::vector<int> bin1;
+    std::vector<float> mag0;
+    std::vector<float> mag1;
+    std::vector<float> sum; // running sum of the scalar code
+
+    void resize(int width, int nDims)
+    {
+        if( (int)bin0.size() < width )
+        {
+            bin0.resize(width);
+            bin1.resize(width);
+            mag0.resize(width);
+            mag1.resize(width);
+        }
+        sum.resize(nDims);
+    }
+};
+
+// one row of the integral histogram with nDims of 8 or 9 (hof), the 9th bin is
+// kept apart; out is the first pixel of the row, step floats below the row above
+__attribute__((target("avx2")))
+static void
+DescRow_AVX2( const float* xc, const float* yc, int width, float* out, int step,
+              int nDims, bool isHof, DescRowBuffer& buf )
+{
+    int hist_bins = isHof ? nDims-1 : nDims;
+    const float angleBase = float(hist_bins)/360.f;
+    buf.resize(width, nDims);
+    const int* bin0 = &buf.bin0[0];
+    const int* bin1 = &buf.bin1[0];
+    const float* mag0 = &buf.mag0[0];
+    const float* mag1 = &buf.mag1[0];
+    const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    DescBins_AVX2(xc, yc, width, isHof, hist_bins, angleBase, &buf.bin0[0], &buf.bin1[0], &buf.mag0[0], &buf.mag1[0]);
+
+    // summarization of the current line
+    __m256 sum = _mm256_setzero_ps();
+    float sum8 = 0;
+    for( int j = 0; j < width; j++, out += nDims )
+    {
+        __m256 add0 = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(iota, _mm256_set1_epi32(bin0[j]))), _mm256_set1_ps(mag0[j]));
+        __m256 add1 = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(iota, _mm256_set1_epi32(bin1[j]))), _mm256_set1_ps(mag1[j]));
+        sum = _mm256_add_ps(_mm256_add_ps(sum, add0), add1);
+        _mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out - step), sum));
+
+        if( nDims > 8 )
+        {
+            sum8 += bin0[j] == 8 ? mag0[j] : 0.f;
+            out[8] = out[8-step] + sum8;
+        }
+    }
+}
+
+// the first pass of a row 16 pixels at a time
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void
+DescBins_AVX512( const float* xc, const float* yc, int width, bool isHof, int nBins, float angleBase,
+                 int* bin0, int* bin1, float* mag0, float* mag1 )
+{
+    const __m512 sign = _mm512_set1_ps(-0.f), eps = _mm512_set1_ps((float)DBL_EPSILON), fzero = _mm512_setzero_ps();
+    const __m512 p1 = _mm512_set1_ps(desc_atan2_p1), p3 = _mm512_set1_ps(desc_atan2_p3);
+    const __m512 p5 = _mm512_set1_ps(desc_atan2_p5), p7 = _mm512_set1_ps(desc_atan2_p7);
+    const __m512 f90 = _mm512_set1_ps(90.f), f180 = _mm512_set1_ps(180.f), f360 = _mm512_set1_ps(360.f);
+    const __m512 fbins = _mm512_set1_ps((float)nBins), base = _mm512_set1_ps(angleBase);
+    const __m512 flow_min = _mm512_set1_ps(min_flow), fone = _mm512_set1_ps(1.f);
+    const __m512i ibins = _mm512_set1_epi32(nBins), ione = _mm512_set1_epi32(1), izero = _mm512_setzero_si512();
+
+    int j = 0;
+    for( ; j <= width - 16; j += 16 )
+    {
+        __m512 x = _mm512_loadu_ps(xc + j), y = _mm512_loadu_ps(yc + j);
+        __m512 mag = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y)));
+
+        // fastAtan2
+        __m512 ax = _mm512_castsi512_ps(_mm512_andnot_si512(_mm512_castps_si512(sign), _mm512_castps_si512(x)));
+        __m512 ay = _mm512_castsi512_ps(_mm512_andnot_si512(_mm512_castps_si512(sign), _mm512_castps_si512(y)));
+        __mmask16 ge = _mm512_cmp_ps_mask(ax, ay, _CMP_GE_OQ);
+        __m512 num = _mm512_mask_blend_ps(ge, ax, ay), den = _mm512_mask_blend_ps(ge, ay, ax);
+        __m512 c = _mm512_div_ps(num, _mm512_add_ps(den, eps)), c2 = _mm512_mul_ps(c, c);
+        __m512 a = _mm512_add_ps(_mm512_mul_ps(p7, c2), p5);
+        a = _mm512_add_ps(_mm512_mul_ps(a, c2), p3);
+        a = _mm512_add_ps(_mm512_mul_ps(a, c2), p1);
+        a = _mm512_mul_ps(a, c);
+        a = _mm512_mask_blend_ps(ge, _mm512_sub_ps(f90, a), a);
+        a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(x, fzero, _CMP_LT_OQ), f180, a);
+        a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(y, fzero, _CMP_LT_OQ), f360, a);
+        a = _mm512_mask_sub_ps(a, _mm512_cmp_ps_mask(a, f360, _CMP_GE_OQ), a, f360);
+
+        __m512 fbin = _mm512_mul_ps(a, base);
+        fbin = _mm512_mask_sub_ps(fbin, _mm512_cmp_ps_mask(fbin, fbins, _CMP_GE_OQ), fbin, fbins);
+        __m512 ffloor = _mm512_roundscale_ps(fbin, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512i b0 = _mm512_cvttps_epi32(ffloor);
+        __m512i b1 = _mm512_add_epi32(b0, ione);
+        b1 = _mm512_mask_mov_epi32(b1, _mm512_cmpeq_epi32_mask(b1, ibins), izero);
+
+        __m512 m1 = _mm512_mul_ps(_mm512_sub_ps(fbin, ffloor), mag);
+        __m512 m0 = _mm512_sub_ps(mag, m1);
+
+        // the zero bin of hof
+        if( isHof )
+        {
+            __mmask16 zero_bin = _mm512_cmp_ps_mask(mag, flow_min, _CMP_LE_OQ);
+            b0 = _mm512_mask_mov_epi32(b0, zero_bin, ibins);
+            b1 = _mm512_mask_mov_epi32(b1, zero_bin, izero);
+            m0 = _mm512_mask_mov_ps(m0, zero_bin, fone);
+            m1 = _mm512_mask_mov_ps(m1, zero_bin, fzero);
+        }
+
+        _mm512_storeu_si512(bin0 + j, b0);
+        _mm512_storeu_si512(bin1 + j, b1);
+        _mm512_storeu_ps(mag0 + j, m0);
+        _mm512_storeu_ps(mag1 + j, m1);
+    }
+
+    for( ; j < width; j++ )
+        DescBins(xc[j], yc[j], isHof, nBins, angleBase, bin0[j], bin1[j], mag0[j], mag1[j]);
+}
+
+// one row of the integral histogram with nDims up to 16, one masked register per pixel
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void
+DescRow_AVX512( const float* xc, const float* yc, int width, float* out, int step,
+                int nDims, bool isHof, DescRowBuffer& buf )
+{
+    int hist_bins = isHof ? nDims-1 : nDims;
+    const float angleBase = float(hist_bins)/360.f;
+    buf.resize(width, nDims);
+    const int* bin0 = &buf.bin0[0];
+    const int* bin1 = &buf.bin1[0];
+    const float* mag0 = &buf.mag0[0];
+    const float* mag1 = &buf.mag1[0];
+    const __mmask16 dims = (__mmask16)((1 << nDims) - 1);
+
+    DescBins_AVX512(xc, yc, width, isHof, hist_bins, angleBase, &buf.bin0[0], &buf.bin1[0], &buf.mag0[0], &buf.mag1[0]);
+
+    // summarization of the current line
+    __m512 sum = _mm512_setzero_ps();
+    for( int j = 0; j < width; j++, out += nDims )
+    {
+        sum = _mm512_mask_add_ps(sum, (__mmask16)(1 << bin0[j]), sum, _mm512_set1_ps(mag0[j]));
+        sum = _mm512_mask_add_ps(sum, (__mmask16)(1 << bin1[j]), sum, _mm512_set1_ps(mag1[j]));
+        _mm512_mask_storeu_ps(out, dims, _mm512_add_ps(_mm512_maskz_loadu_ps(dims, out - step), sum));
+    }
+}
+
+// the 16-bit offsets of n entries of a CompactDescMat from the entries in, the
+// first row of their tile top and the first column base, see PackDescBand
+static inline void
+PackDescRow( const float* in, const float* top, const float* base, const float* inv,
+             unsigned short* out, int n )
+{
+    for( int k = 0; k < n; k++ )
+    {
+        float offset = (in[k] - top[k] - base[k])*inv[k] + 0.5f;
+        offset = offset > 0 ? offset : 0;
+        out[k] = (unsigned short)(int)(offset < 65535 ? offset : 65535);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+PackDescRow_AVX2( const float* in, const float* top, const float* base, const float* inv,
+                  unsigned short* out, int n )
+{
+    const __m256 half = _mm256_set1_ps(0.5f), fzero = _mm256_setzero_ps(), fmax = _mm256_set1_ps(65535.f);
+
+    int k = 0;
+    for( ; k <= n - 16; k += 16 )
+    {
+        __m256 a = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(in + k), _mm256_loadu_ps(top + k)), _mm256_loadu_ps(base + k));
+        __m256 b = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(in + k + 8), _mm256_loadu_ps(top + k + 8)), _mm256_loadu_ps(base + k + 8));
+        a = _mm256_add_ps(_mm256_mul_ps(a, _mm256_loadu_ps(inv + k)), half);
+        b = _mm256_add_ps(_mm256_mul_ps(b, _mm256_loadu_ps(inv + k + 8)), half);
+        a = _mm256_min_ps(_mm256_max_ps(a, fzero), fmax);
+        b = _mm256_min_ps(_mm256_max_ps(b, fzero), fmax);
+
+        // packus works within the 128-bit lanes
+        __m256i p = _mm256_packus_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        _mm256_storeu_si256((__m256i*)(out + k), _mm256_permute4x64_epi64(p, 0xD8));
+    }
+
+    PackDescRow(in + k, top + k, base + k, inv + k, out + k, n - k);
+}
+
+#endif /*DESCSIMD_H_*/
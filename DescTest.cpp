@@ -0,0 +1,251 @@
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "Descriptors.h"
+
+// The integral histograms of the AVX2 and AVX-512 rows against the scalar row
+// of BuildDescMatScalar, for hog, hof and mbh and at every -V level this cpu
+// supports. The gradients include zero and sub-min_flow vectors, the axes and
+// angles just below 360 degrees. With the fastAtan2 of OpenCV 2.4 the rows
+// match bit for bit, newer versions are within 1e-4 of the largest value.
+// MotionDescComp must give the histograms of HofComp and MbhComp bit for bit.
+// The cell sums of a CompactDescMat, up to 1280x720, must be those of the float
+// histogram within 2*max_step and the float rounding of the entries.
+//
+// usage: DescTest
+
+using namespace cv;
+
+static float RandomFloat(float low, float high)
+{
+	return low + (high - low)*(rand()/(float)RAND_MAX);
+}
+
+// one gradient of the special cases or a random one
+static void RandomGradient(float& x, float& y)
+{
+	float mag = RandomFloat(0, 20);
+	switch(rand()%10) {
+	case 0:
+		x = y = 0;
+		break;
+	case 1: // around the zero bin of hof
+		x = RandomFloat(-1, 1)*min_flow;
+		y = RandomFloat(-1, 1)*min_flow;
+		break;
+	case 2:
+		x = min_flow;
+		y = 0;
+		break;
+	case 3: // just below 360 degrees and just above 0
+		x = mag;
+		y = (rand()%2 ? -1 : 1)*mag*RandomFloat(0, 1e-6f);
+		break;
+	case 4: // on an axis
+		x = rand()%2 ? mag : 0;
+		y = x == 0 ? (rand()%2 ? mag : -mag) : 0;
+		break;
+	case 5: // on a diagonal
+		x = rand()%2 ? mag : -mag;
+		y = rand()%2 ? mag : -mag;
+		break;
+	default:
+		x = RandomFloat(-20, 20);
+		y = RandomFloat(-20, 20);
+	}
+}
+
+static const char* LevelName(int level)
+{
+	return level == my::SIMD_AVX512 ? "AVX-512" : level == my::SIMD_AVX2 ? "AVX2" : "scalar";
+}
+
+// returns the number of failed levels
+static int Check(int width, int height, int nBins, bool isHof, int max_level)
+{
+	Mat xComp(height, width, CV_32FC1), yComp(height, width, CV_32FC1);
+	for(int i = 0; i < height; i++)
+		for(int j = 0; j < width; j++)
+			RandomGradient(xComp.ptr<float>(i)[j], yComp.ptr<float>(i)[j]);
+
+	DescInfo descInfo;
+	InitDescInfo(&descInfo, nBins, isHof, 32, 2, 3);
+
+	size_t size = (size_t)(height+1)*(width+1)*nBins;
+	std::vector<float> ref(size, 0.f);
+	BuildDescMatScalar(xComp, yComp, &ref[0], descInfo);
+
+	float scale = 0;
+	for(size_t k = 0; k < size; k++)
+		scale = std::max(scale, fabsf(ref[k]));
+
+	int failed = 0;
+	for(int level = my::SIMD_AVX2; level <= max_level; level++) {
+		simd_limit = level;
+		int used = DescSimdLevel(nBins);
+		if(used != level)
+			continue;
+
+		std::vector<float> desc(size, 0.f);
+		BuildDescMat(xComp, yComp, &desc[0], descInfo, used);
+
+		float error = 0;
+		for(size_t k = 0; k < size; k++)
+			error = std::max(error, fabsf(desc[k] - ref[k]));
+		if(error > 1e-4f*scale) {
+			fprintf(stderr, "%dx%d, %d bins%s: %s error %g of %g\n",
+				width, height, nBins, isHof ? " hof" : "", LevelName(level), error, scale);
+			failed++;
+		}
+	}
+	simd_limit = INT_MAX;
+	return failed;
+}
+
+// returns the number of histograms of MotionDescComp which differ from the ones
+// of HofComp and MbhComp on a random flow
+static int CheckMotion(int width, int height, int max_level)
+{
+	Mat flow(height, width, CV_32FC2);
+	for(int i = 0; i < height; i++)
+		for(int j = 0; j < width; j++)
+			RandomGradient(flow.ptr<float>(i)[2*j], flow.ptr<float>(i)[2*j+1]);
+
+	DescInfo hofInfo, mbhInfo;
+	InitDescInfo(&hofInfo, 9, true, 32, 2, 3);
+	InitDescInfo(&mbhInfo, 8, false, 32, 2, 3);
+	size_t hofSize = (size_t)(height+1)*(width+1)*hofInfo.nBins;
+	size_t mbhSize = (size_t)(height+1)*(width+1)*mbhInfo.nBins;
+
+	int failed = 0;
+	for(int level = my::SIMD_NONE; level <= max_level; level++) {
+		simd_limit = level;
+
+		std::vector<float> hof(hofSize, 0.f), mbhX(mbhSize, 0.f), mbhY(mbhSize, 0.f);
+		HofComp(flow, &hof[0], hofInfo);
+		MbhComp(flow, &mbhX[0], &mbhY[0], mbhInfo);
+
+		std::vector<float> motionHof(hofSize, 0.f), motionX(mbhSize, 0.f), motionY(mbhSize, 0.f);
+		MotionDescComp(flow, &motionHof[0], &motionX[0], &motionY[0], hofInfo, mbhInfo);
+
+		const char* names[3] = { "hof", "mbh x", "mbh y" };
+		bool same[3] = { hof == motionHof, mbhX == motionX, mbhY == motionY };
+		for(int k = 0; k < 3; k++) {
+			if(!same[k]) {
+				fprintf(stderr, "%dx%d: %s %s of MotionDescComp differs\n",
+					width, height, LevelName(level), names[k]);
+				failed++;
+			}
+		}
+	}
+	simd_limit = INT_MAX;
+	return failed;
+}
+
+// the sum of the cell (x, y, w, h) over all bins of a float and of a compact
+// integral histogram of the same width
+static void CellSum(const float* desc, int width, int nBins, int x, int y, int w, int h, float* sum)
+{
+	const float* top_left = desc + ((long)y*width + x)*nBins;
+	const float* top_right = top_left + w*nBins;
+	const float* bottom_left = top_left + (long)h*width*nBins;
+	const float* bottom_right = bottom_left + w*nBins;
+	for(int i = 0; i < nBins; i++)
+		sum[i] = bottom_right[i] + top_left[i] - bottom_left[i] - top_right[i];
+}
+
+static void CellSum(const CompactDescMat* descMat, int x, int y, int w, int h, float* sum)
+{
+	std::fill(sum, sum + descMat->nBins, 0.f);
+	AddCompactDesc(descMat, y + h, x + w, 1, sum);
+	AddCompactDesc(descMat, y, x, 1, sum);
+	AddCompactDesc(descMat, y + h, x, -1, sum);
+	AddCompactDesc(descMat, y, x + w, -1, sum);
+}
+
+// returns the number of failed levels: the cell sums of GetDesc on a CompactDescMat
+// against the ones of the float histogram built on the same level, for random
+// cells, cells of one entry, whole tiles and the whole frame. They must agree
+// within ErrorBound() of DescExtractor, 2*max_step, plus the float rounding of
+// the entries of both, 2*FLT_EPSILON of the largest one (0.25 at 1280x720)
+static int CheckCompact(int width, int height, int nBins, bool isHof, int max_level)
+{
+	Mat xComp(height, width, CV_32FC1), yComp(height, width, CV_32FC1);
+	for(int i = 0; i < height; i++)
+		for(int j = 0; j < width; j++)
+			RandomGradient(xComp.ptr<float>(i)[j], yComp.ptr<float>(i)[j]);
+
+	DescInfo descInfo;
+	InitDescInfo(&descInfo, nBins, isHof, 32, 2, 3);
+	int w = width+1, h = height+1;
+
+	std::vector<int> cells;
+	for(int k = 0; k < 2000; k++) {
+		int cw = 1 + rand()%std::min(width, 4*desc_tile), ch = 1 + rand()%std::min(height, 4*desc_tile);
+		int cell[4] = { rand()%(w - cw), rand()%(h - ch), cw, ch };
+		cells.insert(cells.end(), cell, cell + 4);
+	}
+	int fixed[][4] = { {0, 0, width, height}, {0, 0, 1, 1}, {width-1, height-1, 1, 1},
+		{0, 0, std::min(width, desc_tile), std::min(height, desc_tile)} };
+	for(int k = 0; k < 4; k++)
+		cells.insert(cells.end(), fixed[k], fixed[k] + 4);
+
+	int failed = 0;
+	for(int level = my::SIMD_NONE; level <= max_level; level++) {
+		simd_limit = level;
+		int used = DescSimdLevel(nBins);
+		if(used != level)
+			continue;
+
+		std::vector<float> desc((size_t)h*w*nBins, 0.f);
+		BuildDescMat(xComp, yComp, &desc[0], descInfo, used);
+		CompactDescMat* compact = InitCompactDescMat(h, w, nBins);
+		DescRows rows(compact);
+		BuildDescMat(xComp, yComp, rows, descInfo, used);
+
+		float scale = 0;
+		for(size_t k = 0; k < desc.size(); k++)
+			scale = std::max(scale, fabsf(desc[k]));
+		float bound = 2*compact->max_step + 2*FLT_EPSILON*scale;
+
+		float error = 0;
+		std::vector<float> sum(nBins), compactSum(nBins);
+		for(size_t k = 0; k < cells.size(); k += 4) {
+			CellSum(&desc[0], w, nBins, cells[k], cells[k+1], cells[k+2], cells[k+3], &sum[0]);
+			CellSum(compact, cells[k], cells[k+1], cells[k+2], cells[k+3], &compactSum[0]);
+			for(int i = 0; i < nBins; i++)
+				error = std::max(error, fabsf(sum[i] - compactSum[i]));
+		}
+		if(error > bound) {
+			fprintf(stderr, "%dx%d, %d bins%s: %s compact error %g, bound %g (max_step %g of %g)\n",
+				width, height, nBins, isHof ? " hof" : "", LevelName(level), error, bound, compact->max_step, scale);
+			failed++;
+		}
+		ReleCompactDescMat(compact);
+	}
+	simd_limit = INT_MAX;
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	static const int sizes[][2] = { {320, 240}, {37, 29}, {17, 3}, {8, 8}, {7, 5}, {1, 1} };
+	// hog and mbh, hof with its zero bin, and counts only the AVX-512 rows take
+	static const int bins[][2] = { {8, 0}, {9, 1}, {12, 0}, {16, 1} };
+	int max_level = my::DetectSimdLevel();
+
+	int failed = 0, runs = 0;
+	srand(0);
+	for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+		for(size_t b = 0; b < sizeof(bins)/sizeof(bins[0]); b++, runs++)
+			failed += Check(sizes[i][0], sizes[i][1], bins[b][0], bins[b][1] != 0, max_level);
+	for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++, runs++)
+		failed += CheckMotion(sizes[i][0], sizes[i][1], max_level);
+	// the compact histograms are meant for large frames
+	static const int compact_sizes[][2] = { {1280, 720}, {640, 480}, {100, 70}, {33, 33}, {17, 3}, {1, 1} };
+	for(size_t i = 0; i < sizeof(compact_sizes)/sizeof(compact_sizes[0]); i++)
+		for(size_t b = 0; b < sizeof(bins)/sizeof(bins[0]); b++, runs++)
+			failed += CheckCompact(compact_sizes[i][0], compact_sizes[i][1], bins[b][0], bins[b][1] != 0, max_level);
+
+	printf("Descriptors: %d runs up to %s, %d failed\n", runs, LevelName(max_level), failed);
+	return failed == 0 ? 0 : 1;
+}
@@ -2,6 +2,7 @@
 #define DESCRIPTORS_H_
 
 #include "DenseTrack.h"
+#include "DescSIMD.h"
 using namespace cv;
 
 // get the rectangle for computing the descriptor
@@ -18,65 +19,195 @@ void GetRect(const Point2f& point, RectInfo& rect, const int width, const int he
 	rect.height = descInfo.height;
 }
 
-// compute integral histograms for the whole image
-void BuildDescMat(const Mat& xComp, const Mat& yComp, float* desc, const DescInfo& descInfo)
+// the instruction set of the histogram rows for nBins on the best one allowed by simd_limit
+int DescSimdLevel(int nBins)
 {
+	int level = my::FarnebackSimdLevel();
+	if(level >= my::SIMD_AVX512 && nBins <= 16)
+		return my::SIMD_AVX512;
+	if(level >= my::SIMD_AVX2 && (nBins == 8 || nBins == 9))
+		return my::SIMD_AVX2;
+	return my::SIMD_NONE;
+}
+
+// one row of an integral histogram from the gradients (xc, yc) of width pixels,
+// out is its first pixel and out-step the same pixel of the row above
+void BuildDescRow(int level, const float* xc, const float* yc, int width, float* out, int step,
+                  const DescInfo& descInfo, DescRowBuffer& buf)
+{
+	if(level == my::SIMD_AVX512) {
+		DescRow_AVX512(xc, yc, width, out, step, descInfo.nBins, descInfo.isHof, buf);
+		return;
+	}
+	if(level == my::SIMD_AVX2) {
+		DescRow_AVX2(xc, yc, width, out, step, descInfo.nBins, descInfo.isHof, buf);
+		return;
+	}
+
 	float maxAngle = 360.f;
 	int nDims = descInfo.nBins;
 	// one more bin for hof
 	int nBins = descInfo.isHof ? descInfo.nBins-1 : descInfo.nBins;
 	const float angleBase = float(nBins)/maxAngle;
 
-	int step = (xComp.cols+1)*nDims;
-	int index = step + nDims;
-	for(int i = 0; i < xComp.rows; i++, index += nDims) {
-		const float* xc = xComp.ptr<float>(i);
-		const float* yc = yComp.ptr<float>(i);
-
-		// summarization of the current line
-		std::vector<float> sum(nDims);
-		for(int j = 0; j < xComp.cols; j++) {
-			float x = xc[j];
-			float y = yc[j];
-			float mag0 = sqrt(x*x + y*y);
-			float mag1;
-			int bin0, bin1;
-
-			// for the zero bin of hof
-			if(descInfo.isHof && mag0 <= min_flow) {
-				bin0 = nBins; // the zero bin is the last one
-				mag0 = 1.0;
-				bin1 = 0;
-				mag1 = 0;
-			}
-			else {
-				float angle = fastAtan2(y, x);
-				if(angle >= maxAngle) angle -= maxAngle;
-
-				// split the mag to two adjacent bins
-				float fbin = angle * angleBase;
-				bin0 = cvFloor(fbin);
-				bin1 = (bin0+1)%nBins;
-
-				mag1 = (fbin - bin0)*mag0;
-				mag0 -= mag1;
-			}
-
-			sum[bin0] += mag0;
-			sum[bin1] += mag1;
-
-			for(int m = 0; m < nDims; m++, index++)
-				desc[index] = desc[index-step] + sum[m];
+	// summarization of the current line
+	buf.resize(0, nDims);
+	float* sum = &buf.sum[0];
+	std::fill(sum, sum + nDims, 0.f);
+	for(int j = 0; j < width; j++, out += nDims) {
+		int bin0, bin1;
+		float mag0, mag1;
+		DescBins(xc[j], yc[j], descInfo.isHof, nBins, angleBase, bin0, bin1, mag0, mag1);
+
+		sum[bin0] += mag0;
+		sum[bin1] += mag1;
+
+		for(int m = 0; m < nDims; m++)
+			out[m] = out[m-step] + sum[m];
+	}
+}
+
+// pack the integral rows y0 to y0+nRows-1 of band, one row of tiles, into descMat
+void PackDescBand(CompactDescMat* descMat, const float* band, int y0, int nRows)
+{
+	int width = descMat->width;
+	int nBins = descMat->nBins;
+	int step = width*nBins;
+	int ty = y0/desc_tile;
+	memcpy(descMat->rows + (long)ty*step, band, step*sizeof(float));
+
+	// the offset of an entry is its value minus the entries above it on the first row
+	// and on the first column of its tile, plus the first entry of the tile. The
+	// scale of a tile and bin comes from its last entry, where the offsets are
+	// largest since the histogram only grows to the right and down
+	std::vector<float> inv(step), base(step);
+	for(int tx = 0; tx < descMat->xTiles; tx++) {
+		int x0 = tx*desc_tile;
+		int n = (std::min(x0 + desc_tile, width) - x0)*nBins;
+		const float* first = band + x0*nBins;
+		const float* last_row = first + n - nBins;
+		const float* last_col = first + (nRows-1)*step;
+		const float* last = last_col + n - nBins;
+		float* scale = descMat->scale + ((long)ty*descMat->xTiles + tx)*nBins;
+		for(int i = 0; i < nBins; i++) {
+			float range = last[i] - last_row[i] - last_col[i] + first[i];
+			scale[i] = range > 0 ? range/65535 : 0;
+			inv[x0*nBins+i] = range > 0 ? 1/scale[i] : 0;
+			descMat->max_step = std::max<float>(descMat->max_step, scale[i]);
 		}
+		for(int k = nBins; k < n; k += k)
+			memcpy(&inv[x0*nBins+k], &inv[x0*nBins], std::min(k, n-k)*sizeof(float));
+	}
+
+	// row by row over all tiles, with the first column of every tile repeated over
+	// the tile by doubling copies like the inverse scales
+	for(int y = 0; y < nRows; y++) {
+		const float* in = band + (long)y*step;
+		unsigned short* out = descMat->offs + (long)(y0+y)*step;
+		for(int tx = 0; tx < descMat->xTiles; tx++) {
+			int x0 = tx*desc_tile;
+			int n = (std::min(x0 + desc_tile, width) - x0)*nBins;
+			memcpy(descMat->cols + ((long)tx*descMat->height + y0+y)*nBins, in + x0*nBins, nBins*sizeof(float));
+			float* b = &base[x0*nBins];
+			for(int i = 0; i < nBins; i++)
+				b[i] = in[x0*nBins+i] - band[x0*nBins+i];
+			for(int k = nBins; k < n; k += k)
+				memcpy(b + k, b, std::min(k, n-k)*sizeof(float));
+		}
+
+		if(my::FarnebackSimdLevel() >= my::SIMD_AVX2)
+			PackDescRow_AVX2(in, band, &base[0], &inv[0], out, step);
+		else
+			PackDescRow(in, band, &base[0], &inv[0], out, step);
 	}
 }
 
-// get a descriptor from the integral histogram
-void GetDesc(const DescMat* descMat, RectInfo& rect, DescInfo descInfo, std::vector<float>& desc, const int index)
+// the rows of an integral histogram while it is built: row(r) is its r-th row and
+// row(r)-step the row above. With a DescMat these are its own rows, with a
+// CompactDescMat the rows of the current row of tiles in its band, which is packed
+// when the builder is done with the last of them
+class DescRows
+{
+public:
+	int step;
+
+	DescRows(float* desc_, int width, int nBins) : step(width*nBins), desc(desc_), compact(NULL), y0(0) {}
+
+	DescRows(CompactDescMat* compact_) : step(compact_->width*compact_->nBins), desc(compact_->band), compact(compact_), y0(0)
+	{
+		// the first row and column of the integral histogram are zero
+		memset(desc, 0, (long)(desc_tile+1)*step*sizeof(float));
+	}
+
+	float* row(int r)
+	{
+		return compact ? desc + (long)(r - y0 + 1)*step : desc + (long)r*step;
+	}
+
+	// the builder wrote row r
+	void done(int r)
+	{
+		if(!compact)
+			return;
+		int nRows = r - y0 + 1;
+		if(nRows == desc_tile || r == compact->height-1) {
+			PackDescBand(compact, desc + step, y0, nRows);
+			memcpy(desc, desc + (long)nRows*step, step*sizeof(float));
+			y0 = r + 1;
+		}
+	}
+
+private:
+	float* desc;
+	CompactDescMat* compact;
+	int y0; // first row of the band
+};
+
+// compute integral histograms for the whole image on the given instruction set
+void BuildDescMat(const Mat& xComp, const Mat& yComp, DescRows& rows, const DescInfo& descInfo, int level)
+{
+	DescRowBuffer buf;
+	for(int i = 0; i < xComp.rows; i++) {
+		BuildDescRow(level, xComp.ptr<float>(i), yComp.ptr<float>(i), xComp.cols, rows.row(i+1) + descInfo.nBins, rows.step, descInfo, buf);
+		rows.done(i+1);
+	}
+}
+
+void BuildDescMat(const Mat& xComp, const Mat& yComp, float* desc, const DescInfo& descInfo, int level)
+{
+	DescRows rows(desc, xComp.cols+1, descInfo.nBins);
+	BuildDescMat(xComp, yComp, rows, descInfo, level);
+}
+
+// the scalar reference
+void BuildDescMatScalar(const Mat& xComp, const Mat& yComp, float* desc, const DescInfo& descInfo)
+{
+	BuildDescMat(xComp, yComp, desc, descInfo, my::SIMD_NONE);
+}
+
+// the integral histogram on the best instruction set allowed by simd_limit
+void BuildDescMat(const Mat& xComp, const Mat& yComp, float* desc, const DescInfo& descInfo)
+{
+	BuildDescMat(xComp, yComp, desc, descInfo, DescSimdLevel(descInfo.nBins));
+}
+
+// the L1 normalization and the square root of a descriptor
+void NormDesc(float* desc, int dim)
+{
+	float norm = 0;
+	for(int i = 0; i < dim; i++)
+		norm += desc[i];
+	if(norm > 0) norm = 1./norm;
+
+	for(int i = 0; i < dim; i++)
+		desc[i] = sqrt(desc[i]*norm);
+}
+
+// get a descriptor from the integral histogram, the dim values are written to desc
+void GetDesc(const DescMat* descMat, const RectInfo& rect, const DescInfo& descInfo, float* desc)
 {
 	int dim = descInfo.dim;
 	int nBins = descInfo.nBins;
-	int height = descMat->height;
 	int width = descMat->width;
 
 	int xStride = rect.width/descInfo.nxCells;
@@ -86,7 +217,6 @@ void GetDesc(const DescMat* descMat, RectInfo& rect, DescInfo descInfo, std::vec
 
 	// iterate over different cells
 	int iDesc = 0;
-	std::vector<float> vec(dim);
 	for(int xPos = rect.x, x = 0; x < descInfo.nxCells; xPos += xStride, x++)
 	for(int yPos = rect.y, y = 0; y < descInfo.nyCells; yPos += yStride, y++) {
 		// get the positions in the integral histogram
@@ -97,27 +227,74 @@ void GetDesc(const DescMat* descMat, RectInfo& rect, DescInfo descInfo, std::vec
 
 		for(int i = 0; i < nBins; i++) {
 			float sum = bottom_right[i] + top_left[i] - bottom_left[i] - top_right[i];
-			vec[iDesc++] = std::max<float>(sum, 0) + epsilon;
+			desc[iDesc++] = std::max<float>(sum, 0) + epsilon;
 		}
 	}
 
-	float norm = 0;
-	for(int i = 0; i < dim; i++)
-		norm += vec[i];
-	if(norm > 0) norm = 1./norm;
+	NormDesc(desc, dim);
+}
 
-	int pos = index*dim;
-	for(int i = 0; i < dim; i++)
-		desc[pos++] = sqrt(vec[i]*norm);
+// add sign times the entry (y, x) of a compact integral histogram to sum
+inline void AddCompactDesc(const CompactDescMat* descMat, int y, int x, float sign, float* sum)
+{
+	int nBins = descMat->nBins;
+	int ty = y/desc_tile, tx = x/desc_tile;
+	const float* row = descMat->rows + ((long)ty*descMat->width + x)*nBins;
+	const float* first = descMat->rows + ((long)ty*descMat->width + tx*desc_tile)*nBins;
+	const float* col = descMat->cols + ((long)tx*descMat->height + y)*nBins;
+	const float* scale = descMat->scale + ((long)ty*descMat->xTiles + tx)*nBins;
+	const unsigned short* offs = descMat->offs + ((long)y*descMat->width + x)*nBins;
+
+	for(int i = 0; i < nBins; i++)
+		sum[i] += sign*(col[i] + ((row[i] - first[i]) + offs[i]*scale[i]));
+}
+
+// get a descriptor from a compact integral histogram, within 2*max_step of every
+// cell sum of the float one
+void GetDesc(const CompactDescMat* descMat, const RectInfo& rect, const DescInfo& descInfo, float* desc)
+{
+	int nBins = descInfo.nBins;
+	int xStride = rect.width/descInfo.nxCells;
+	int yStride = rect.height/descInfo.nyCells;
+
+	// iterate over different cells
+	int iDesc = 0;
+	for(int xPos = rect.x, x = 0; x < descInfo.nxCells; xPos += xStride, x++)
+	for(int yPos = rect.y, y = 0; y < descInfo.nyCells; yPos += yStride, y++) {
+		float* sum = desc + iDesc;
+		std::fill(sum, sum + nBins, 0.f);
+		AddCompactDesc(descMat, yPos + yStride, xPos + xStride, 1, sum);
+		AddCompactDesc(descMat, yPos, xPos, 1, sum);
+		AddCompactDesc(descMat, yPos + yStride, xPos, -1, sum);
+		AddCompactDesc(descMat, yPos, xPos + xStride, -1, sum);
+
+		for(int i = 0; i < nBins; i++)
+			sum[i] = std::max<float>(sum[i], 0) + epsilon;
+		iDesc += nBins;
+	}
+
+	NormDesc(desc, descInfo.dim);
+}
+
+// the descriptor of a track at its index-th point, in a vector of all its points
+void GetDesc(const DescMat* descMat, RectInfo& rect, DescInfo descInfo, std::vector<float>& desc, const int index)
+{
+	GetDesc(descMat, rect, descInfo, &desc[index*descInfo.dim]);
 }
 
 // for HOG descriptor
-void HogComp(const Mat& img, float* desc, DescInfo& descInfo)
+void HogComp(const Mat& img, DescRows& rows, const DescInfo& descInfo)
 {
 	Mat imgX, imgY;
 	Sobel(img, imgX, CV_32F, 1, 0, 1);
 	Sobel(img, imgY, CV_32F, 0, 1, 1);
-	BuildDescMat(imgX, imgY, desc, descInfo);
+	BuildDescMat(imgX, imgY, rows, descInfo, DescSimdLevel(descInfo.nBins));
+}
+
+void HogComp(const Mat& img, float* desc, DescInfo& descInfo)
+{
+	DescRows rows(desc, img.cols+1, descInfo.nBins);
+	HogComp(img, rows, descInfo);
 }
 
 // for HOF descriptor
@@ -128,20 +305,82 @@ void HofComp(const Mat& flow, float* desc, DescInfo& descInfo)
 	BuildDescMat(flows[0], flows[1], desc, descInfo);
 }
 
-// for MBH descriptor
-void MbhComp(const Mat& flow, float* descX, float* descY, DescInfo& descInfo)
+// for one component of the MBH descriptor, the gradient of the x (comp 0) or y (comp 1) flow
+void MbhComp(const Mat& flow, int comp, float* desc, DescInfo& descInfo)
 {
 	Mat flows[2];
 	split(flow, flows);
 
-	Mat flowXdX, flowXdY, flowYdX, flowYdY;
-	Sobel(flows[0], flowXdX, CV_32F, 1, 0, 1);
-	Sobel(flows[0], flowXdY, CV_32F, 0, 1, 1);
-	Sobel(flows[1], flowYdX, CV_32F, 1, 0, 1);
-	Sobel(flows[1], flowYdY, CV_32F, 0, 1, 1);
+	Mat flowdX, flowdY;
+	Sobel(flows[comp], flowdX, CV_32F, 1, 0, 1);
+	Sobel(flows[comp], flowdY, CV_32F, 0, 1, 1);
+	BuildDescMat(flowdX, flowdY, desc, descInfo);
+}
 
-	BuildDescMat(flowXdX, flowXdY, descX, descInfo);
-	BuildDescMat(flowYdX, flowYdY, descY, descInfo);
+// for MBH descriptor
+void MbhComp(const Mat& flow, float* descX, float* descY, DescInfo& descInfo)
+{
+	MbhComp(flow, 0, descX, descInfo);
+	MbhComp(flow, 1, descY, descInfo);
+}
+
+// HOF and both components of MBH in one pass over the flow. Each row is read once
+// with the rows above and below, split into the x and y flow and differentiated on
+// the fly, which gives the values of Sobel with ksize 1 and its reflect-101 border,
+// and the three histogram rows are built from these row buffers. This replaces the
+// three splits, the four derivative images and their round trips through memory of
+// HofComp and MbhComp, and gives the same histograms
+void MotionDescComp(const Mat& flow, DescRows& hofRows, DescRows& mbhRowsX, DescRows& mbhRowsY,
+                    const DescInfo& hofInfo, const DescInfo& mbhInfo)
+{
+	int width = flow.cols, height = flow.rows;
+	int hofLevel = DescSimdLevel(hofInfo.nBins);
+	int mbhLevel = DescSimdLevel(mbhInfo.nBins);
+
+	std::vector<float> comps(6*width);
+	float* fx = &comps[0];
+	float* fy = fx + width;
+	float* xdx = fy + width; // derivatives of the x flow
+	float* xdy = xdx + width;
+	float* ydx = xdy + width; // and of the y flow
+	float* ydy = ydx + width;
+
+	DescRowBuffer buf;
+	for(int i = 0; i < height; i++) {
+		const float* f = flow.ptr<float>(i);
+		const float* up = flow.ptr<float>(i > 0 ? i-1 : std::min(1, height-1));
+		const float* down = flow.ptr<float>(i < height-1 ? i+1 : std::max(height-2, 0));
+
+		for(int j = 0; j < width; j++) {
+			fx[j] = f[2*j];
+			fy[j] = f[2*j+1];
+			xdy[j] = down[2*j] - up[2*j];
+			ydy[j] = down[2*j+1] - up[2*j+1];
+		}
+		// the reflected neighbours of the first and last column are equal
+		xdx[0] = ydx[0] = 0;
+		for(int j = 1; j < width-1; j++) {
+			xdx[j] = f[2*j+2] - f[2*j-2];
+			ydx[j] = f[2*j+3] - f[2*j-1];
+		}
+		xdx[width-1] = ydx[width-1] = 0;
+
+		BuildDescRow(hofLevel, fx, fy, width, hofRows.row(i+1) + hofInfo.nBins, hofRows.step, hofInfo, buf);
+		BuildDescRow(mbhLevel, xdx, xdy, width, mbhRowsX.row(i+1) + mbhInfo.nBins, mbhRowsX.step, mbhInfo, buf);
+		BuildDescRow(mbhLevel, ydx, ydy, width, mbhRowsY.row(i+1) + mbhInfo.nBins, mbhRowsY.step, mbhInfo, buf);
+		hofRows.done(i+1);
+		mbhRowsX.done(i+1);
+		mbhRowsY.done(i+1);
+	}
+}
+
+void MotionDescComp(const Mat& flow, float* hofDesc, float* mbhDescX, float* mbhDescY,
+                    const DescInfo& hofInfo, const DescInfo& mbhInfo)
+{
+	DescRows hofRows(hofDesc, flow.cols+1, hofInfo.nBins);
+	DescRows mbhRowsX(mbhDescX, flow.cols+1, mbhInfo.nBins);
+	DescRows mbhRowsY(mbhDescY, flow.cols+1, mbhInfo.nBins);
+	MotionDescComp(flow, hofRows, mbhRowsX, mbhRowsY, hofInfo, mbhInfo);
 }
 
 // check whether a trajectory is valid or not
@@ -241,9 +480,122 @@ void DenseSample(const Mat& grey, std::vector<Point2f>& points, const double qua
 	}
 }
 
-void InitPry(const Mat& frame, std::vector<float>& scales, std::vector<Size>& sizes)
+// new points in the centres of the empty cells of grid where the corner response
+// of grey is above quality times its maximum, as DenseSample
+void DenseSample(const Mat& grey, const SampleGrid& grid, std::vector<Point2f>& points, const double quality)
 {
-	int rows = frame.rows, cols = frame.cols;
+	Mat eig;
+	cornerMinEigenVal(grey, eig, 3, 3);
+
+	double maxVal = 0;
+	minMaxLoc(eig, 0, &maxVal);
+	const double threshold = maxVal*quality;
+
+	points.clear();
+	int index = 0;
+	int offset = grid.cell_size/2;
+	for(int i = 0; i < grid.height; i++)
+	for(int j = 0; j < grid.width; j++, index++) {
+		if(grid.count[index] > 0)
+			continue;
+
+		int x = j*grid.cell_size+offset;
+		int y = i*grid.cell_size+offset;
+
+		if(eig.at<float>(y, x) > threshold)
+			points.push_back(Point2f(float(x), float(y)));
+	}
+}
+
+// reflect-101 border of the filters
+inline int Reflect101(int i, int n)
+{
+	if(n == 1)
+		return 0;
+	if(i < 0)
+		return -i;
+	if(i >= n)
+		return 2*n-2-i;
+	return i;
+}
+
+// cornerMinEigenVal with a block and an aperture of 3 at one pixel: the smaller
+// eigenvalue of the products of the 3x3 Sobel derivatives summed over the 3x3 block,
+// with the reflect-101 border of the derivatives and of the block
+template<typename T>
+float MinEigenValAt(const Mat& img, int x, int y)
+{
+	// the same scale as cornerMinEigenVal
+	const float scale = 1.f/(4*3*(sizeof(T) == 1 ? 255 : 1));
+
+	float xx = 0, xy = 0, yy = 0;
+	for(int by = -1; by <= 1; by++)
+	for(int bx = -1; bx <= 1; bx++) {
+		int px = Reflect101(x+bx, img.cols);
+		int py = Reflect101(y+by, img.rows);
+		int l = Reflect101(px-1, img.cols);
+		int r = Reflect101(px+1, img.cols);
+		const T* up = img.ptr<T>(Reflect101(py-1, img.rows));
+		const T* row = img.ptr<T>(py);
+		const T* down = img.ptr<T>(Reflect101(py+1, img.rows));
+
+		float gx = (float(up[r] + 2*row[r] + down[r]) - float(up[l] + 2*row[l] + down[l]))*scale;
+		float gy = (float(down[l] + 2*down[px] + down[r]) - float(up[l] + 2*up[px] + up[r]))*scale;
+		xx += gx*gx;
+		xy += gx*gy;
+		yy += gy*gy;
+	}
+
+	float a = xx*0.5f, b = xy, c = yy*0.5f;
+	return (a + c) - sqrt((a - c)*(a - c) + b*b);
+}
+
+// DenseSample with the corner response evaluated only at the centres of the empty
+// cells, so the cost follows the number of empty cells instead of the frame area.
+// The threshold needs the maximum of the response over the frame, which is mostly
+// at a few sharp corners away from the centres: it is taken from the whole frame
+// every refresh calls, as in DenseSample, and kept in grid.max_eig in between,
+// raised when a centre goes above it
+void SparseSample(const Mat& grey, SampleGrid& grid, std::vector<Point2f>& points, const double quality, int refresh)
+{
+	if(grid.samples == 0) {
+		Mat eig;
+		cornerMinEigenVal(grey, eig, 3, 3);
+
+		double maxVal = 0;
+		minMaxLoc(eig, 0, &maxVal);
+		grid.max_eig = maxVal;
+	}
+	grid.samples = (grid.samples + 1)%std::max<int>(refresh, 1);
+
+	std::vector<int> cells;
+	std::vector<float> eig;
+	int offset = grid.cell_size/2;
+	for(int index = 0; index < grid.width*grid.height; index++) {
+		if(grid.count[index] > 0)
+			continue;
+
+		int x = index%grid.width*grid.cell_size+offset;
+		int y = index/grid.width*grid.cell_size+offset;
+		float val = grey.depth() == CV_8U ? MinEigenValAt<uchar>(grey, x, y) : MinEigenValAt<float>(grey, x, y);
+		cells.push_back(index);
+		eig.push_back(val);
+		grid.max_eig = std::max<float>(grid.max_eig, val);
+	}
+
+	const double threshold = grid.max_eig*quality;
+
+	points.clear();
+	for(size_t i = 0; i < cells.size(); i++)
+		if(eig[i] > threshold)
+			points.push_back(Point2f(float(cells[i]%grid.width*grid.cell_size+offset),
+				float(cells[i]/grid.width*grid.cell_size+offset)));
+}
+
+// at most scale_num levels, down to patch_size
+void InitPry(const Size& size, int scale_num, int patch_size, std::vector<float>& scales, std::vector<Size>& sizes)
+{
+	int rows = size.height, cols = size.width;
 	float min_size = std::min<int>(rows, cols);
 
 	int nlayers = 0;
@@ -268,6 +620,11 @@ void InitPry(const Mat& frame, std::vector<float>& scales, std::vector<Size>& si
 	}
 }
 
+void InitPry(const Mat& frame, std::vector<float>& scales, std::vector<Size>& sizes)
+{
+	InitPry(frame.size(), scale_num, patch_size, scales, sizes);
+}
+
 void BuildPry(const std::vector<Size>& sizes, const int type, std::vector<Mat>& grey_pyr)
 {
 	int nlayers = sizes.size();
@@ -277,7 +634,7 @@ void BuildPry(const std::vector<Size>& sizes, const int type, std::vector<Mat>&
 		grey_pyr[i].create(sizes[i], type);
 }
 
-void DrawTrack(const std::vector<Point2f>& point, const int index, const float scale, int traj_len, Mat& image)
+void DrawTrack(const Point2f* point, const int index, const float scale, int traj_len, Mat& image)
 {
 	int j = 1;
 	if(traj_len < index)
@@ -296,20 +653,36 @@ void DrawTrack(const std::vector<Point2f>& point, const int index, const float s
 	//circle(image, point0, 1, Scalar(0,0,255), -1, 8, 0);
 }
 
-void PrintDesc(std::vector<float>& desc, DescInfo& descInfo, TrackInfo& trackInfo)
+// the descriptor averaged over each of the ntCells temporal cells, ntCells*dim values
+// appended to vec; desc holds the dim values of each point of the track, stride floats apart
+void AverageDesc(const float* desc, int stride, const DescInfo& descInfo, const TrackInfo& trackInfo, std::vector<float>& vec)
 {
 	int tStride = cvFloor(trackInfo.length/descInfo.ntCells);
 	float norm = 1./float(tStride);
 	int dim = descInfo.dim;
-	int pos = 0;
 	for(int i = 0; i < descInfo.ntCells; i++) {
-		std::vector<float> vec(dim);
-		for(int t = 0; t < tStride; t++)
+		int first = vec.size();
+		vec.resize(first + dim, 0.f);
+		for(int t = 0; t < tStride; t++, desc += stride)
 			for(int j = 0; j < dim; j++)
-				vec[j] += desc[pos++];
+				vec[first+j] += desc[j];
 		for(int j = 0; j < dim; j++)
-			printf("%.7f\t", vec[j]*norm);
+			vec[first+j] *= norm;
 	}
 }
 
+// print the descriptor averaged over the temporal cells
+void PrintDesc(FILE* file, const float* desc, int stride, const DescInfo& descInfo, const TrackInfo& trackInfo)
+{
+	std::vector<float> vec;
+	AverageDesc(desc, stride, descInfo, trackInfo, vec);
+	for(size_t j = 0; j < vec.size(); j++)
+		fprintf(file, "%.7f\t", vec[j]);
+}
+
+void PrintDesc(std::vector<float>& desc, DescInfo& descInfo, TrackInfo& trackInfo)
+{
+	PrintDesc(stdout, &desc[0], descInfo.dim, descInfo, trackInfo);
+}
+
 #endif /*DESCRIPTORS_H_*/
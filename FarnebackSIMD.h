@@ -0,0 +1,612 @@
+#ifndef FARNEBACKSIMD_H_
+#define FARNEBACKSIMD_H_
+
+#include "DenseTrack.h"
+
+#include <immintrin.h>
+
+using namespace cv;
+
+// AVX2 and AVX-512 kernels for the polynomial expansion, the matrix update and the
+// blurred flow update of the Farneback flow, picked at runtime by FarnebackSimdLevel().
+// The scalar code in OpticalFlow.h stays the reference: the polynomial expansion and
+// the matrix update accumulate in float and use FMA, so they match it to a relative
+// error of about 1e-6 instead of bit for bit. The blur and the flow solve keep the
+// operations of the scalar code in the same order without FMA and match bit for bit.
+
+namespace my
+{
+
+enum {
+    SIMD_NONE = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512 = 2
+};
+
+static int DetectSimdLevel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx512f") )
+        return SIMD_AVX512;
+    if( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+        return SIMD_AVX2;
+#endif
+    return SIMD_NONE;
+}
+
+// the best instruction set of this cpu, capped by the global simd_limit
+static int FarnebackSimdLevel()
+{
+    static const int level = DetectSimdLevel();
+    return std::min(level, simd_limit);
+}
+
+// vertical pass of the polynomial expansion for the pixels [x, width) into the
+// planar scratch rows, the scalar tail of the vector kernels
+static inline void
+FarnebackPolyExpVertTail( const float** srow, float* row0, float* row1, float* row2, int x, int width,
+                          int n, const float* g, const float* xg, const float* xxg )
+{
+    for( ; x < width; x++ )
+    {
+        float t0 = srow[0][x]*g[0], t1 = 0.f, t2 = 0.f;
+        for( int k = 1; k <= n; k++ )
+        {
+            float a = srow[-k][x], b = srow[k][x];
+            float p = a + b;
+            t0 += g[k]*p;
+            t1 += xg[k]*(b - a);
+            t2 += xxg[k]*p;
+        }
+        row0[x] = t0;
+        row1[x] = t1;
+        row2[x] = t2;
+    }
+}
+
+// horizontal pass for the pixels [x, width), same as the reference in OpticalFlow.h
+// but reading planar scratch rows
+static inline void
+FarnebackPolyExpHorzTail( const float* row0, const float* row1, const float* row2, float* drow, int x, int width,
+                          int n, const float* g, const float* xg, const float* xxg,
+                          double ig11, double ig03, double ig33, double ig55 )
+{
+    for( ; x < width; x++ )
+    {
+        double b1 = row0[x]*g[0], b2 = 0, b3 = row1[x]*g[0],
+            b4 = 0, b5 = row2[x]*g[0], b6 = 0;
+
+        for( int k = 1; k <= n; k++ )
+        {
+            double tg = row0[x+k] + row0[x-k];
+            b1 += tg*g[k];
+            b4 += tg*xxg[k];
+            b2 += (row0[x+k] - row0[x-k])*xg[k];
+            b3 += (row1[x+k] + row1[x-k])*g[k];
+            b6 += (row1[x+k] - row1[x-k])*xg[k];
+            b5 += (row2[x+k] + row2[x-k])*g[k];
+        }
+
+        drow[x*5+1] = (float)(b2*ig11);
+        drow[x*5] = (float)(b3*ig11);
+        drow[x*5+3] = (float)(b1*ig03 + b4*ig33);
+        drow[x*5+2] = (float)(b1*ig03 + b5*ig33);
+        drow[x*5+4] = (float)(b6*ig55);
+    }
+}
+
+// replicate the first and the last pixel n times on both sides of a scratch row
+static inline void
+FarnebackPolyExpBorder( float* row, int width, int n )
+{
+    for( int k = 1; k <= n; k++ )
+    {
+        row[-k] = row[0];
+        row[width-1+k] = row[width-1];
+    }
+}
+
+// interleave nvec vectors of lanes floats (planar, vec[c*lanes + i]) into 5-channel pixels
+static inline void
+StoreInterleaved5( const float* vec, float* dst, int lanes )
+{
+    for( int i = 0; i < lanes; i++ )
+        for( int c = 0; c < 5; c++ )
+            dst[i*5+c] = vec[c*lanes+i];
+}
+
+__attribute__((target("avx2,fma")))
+static void
+FarnebackPolyExpRows_AVX2( const Mat& src, Mat& dst, int y0, int y1, int n,
+                           const float* g, const float* xg, const float* xxg,
+                           double ig11, double ig03, double ig33, double ig55, float* _row )
+{
+    int width = src.cols;
+    int height = src.rows;
+    int rstep = width + n*2;
+
+    // three planar scratch rows (r1, r2/x, r3/x^2 of the vertical pass) with n pixels of
+    // border in _row, the same size as the interleaved row of the scalar code
+    AutoBuffer<const float*> _srow(n*2+1);
+    float* row0 = _row + n;
+    float* row1 = row0 + rstep;
+    float* row2 = row1 + rstep;
+    const float** srow = (const float**)&_srow[0] + n;
+    float CV_DECL_ALIGNED(32) out[5*8];
+
+    const __m256 vig11 = _mm256_set1_ps((float)ig11), vig03 = _mm256_set1_ps((float)ig03);
+    const __m256 vig33 = _mm256_set1_ps((float)ig33), vig55 = _mm256_set1_ps((float)ig55);
+
+    for( int y = y0; y < y1; y++ )
+    {
+        float* drow = (float*)(dst.data + dst.step*y);
+        for( int k = -n; k <= n; k++ )
+            srow[k] = (const float*)(src.data + src.step*std::min(std::max(y+k,0),height-1));
+
+        // vertical part of convolution
+        int x = 0;
+        for( ; x <= width - 8; x += 8 )
+        {
+            __m256 t0 = _mm256_mul_ps(_mm256_loadu_ps(srow[0] + x), _mm256_set1_ps(g[0]));
+            __m256 t1 = _mm256_setzero_ps(), t2 = _mm256_setzero_ps();
+
+            for( int k = 1; k <= n; k++ )
+            {
+                __m256 a = _mm256_loadu_ps(srow[-k] + x), b = _mm256_loadu_ps(srow[k] + x);
+                __m256 p = _mm256_add_ps(a, b);
+                t0 = _mm256_fmadd_ps(p, _mm256_set1_ps(g[k]), t0);
+                t1 = _mm256_fmadd_ps(_mm256_sub_ps(b, a), _mm256_set1_ps(xg[k]), t1);
+                t2 = _mm256_fmadd_ps(p, _mm256_set1_ps(xxg[k]), t2);
+            }
+
+            _mm256_storeu_ps(row0 + x, t0);
+            _mm256_storeu_ps(row1 + x, t1);
+            _mm256_storeu_ps(row2 + x, t2);
+        }
+        FarnebackPolyExpVertTail( srow, row0, row1, row2, x, width, n, g, xg, xxg );
+
+        FarnebackPolyExpBorder( row0, width, n );
+        FarnebackPolyExpBorder( row1, width, n );
+        FarnebackPolyExpBorder( row2, width, n );
+
+        // horizontal part of convolution
+        x = 0;
+        for( ; x <= width - 8; x += 8 )
+        {
+            __m256 g0 = _mm256_set1_ps(g[0]);
+            __m256 b1 = _mm256_mul_ps(_mm256_loadu_ps(row0 + x), g0);
+            __m256 b3 = _mm256_mul_ps(_mm256_loadu_ps(row1 + x), g0);
+            __m256 b5 = _mm256_mul_ps(_mm256_loadu_ps(row2 + x), g0);
+            __m256 b2 = _mm256_setzero_ps(), b4 = _mm256_setzero_ps(), b6 = _mm256_setzero_ps();
+
+            for( int k = 1; k <= n; k++ )
+            {
+                __m256 gk = _mm256_set1_ps(g[k]), xgk = _mm256_set1_ps(xg[k]), xxgk = _mm256_set1_ps(xxg[k]);
+
+                __m256 l = _mm256_loadu_ps(row0 + x - k), r = _mm256_loadu_ps(row0 + x + k);
+                __m256 tg = _mm256_add_ps(r, l);
+                b1 = _mm256_fmadd_ps(tg, gk, b1);
+                b4 = _mm256_fmadd_ps(tg, xxgk, b4);
+                b2 = _mm256_fmadd_ps(_mm256_sub_ps(r, l), xgk, b2);
+
+                l = _mm256_loadu_ps(row1 + x - k); r = _mm256_loadu_ps(row1 + x + k);
+                b3 = _mm256_fmadd_ps(_mm256_add_ps(r, l), gk, b3);
+                b6 = _mm256_fmadd_ps(_mm256_sub_ps(r, l), xgk, b6);
+
+                l = _mm256_loadu_ps(row2 + x - k); r = _mm256_loadu_ps(row2 + x + k);
+                b5 = _mm256_fmadd_ps(_mm256_add_ps(r, l), gk, b5);
+            }
+
+            // do not store r1
+            _mm256_store_ps(out, _mm256_mul_ps(b3, vig11));
+            _mm256_store_ps(out + 8, _mm256_mul_ps(b2, vig11));
+            _mm256_store_ps(out + 16, _mm256_fmadd_ps(b1, vig03, _mm256_mul_ps(b5, vig33)));
+            _mm256_store_ps(out + 24, _mm256_fmadd_ps(b1, vig03, _mm256_mul_ps(b4, vig33)));
+            _mm256_store_ps(out + 32, _mm256_mul_ps(b6, vig55));
+            StoreInterleaved5( out, drow + x*5, 8 );
+        }
+        FarnebackPolyExpHorzTail( row0, row1, row2, drow, x, width, n, g, xg, xxg, ig11, ig03, ig33, ig55 );
+    }
+}
+
+__attribute__((target("avx512f")))
+static void
+FarnebackPolyExpRows_AVX512( const Mat& src, Mat& dst, int y0, int y1, int n,
+                             const float* g, const float* xg, const float* xxg,
+                             double ig11, double ig03, double ig33, double ig55, float* _row )
+{
+    int width = src.cols;
+    int height = src.rows;
+    int rstep = width + n*2;
+
+    AutoBuffer<const float*> _srow(n*2+1);
+    float* row0 = _row + n;
+    float* row1 = row0 + rstep;
+    float* row2 = row1 + rstep;
+    const float** srow = (const float**)&_srow[0] + n;
+    float CV_DECL_ALIGNED(64) out[5*16];
+
+    const __m512 vig11 = _mm512_set1_ps((float)ig11), vig03 = _mm512_set1_ps((float)ig03);
+    const __m512 vig33 = _mm512_set1_ps((float)ig33), vig55 = _mm512_set1_ps((float)ig55);
+
+    for( int y = y0; y < y1; y++ )
+    {
+        float* drow = (float*)(dst.data + dst.step*y);
+        for( int k = -n; k <= n; k++ )
+            srow[k] = (const float*)(src.data + src.step*std::min(std::max(y+k,0),height-1));
+
+        // vertical part of convolution
+        int x = 0;
+        for( ; x <= width - 16; x += 16 )
+        {
+            __m512 t0 = _mm512_mul_ps(_mm512_loadu_ps(srow[0] + x), _mm512_set1_ps(g[0]));
+            __m512 t1 = _mm512_setzero_ps(), t2 = _mm512_setzero_ps();
+
+            for( int k = 1; k <= n; k++ )
+            {
+                __m512 a = _mm512_loadu_ps(srow[-k] + x), b = _mm512_loadu_ps(srow[k] + x);
+                __m512 p = _mm512_add_ps(a, b);
+                t0 = _mm512_fmadd_ps(p, _mm512_set1_ps(g[k]), t0);
+                t1 = _mm512_fmadd_ps(_mm512_sub_ps(b, a), _mm512_set1_ps(xg[k]), t1);
+                t2 = _mm512_fmadd_ps(p, _mm512_set1_ps(xxg[k]), t2);
+            }
+
+            _mm512_storeu_ps(row0 + x, t0);
+            _mm512_storeu_ps(row1 + x, t1);
+            _mm512_storeu_ps(row2 + x, t2);
+        }
+        FarnebackPolyExpVertTail( srow, row0, row1, row2, x, width, n, g, xg, xxg );
+
+        FarnebackPolyExpBorder( row0, width, n );
+        FarnebackPolyExpBorder( row1, width, n );
+        FarnebackPolyExpBorder( row2, width, n );
+
+        // horizontal part of convolution
+        x = 0;
+        for( ; x <= width - 16; x += 16 )
+        {
+            __m512 g0 = _mm512_set1_ps(g[0]);
+            __m512 b1 = _mm512_mul_ps(_mm512_loadu_ps(row0 + x), g0);
+            __m512 b3 = _mm512_mul_ps(_mm512_loadu_ps(row1 + x), g0);
+            __m512 b5 = _mm512_mul_ps(_mm512_loadu_ps(row2 + x), g0);
+            __m512 b2 = _mm512_setzero_ps(), b4 = _mm512_setzero_ps(), b6 = _mm512_setzero_ps();
+
+            for( int k = 1; k <= n; k++ )
+            {
+                __m512 gk = _mm512_set1_ps(g[k]), xgk = _mm512_set1_ps(xg[k]), xxgk = _mm512_set1_ps(xxg[k]);
+
+                __m512 l = _mm512_loadu_ps(row0 + x - k), r = _mm512_loadu_ps(row0 + x + k);
+                __m512 tg = _mm512_add_ps(r, l);
+                b1 = _mm512_fmadd_ps(tg, gk, b1);
+                b4 = _mm512_fmadd_ps(tg, xxgk, b4);
+                b2 = _mm512_fmadd_ps(_mm512_sub_ps(r, l), xgk, b2);
+
+                l = _mm512_loadu_ps(row1 + x - k); r = _mm512_loadu_ps(row1 + x + k);
+                b3 = _mm512_fmadd_ps(_mm512_add_ps(r, l), gk, b3);
+                b6 = _mm512_fmadd_ps(_mm512_sub_ps(r, l), xgk, b6);
+
+                l = _mm512_loadu_ps(row2 + x - k); r = _mm512_loadu_ps(row2 + x + k);
+                b5 = _mm512_fmadd_ps(_mm512_add_ps(r, l), gk, b5);
+            }
+
+            // do not store r1
+            _mm512_store_ps(out, _mm512_mul_ps(b3, vig11));
+            _mm512_store_ps(out + 16, _mm512_mul_ps(b2, vig11));
+            _mm512_store_ps(out + 32, _mm512_fmadd_ps(b1, vig03, _mm512_mul_ps(b5, vig33)));
+            _mm512_store_ps(out + 48, _mm512_fmadd_ps(b1, vig03, _mm512_mul_ps(b4, vig33)));
+            _mm512_store_ps(out + 64, _mm512_mul_ps(b6, vig55));
+            StoreInterleaved5( out, drow + x*5, 16 );
+        }
+        FarnebackPolyExpHorzTail( row0, row1, row2, drow, x, width, n, g, xg, xxg, ig11, ig03, ig33, ig55 );
+    }
+}
+
+// FarnebackUpdateMatrices for the pixels [x0, x1) of an inner row y (no border
+// weighting), returns the first pixel left for the scalar code
+__attribute__((target("avx2,fma")))
+static int
+FarnebackUpdateMatricesRow_AVX2( const Mat& _R0, const Mat& _R1, const Mat& _flow, Mat& matM,
+                                 int y, int x0, int x1 )
+{
+    int width = _flow.cols, height = _flow.rows;
+    const float* R1 = (float*)_R1.data;
+    int step1 = (int)(_R1.step/sizeof(R1[0]));
+    const float* flow = (float*)(_flow.data + y*_flow.step);
+    const float* R0 = (float*)(_R0.data + y*_R0.step);
+    float* M = (float*)(matM.data + y*matM.step);
+    float CV_DECL_ALIGNED(32) out[5*8];
+
+    const __m256i idx2 = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m256i idx5 = _mm256_setr_epi32(0, 5, 10, 15, 20, 25, 30, 35);
+    const __m256 iota = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+    const __m256i xmax = _mm256_set1_epi32(width-1), ymax = _mm256_set1_epi32(height-1);
+    const __m256i minus1 = _mm256_set1_epi32(-1);
+    const __m256 one = _mm256_set1_ps(1.f), half = _mm256_set1_ps(0.5f), quarter = _mm256_set1_ps(0.25f);
+    const __m256 vy = _mm256_set1_ps((float)y);
+
+    int x = x0;
+    for( ; x <= x1 - 8; x += 8 )
+    {
+        __m256 dx = _mm256_i32gather_ps(flow + x*2, idx2, 4);
+        __m256 dy = _mm256_i32gather_ps(flow + x*2 + 1, idx2, 4);
+        __m256 fx = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps((float)x), iota), dx);
+        __m256 fy = _mm256_add_ps(vy, dy);
+
+        __m256 flx = _mm256_floor_ps(fx), fly = _mm256_floor_ps(fy);
+        __m256i ix = _mm256_cvttps_epi32(flx), iy = _mm256_cvttps_epi32(fly);
+        fx = _mm256_sub_ps(fx, flx);
+        fy = _mm256_sub_ps(fy, fly);
+
+        // (unsigned)x1 < (unsigned)(width-1) && (unsigned)y1 < (unsigned)(height-1)
+        __m256i inside = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi32(ix, minus1), _mm256_cmpgt_epi32(xmax, ix)),
+            _mm256_and_si256(_mm256_cmpgt_epi32(iy, minus1), _mm256_cmpgt_epi32(ymax, iy)));
+        __m256 mask = _mm256_castsi256_ps(inside);
+
+        // lanes outside the image gather nothing and keep zeros
+        __m256i ofs = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(iy, _mm256_set1_epi32(step1)),
+                                                        _mm256_mullo_epi32(ix, _mm256_set1_epi32(5))), inside);
+
+        __m256 a00 = _mm256_mul_ps(_mm256_sub_ps(one, fx), _mm256_sub_ps(one, fy));
+        __m256 a01 = _mm256_mul_ps(fx, _mm256_sub_ps(one, fy));
+        __m256 a10 = _mm256_mul_ps(_mm256_sub_ps(one, fx), fy);
+        __m256 a11 = _mm256_mul_ps(fx, fy);
+
+        __m256 r[5], r0[5];
+        for( int c = 0; c < 5; c++ )
+        {
+            __m256 p00 = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), R1 + c, ofs, mask, 4);
+            __m256 p01 = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), R1 + c + 5, ofs, mask, 4);
+            __m256 p10 = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), R1 + c + step1, ofs, mask, 4);
+            __m256 p11 = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), R1 + c + step1 + 5, ofs, mask, 4);
+            r[c] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a00, p00), _mm256_mul_ps(a01, p01)),
+                                 _mm256_add_ps(_mm256_mul_ps(a10, p10), _mm256_mul_ps(a11, p11)));
+            r0[c] = _mm256_i32gather_ps(R0 + x*5 + c, idx5, 4);
+        }
+
+        __m256 r2 = r[0], r3 = r[1];
+        __m256 r4 = _mm256_blendv_ps(r0[2], _mm256_mul_ps(_mm256_add_ps(r0[2], r[2]), half), mask);
+        __m256 r5 = _mm256_blendv_ps(r0[3], _mm256_mul_ps(_mm256_add_ps(r0[3], r[3]), half), mask);
+        __m256 r6 = _mm256_blendv_ps(_mm256_mul_ps(r0[4], half), _mm256_mul_ps(_mm256_add_ps(r0[4], r[4]), quarter), mask);
+
+        r2 = _mm256_mul_ps(_mm256_sub_ps(r0[0], r2), half);
+        r3 = _mm256_mul_ps(_mm256_sub_ps(r0[1], r3), half);
+
+        r2 = _mm256_add_ps(r2, _mm256_add_ps(_mm256_mul_ps(r4, dy), _mm256_mul_ps(r6, dx)));
+        r3 = _mm256_add_ps(r3, _mm256_add_ps(_mm256_mul_ps(r6, dy), _mm256_mul_ps(r5, dx)));
+
+        _mm256_store_ps(out, _mm256_add_ps(_mm256_mul_ps(r4, r4), _mm256_mul_ps(r6, r6)));
+        _mm256_store_ps(out + 8, _mm256_mul_ps(_mm256_add_ps(r4, r5), r6));
+        _mm256_store_ps(out + 16, _mm256_add_ps(_mm256_mul_ps(r5, r5), _mm256_mul_ps(r6, r6)));
+        _mm256_store_ps(out + 24, _mm256_add_ps(_mm256_mul_ps(r4, r2), _mm256_mul_ps(r6, r3)));
+        _mm256_store_ps(out + 32, _mm256_add_ps(_mm256_mul_ps(r6, r2), _mm256_mul_ps(r5, r3)));
+        StoreInterleaved5( out, M + x*5, 8 );
+    }
+
+    return x;
+}
+
+__attribute__((target("avx512f")))
+static int
+FarnebackUpdateMatricesRow_AVX512( const Mat& _R0, const Mat& _R1, const Mat& _flow, Mat& matM,
+                                   int y, int x0, int x1 )
+{
+    int width = _flow.cols, height = _flow.rows;
+    const float* R1 = (float*)_R1.data;
+    int step1 = (int)(_R1.step/sizeof(R1[0]));
+    const float* flow = (float*)(_flow.data + y*_flow.step);
+    const float* R0 = (float*)(_R0.data + y*_R0.step);
+    float* M = (float*)(matM.data + y*matM.step);
+    float CV_DECL_ALIGNED(64) out[5*16];
+
+    const __m512i idx2 = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i idx5 = _mm512_setr_epi32(0, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 65, 70, 75);
+    const __m512 iota = _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f,
+                                       8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f);
+    const __m512i xmax = _mm512_set1_epi32(width-1), ymax = _mm512_set1_epi32(height-1);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512 one = _mm512_set1_ps(1.f), half = _mm512_set1_ps(0.5f), quarter = _mm512_set1_ps(0.25f);
+    const __m512 vy = _mm512_set1_ps((float)y);
+
+    int x = x0;
+    for( ; x <= x1 - 16; x += 16 )
+    {
+        __m512 dx = _mm512_i32gather_ps(idx2, flow + x*2, 4);
+        __m512 dy = _mm512_i32gather_ps(idx2, flow + x*2 + 1, 4);
+        __m512 fx = _mm512_add_ps(_mm512_add_ps(_mm512_set1_ps((float)x), iota), dx);
+        __m512 fy = _mm512_add_ps(vy, dy);
+
+        __m512 flx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 fly = _mm512_roundscale_ps(fy, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512i ix = _mm512_cvttps_epi32(flx), iy = _mm512_cvttps_epi32(fly);
+        fx = _mm512_sub_ps(fx, flx);
+        fy = _mm512_sub_ps(fy, fly);
+
+        __mmask16 inside = _mm512_cmpge_epi32_mask(ix, zero) & _mm512_cmplt_epi32_mask(ix, xmax) &
+                           _mm512_cmpge_epi32_mask(iy, zero) & _mm512_cmplt_epi32_mask(iy, ymax);
+        __m512i ofs = _mm512_maskz_add_epi32(inside, _mm512_mullo_epi32(iy, _mm512_set1_epi32(step1)),
+                                                     _mm512_mullo_epi32(ix, _mm512_set1_epi32(5)));
+
+        __m512 a00 = _mm512_mul_ps(_mm512_sub_ps(one, fx), _mm512_sub_ps(one, fy));
+        __m512 a01 = _mm512_mul_ps(fx, _mm512_sub_ps(one, fy));
+        __m512 a10 = _mm512_mul_ps(_mm512_sub_ps(one, fx), fy);
+        __m512 a11 = _mm512_mul_ps(fx, fy);
+
+        __m512 r[5], r0[5];
+        for( int c = 0; c < 5; c++ )
+        {
+            __m512 p00 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), inside, ofs, R1 + c, 4);
+            __m512 p01 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), inside, ofs, R1 + c + 5, 4);
+            __m512 p10 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), inside, ofs, R1 + c + step1, 4);
+            __m512 p11 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), inside, ofs, R1 + c + step1 + 5, 4);
+            r[c] = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(a00, p00), _mm512_mul_ps(a01, p01)),
+                                 _mm512_add_ps(_mm512_mul_ps(a10, p10), _mm512_mul_ps(a11, p11)));
+            r0[c] = _mm512_i32gather_ps(idx5, R0 + x*5 + c, 4);
+        }
+
+        __m512 r2 = r[0], r3 = r[1];
+        __m512 r4 = _mm512_mask_blend_ps(inside, r0[2], _mm512_mul_ps(_mm512_add_ps(r0[2], r[2]), half));
+        __m512 r5 = _mm512_mask_blend_ps(inside, r0[3], _mm512_mul_ps(_mm512_add_ps(r0[3], r[3]), half));
+        __m512 r6 = _mm512_mask_blend_ps(inside, _mm512_mul_ps(r0[4], half), _mm512_mul_ps(_mm512_add_ps(r0[4], r[4]), quarter));
+
+        r2 = _mm512_mul_ps(_mm512_sub_ps(r0[0], r2), half);
+        r3 = _mm512_mul_ps(_mm512_sub_ps(r0[1], r3), half);
+
+        r2 = _mm512_add_ps(r2, _mm512_add_ps(_mm512_mul_ps(r4, dy), _mm512_mul_ps(r6, dx)));
+        r3 = _mm512_add_ps(r3, _mm512_add_ps(_mm512_mul_ps(r6, dy), _mm512_mul_ps(r5, dx)));
+
+        _mm512_store_ps(out, _mm512_add_ps(_mm512_mul_ps(r4, r4), _mm512_mul_ps(r6, r6)));
+        _mm512_store_ps(out + 16, _mm512_mul_ps(_mm512_add_ps(r4, r5), r6));
+        _mm512_store_ps(out + 32, _mm512_add_ps(_mm512_mul_ps(r5, r5), _mm512_mul_ps(r6, r6)));
+        _mm512_store_ps(out + 48, _mm512_add_ps(_mm512_mul_ps(r4, r2), _mm512_mul_ps(r6, r3)));
+        _mm512_store_ps(out + 64, _mm512_add_ps(_mm512_mul_ps(r6, r2), _mm512_mul_ps(r5, r3)));
+        StoreInterleaved5( out, M + x*5, 16 );
+    }
+
+    return x;
+}
+
+// the vertical blur of FarnebackUpdateFlow_GaussianBlur for the floats [0, len) of
+// a row of matrices, returns the first float left for the other paths
+__attribute__((target("avx2")))
+static int
+FarnebackBlurVertRow_AVX2( const float** srow, const float* kernel, int m, float* vsum, int len )
+{
+    int x = 0;
+    for( ; x <= len - 8; x += 8 )
+    {
+        __m256 s0 = _mm256_mul_ps(_mm256_loadu_ps(srow[m] + x), _mm256_set1_ps(kernel[0]));
+        for( int i = 1; i <= m; i++ )
+        {
+            __m256 t = _mm256_add_ps(_mm256_loadu_ps(srow[m+i] + x), _mm256_loadu_ps(srow[m-i] + x));
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(t, _mm256_set1_ps(kernel[i])));
+        }
+        _mm256_storeu_ps(vsum + x, s0);
+    }
+    return x;
+}
+
+// the horizontal blur, vsum has m pixels of border on both sides
+__attribute__((target("avx2")))
+static int
+FarnebackBlurHorzRow_AVX2( const float* vsum, const float* kernel, int m, float* hsum, int len )
+{
+    int x = 0;
+    for( ; x <= len - 8; x += 8 )
+    {
+        __m256 s0 = _mm256_mul_ps(_mm256_loadu_ps(vsum + x), _mm256_set1_ps(kernel[0]));
+        for( int i = 1; i <= m; i++ )
+        {
+            __m256 t = _mm256_add_ps(_mm256_loadu_ps(vsum + x - i*5), _mm256_loadu_ps(vsum + x + i*5));
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_set1_ps(kernel[i]), t));
+        }
+        _mm256_storeu_ps(hsum + x, s0);
+    }
+    return x;
+}
+
+// solves blur(G)*flow = blur(h) for the pixels [0, width) in double like the scalar
+// code, returns the first pixel left
+__attribute__((target("avx2")))
+static int
+FarnebackSolveFlowRow_AVX2( const float* hsum, float* flow, int width )
+{
+    const __m128i idx5 = _mm_setr_epi32(0, 5, 10, 15);
+    const __m256d one = _mm256_set1_pd(1.), eps = _mm256_set1_pd(1e-3);
+
+    int x = 0;
+    for( ; x <= width - 4; x += 4 )
+    {
+        const float* h = hsum + x*5;
+        __m256d g11 = _mm256_cvtps_pd(_mm_i32gather_ps(h, idx5, 4));
+        __m256d g12 = _mm256_cvtps_pd(_mm_i32gather_ps(h + 1, idx5, 4));
+        __m256d g22 = _mm256_cvtps_pd(_mm_i32gather_ps(h + 2, idx5, 4));
+        __m256d h1 = _mm256_cvtps_pd(_mm_i32gather_ps(h + 3, idx5, 4));
+        __m256d h2 = _mm256_cvtps_pd(_mm_i32gather_ps(h + 4, idx5, 4));
+
+        __m256d idet = _mm256_div_pd(one, _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(g11, g22),
+                                                                      _mm256_mul_pd(g12, g12)), eps));
+        __m128 fx = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(g11, h2), _mm256_mul_pd(g12, h1)), idet));
+        __m128 fy = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(g22, h1), _mm256_mul_pd(g12, h2)), idet));
+
+        _mm_storeu_ps(flow + x*2, _mm_unpacklo_ps(fx, fy));
+        _mm_storeu_ps(flow + x*2 + 4, _mm_unpackhi_ps(fx, fy));
+    }
+    return x;
+}
+
+// the products use the _round forms, which the compiler does not fuse with the
+// following add into an FMA like the plain AVX-512 operators
+__attribute__((target("avx512f")))
+static int
+FarnebackBlurVertRow_AVX512( const float** srow, const float* kernel, int m, float* vsum, int len )
+{
+    int x = 0;
+    for( ; x <= len - 16; x += 16 )
+    {
+        __m512 s0 = _mm512_mul_round_ps(_mm512_loadu_ps(srow[m] + x), _mm512_set1_ps(kernel[0]), _MM_FROUND_CUR_DIRECTION);
+        for( int i = 1; i <= m; i++ )
+        {
+            __m512 t = _mm512_add_ps(_mm512_loadu_ps(srow[m+i] + x), _mm512_loadu_ps(srow[m-i] + x));
+            s0 = _mm512_add_ps(s0, _mm512_mul_round_ps(t, _mm512_set1_ps(kernel[i]), _MM_FROUND_CUR_DIRECTION));
+        }
+        _mm512_storeu_ps(vsum + x, s0);
+    }
+    return x;
+}
+
+__attribute__((target("avx512f")))
+static int
+FarnebackBlurHorzRow_AVX512( const float* vsum, const float* kernel, int m, float* hsum, int len )
+{
+    int x = 0;
+    for( ; x <= len - 16; x += 16 )
+    {
+        __m512 s0 = _mm512_mul_round_ps(_mm512_loadu_ps(vsum + x), _mm512_set1_ps(kernel[0]), _MM_FROUND_CUR_DIRECTION);
+        for( int i = 1; i <= m; i++ )
+        {
+            __m512 t = _mm512_add_ps(_mm512_loadu_ps(vsum + x - i*5), _mm512_loadu_ps(vsum + x + i*5));
+            s0 = _mm512_add_ps(s0, _mm512_mul_round_ps(_mm512_set1_ps(kernel[i]), t, _MM_FROUND_CUR_DIRECTION));
+        }
+        _mm512_storeu_ps(hsum + x, s0);
+    }
+    return x;
+}
+
+__attribute__((target("avx512f")))
+static int
+FarnebackSolveFlowRow_AVX512( const float* hsum, float* flow, int width )
+{
+    const __m256i idx5 = _mm256_setr_epi32(0, 5, 10, 15, 20, 25, 30, 35);
+    const __m512d one = _mm512_set1_pd(1.), eps = _mm512_set1_pd(1e-3);
+
+    int x = 0;
+    for( ; x <= width - 8; x += 8 )
+    {
+        const float* h = hsum + x*5;
+        __m512d g11 = _mm512_cvtps_pd(_mm256_i32gather_ps(h, idx5, 4));
+        __m512d g12 = _mm512_cvtps_pd(_mm256_i32gather_ps(h + 1, idx5, 4));
+        __m512d g22 = _mm512_cvtps_pd(_mm256_i32gather_ps(h + 2, idx5, 4));
+        __m512d h1 = _mm512_cvtps_pd(_mm256_i32gather_ps(h + 3, idx5, 4));
+        __m512d h2 = _mm512_cvtps_pd(_mm256_i32gather_ps(h + 4, idx5, 4));
+
+        const int R = _MM_FROUND_CUR_DIRECTION;
+        __m512d det = _mm512_sub_pd(_mm512_mul_round_pd(g11, g22, R), _mm512_mul_round_pd(g12, g12, R));
+        __m512d idet = _mm512_div_pd(one, _mm512_add_pd(det, eps));
+        __m512d u = _mm512_sub_pd(_mm512_mul_round_pd(g11, h2, R), _mm512_mul_round_pd(g12, h1, R));
+        __m512d v = _mm512_sub_pd(_mm512_mul_round_pd(g22, h1, R), _mm512_mul_round_pd(g12, h2, R));
+        __m256 fx = _mm512_cvtpd_ps(_mm512_mul_pd(u, idet));
+        __m256 fy = _mm512_cvtpd_ps(_mm512_mul_pd(v, idet));
+
+        // the unpacks interleave within the 128-bit halves
+        __m256 lo = _mm256_unpacklo_ps(fx, fy), hi = _mm256_unpackhi_ps(fx, fy);
+        _mm256_storeu_ps(flow + x*2, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(flow + x*2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    return x;
+}
+
+}
+
+#endif /*FARNEBACKSIMD_H_*/
@@ -0,0 +1,117 @@
+#include "DenseTrack.h"
+#include "OpticalFlow.h"
+
+// The AVX2 and AVX-512 Farneback kernels against the scalar reference: the
+// polynomial expansion and the matrix update run on random images at every -V
+// level this cpu supports, and must match the -V 0 output to a relative error
+// of 1e-5 of its largest value. The blur and the flow solve of the flow update
+// must match it bit for bit. The sizes include odd widths for the scalar
+// tails and images narrower than the border of the matrix update.
+//
+// usage: FarnebackTest
+
+using namespace cv;
+using namespace my;
+
+static void RandomMat(Mat& mat, int rows, int cols, int type, float low, float high)
+{
+	mat.create(rows, cols, type);
+	for(int y = 0; y < rows; y++) {
+		float* row = mat.ptr<float>(y);
+		for(int x = 0; x < cols*mat.channels(); x++)
+			row[x] = low + (high - low)*(rand()/(float)RAND_MAX);
+	}
+}
+
+// the largest difference relative to the largest value of the reference
+static double MaxError(const Mat& ref, const Mat& mat)
+{
+	double diff = 0, scale = 0;
+	for(int y = 0; y < ref.rows; y++) {
+		const float* r = ref.ptr<float>(y);
+		const float* m = mat.ptr<float>(y);
+		for(int x = 0; x < ref.cols*ref.channels(); x++) {
+			diff = std::max(diff, (double)fabs(r[x] - m[x]));
+			scale = std::max(scale, (double)fabs(r[x]));
+		}
+	}
+	return diff/std::max(scale, 1e-12);
+}
+
+static bool SameMat(const Mat& ref, const Mat& mat)
+{
+	for(int y = 0; y < ref.rows; y++)
+		if(memcmp(ref.ptr<float>(y), mat.ptr<float>(y), ref.cols*ref.elemSize()) != 0)
+			return false;
+	return true;
+}
+
+static const char* LevelName(int level)
+{
+	return level == SIMD_AVX512 ? "AVX-512" : level == SIMD_AVX2 ? "AVX2" : "scalar";
+}
+
+// returns the number of failed comparisons
+static int Check(int width, int height, int n, double sigma, int winsize, int max_level)
+{
+	const double tolerance = 1e-5;
+	int failed = 0;
+
+	Mat src, R0, R1, flow;
+	RandomMat(src, height, width, CV_32FC1, 0, 255);
+	RandomMat(R0, height, width, CV_32FC(5), -1, 1);
+	RandomMat(R1, height, width, CV_32FC(5), -1, 1);
+	// large enough that some points leave the image
+	RandomMat(flow, height, width, CV_32FC2, -15, 15);
+
+	// the flow update reads the matrices of the reference, without updating them
+	Mat ref_poly, ref_M, ref_blur;
+	FarnebackWorkspace ws;
+	simd_limit = SIMD_NONE;
+	FarnebackPolyExp(src, ref_poly, n, sigma);
+	FarnebackUpdateMatrices(R0, R1, flow, ref_M, 0, height);
+	flow.copyTo(ref_blur);
+	FarnebackUpdateFlow_GaussianBlur(R0, R1, ref_blur, ref_M, winsize, false, ws);
+
+	for(int level = SIMD_AVX2; level <= max_level; level++) {
+		Mat poly, M, blur;
+		simd_limit = level;
+		FarnebackPolyExp(src, poly, n, sigma);
+		FarnebackUpdateMatrices(R0, R1, flow, M, 0, height);
+		flow.copyTo(blur);
+		FarnebackUpdateFlow_GaussianBlur(R0, R1, blur, ref_M, winsize, false, ws);
+
+		double poly_error = MaxError(ref_poly, poly);
+		double M_error = MaxError(ref_M, M);
+		if(poly_error > tolerance || M_error > tolerance) {
+			fprintf(stderr, "%dx%d, n %d: %s polynomial expansion error %g, matrix update error %g\n",
+				width, height, n, LevelName(level), poly_error, M_error);
+			failed++;
+		}
+		if(!SameMat(ref_blur, blur)) {
+			fprintf(stderr, "%dx%d, window %d: %s flow update differs, error %g\n",
+				width, height, winsize, LevelName(level), MaxError(ref_blur, blur));
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	static const int sizes[][2] = { {320, 240}, {133, 77}, {17, 31}, {11, 11}, {9, 40}, {1, 1} };
+	int max_level = DetectSimdLevel();
+
+	int failed = 0, runs = 0;
+	srand(0);
+	for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		// the poly_n, poly_sigma and winsize of FramePipeline and the other OpenCV defaults
+		failed += Check(sizes[i][0], sizes[i][1], 7, 1.5, flow_winsize, max_level);
+		failed += Check(sizes[i][0], sizes[i][1], 5, 1.1, 15, max_level);
+		runs += 2;
+	}
+	simd_limit = INT_MAX;
+
+	printf("Farneback: %d runs up to %s, %d failed\n", runs, LevelName(max_level), failed);
+	return failed == 0 ? 0 : 1;
+}
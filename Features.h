@@ -0,0 +1,245 @@
+#ifndef FEATURES_H_
+#define FEATURES_H_
+
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "Descriptors.h"
+#include "ThreadPool.h"
+#include "Trajectories.h"
+
+using namespace cv;
+
+// the HOG, HOF and MBH descriptors along the tracks, as described in
+// Out_features_description.txt. The four descriptors of a point are stored next
+// to each other in the slab of its track, hog first
+typedef struct {
+	DescInfo hogInfo;
+	DescInfo hofInfo;
+	DescInfo mbhInfo;
+	int hofOffset;  // offsets in the values of a point
+	int mbhXOffset;
+	int mbhYOffset;
+	int size;       // floats per point
+}DescLayout;
+
+void InitDescLayout(DescLayout* layout, int patch_size, int nxy_cell, int nt_cell)
+{
+	InitDescInfo(&layout->hogInfo, 8, false, patch_size, nxy_cell, nt_cell);
+	InitDescInfo(&layout->hofInfo, 9, true, patch_size, nxy_cell, nt_cell);
+	InitDescInfo(&layout->mbhInfo, 8, false, patch_size, nxy_cell, nt_cell);
+
+	layout->hofOffset = layout->hogInfo.dim;
+	layout->mbhXOffset = layout->hofOffset + layout->hofInfo.dim;
+	layout->mbhYOffset = layout->mbhXOffset + layout->mbhInfo.dim;
+	layout->size = layout->mbhYOffset + layout->mbhInfo.dim;
+}
+
+enum {
+	DESC_HOG = 0,
+	DESC_HOF,
+	DESC_MBHX,
+	DESC_MBHY,
+	DESC_NUM
+};
+
+// computes the descriptors of every track at its current point, before it is
+// moved by the flow. The integral histograms of all scales are built as two jobs
+// per scale on the thread pool, hog and the three of the flow in one pass of
+// MotionDescComp, then the tracks of all scales are split into batches for
+// GetDesc. The histograms, CompactDescMat if compact, are allocated on the
+// first frame and reused; GetDesc writes straight into the slabs of the TrackStore.
+class DescExtractor
+{
+public:
+	DescExtractor(const DescLayout& layout_, bool compact_) : layout(layout_), compact(compact_) {}
+
+	~DescExtractor()
+	{
+		for(size_t i = 0; i < mats.size(); i++)
+			ReleDescMat(mats[i]);
+		for(size_t i = 0; i < compacts.size(); i++)
+			ReleCompactDescMat(compacts[i]);
+	}
+
+	// image_pyr is the frame of the current points, flow_pyr the flow from it to the next one
+	void Compute(const std::vector<Mat>& image_pyr, const std::vector<Mat>& flow_pyr, std::vector<TrackStore>& xyScaleTracks)
+	{
+		int scales = flow_pyr.size();
+		if(mats.empty() && compacts.empty()) {
+			for(int iScale = 0; iScale < scales; iScale++) {
+				int height = flow_pyr[iScale].rows, width = flow_pyr[iScale].cols;
+				int nBins[DESC_NUM] = {layout.hogInfo.nBins, layout.hofInfo.nBins, layout.mbhInfo.nBins, layout.mbhInfo.nBins};
+				for(int kind = 0; kind < DESC_NUM; kind++) {
+					if(compact)
+						compacts.push_back(InitCompactDescMat(height+1, width+1, nBins[kind]));
+					else
+						mats.push_back(InitDescMat(height+1, width+1, nBins[kind]));
+				}
+			}
+		}
+
+		ParallelFor(0, scales*2, HistogramBuilder(*this, image_pyr, flow_pyr));
+
+		offsets.resize(scales+1);
+		offsets[0] = 0;
+		for(int iScale = 0; iScale < scales; iScale++)
+			offsets[iScale+1] = offsets[iScale] + xyScaleTracks[iScale].size();
+
+		ParallelFor(0, offsets[scales], TrackDescriber(*this, flow_pyr, xyScaleTracks));
+	}
+
+	// the largest error of a cell sum of the compact histograms so far
+	float ErrorBound() const
+	{
+		float max_step = 0;
+		for(size_t i = 0; i < compacts.size(); i++)
+			max_step = std::max<float>(max_step, compacts[i]->max_step);
+		return 2*max_step;
+	}
+
+private:
+	DescLayout layout;
+	bool compact;               // the histograms are CompactDescMat
+	std::vector<DescMat*> mats; // DESC_NUM per scale
+	std::vector<CompactDescMat*> compacts; // or these if compact
+	std::vector<int> offsets;   // first track of each scale in the batches
+
+	// the rows of the i-th histogram for building it
+	DescRows Rows(int i)
+	{
+		if(compact)
+			return DescRows(compacts[i]);
+		return DescRows(mats[i]->desc, mats[i]->width, mats[i]->nBins);
+	}
+
+	void Describe(int i, const RectInfo& rect, const DescInfo& descInfo, float* desc) const
+	{
+		if(compact)
+			GetDesc(compacts[i], rect, descInfo, desc);
+		else
+			GetDesc(mats[i], rect, descInfo, desc);
+	}
+
+	// the hog or the three flow histograms of one scale per job
+	class HistogramBuilder : public ParallelBody
+	{
+	public:
+		HistogramBuilder(DescExtractor& owner_, const std::vector<Mat>& image_pyr_, const std::vector<Mat>& flow_pyr_)
+			: owner(owner_), image_pyr(image_pyr_), flow_pyr(flow_pyr_) {}
+
+		void operator()(int begin, int end) const
+		{
+			for(int job = begin; job < end; job++) {
+				int first = job/2*DESC_NUM;
+				const DescLayout& layout = owner.layout;
+
+				if(job%2 == 0) {
+					DescRows hog = owner.Rows(first + DESC_HOG);
+					HogComp(image_pyr[job/2], hog, layout.hogInfo);
+				}
+				else {
+					DescRows hof = owner.Rows(first + DESC_HOF);
+					DescRows mbhX = owner.Rows(first + DESC_MBHX);
+					DescRows mbhY = owner.Rows(first + DESC_MBHY);
+					MotionDescComp(flow_pyr[job/2], hof, mbhX, mbhY, layout.hofInfo, layout.mbhInfo);
+				}
+			}
+		}
+
+	private:
+		DescExtractor& owner;
+		const std::vector<Mat>& image_pyr;
+		const std::vector<Mat>& flow_pyr;
+	};
+
+	// the descriptors of a batch of tracks, indexed over all scales
+	class TrackDescriber : public ParallelBody
+	{
+	public:
+		TrackDescriber(DescExtractor& owner_, const std::vector<Mat>& flow_pyr_, std::vector<TrackStore>& xyScaleTracks_)
+			: owner(owner_), flow_pyr(flow_pyr_), xyScaleTracks(xyScaleTracks_) {}
+
+		void operator()(int begin, int end) const
+		{
+			const DescLayout& layout = owner.layout;
+			const std::vector<int>& offsets = owner.offsets;
+
+			int iScale = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+			for(int i = begin; i < end; i++) {
+				while(i >= offsets[iScale+1])
+					iScale++;
+
+				TrackStore& xyTracks = xyScaleTracks[iScale];
+				int first = iScale*DESC_NUM;
+				int iTrack = i - offsets[iScale];
+
+				RectInfo rect;
+				GetRect(Point2f(xyTracks.x[iTrack], xyTracks.y[iTrack]), rect, flow_pyr[iScale].cols, flow_pyr[iScale].rows, layout.hogInfo);
+
+				float* desc = xyTracks.descRow(iTrack) + xyTracks.index[iTrack]*layout.size;
+				owner.Describe(first + DESC_HOG, rect, layout.hogInfo, desc);
+				owner.Describe(first + DESC_HOF, rect, layout.hofInfo, desc + layout.hofOffset);
+				owner.Describe(first + DESC_MBHX, rect, layout.mbhInfo, desc + layout.mbhXOffset);
+				owner.Describe(first + DESC_MBHY, rect, layout.mbhInfo, desc + layout.mbhYOffset);
+			}
+		}
+
+	private:
+		DescExtractor& owner;
+		const std::vector<Mat>& flow_pyr;
+		std::vector<TrackStore>& xyScaleTracks;
+	};
+};
+
+// the feature file: one line per trajectory with its position, its shape and the
+// descriptors averaged over the temporal cells
+class FeatureWriter
+{
+public:
+	FeatureWriter(const DescLayout& layout_, const TrackInfo& trackInfo_) : layout(layout_), trackInfo(trackInfo_), outfile(NULL) {}
+
+	~FeatureWriter()
+	{
+		if(outfile)
+			fclose(outfile);
+	}
+
+	bool open(const char* file)
+	{
+		outfile = fopen(file, "w");
+		if(!outfile)
+			return false;
+		setvbuf(outfile, NULL, _IOFBF, 1 << 20);
+		return true;
+	}
+
+	// t_pos needs the length of the video, it is 0 while the length is unknown (-P 1)
+	void write(const TrackResult& result, int frame_num, float scale, const SeqInfo& seqInfo)
+	{
+		fprintf(outfile, "%d\t%f\t%f\t%f\t%f\t%f\t%f\t", frame_num, result.mean_x, result.mean_y,
+			result.var_x, result.var_y, result.length, scale);
+
+		// for spatio-temporal pyramid
+		fprintf(outfile, "%f\t", std::min<float>(std::max<float>(result.mean_x/float(seqInfo.width), 0), 0.999));
+		fprintf(outfile, "%f\t", std::min<float>(std::max<float>(result.mean_y/float(seqInfo.height), 0), 0.999));
+		float t_pos = seqInfo.length > 0 ? (frame_num - trackInfo.length/2.0 - start_frame)/float(seqInfo.length) : 0;
+		fprintf(outfile, "%f\t", std::min<float>(std::max<float>(t_pos, 0), 0.999));
+
+		for(int i = 0; i < trackInfo.length; ++i)
+			fprintf(outfile, "%f\t%f\t", result.trajectory[i].x, result.trajectory[i].y);
+
+		const float* desc = &result.desc[0];
+		PrintDesc(outfile, desc, layout.size, layout.hogInfo, trackInfo);
+		PrintDesc(outfile, desc + layout.hofOffset, layout.size, layout.hofInfo, trackInfo);
+		PrintDesc(outfile, desc + layout.mbhXOffset, layout.size, layout.mbhInfo, trackInfo);
+		PrintDesc(outfile, desc + layout.mbhYOffset, layout.size, layout.mbhInfo, trackInfo);
+		fputc('\n', outfile);
+	}
+
+private:
+	DescLayout layout;
+	TrackInfo trackInfo;
+	FILE* outfile;
+};
+
+#endif /*FEATURES_H_*/
@@ -0,0 +1,292 @@
+#ifndef FRAMESOURCE_H_
+#define FRAMESOURCE_H_
+
+#include "DenseTrack.h"
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <deque>
+
+using namespace cv;
+
+// where the decode stage of FramePipeline takes its BGR frames from: a video file
+// through VideoCapture, raw I420 frames from a file, a pipe or stdin, or frames
+// handed over in memory by another thread. The size and the length may be unknown
+// before the first frame, resp. the end of the stream.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    virtual bool isOpened() = 0;
+
+    // the next frame as CV_8UC3, false at the end of the stream
+    virtual bool read(Mat& frame) = 0;
+
+    // skip the next frame, cheaper than read() where the source allows it
+    virtual bool grab()
+    {
+        Mat frame;
+        return read(frame);
+    }
+
+    // 0x0 if not known before the first frame
+    virtual Size size() = 0;
+
+    // the number of frames, -1 if not known before the end of the stream
+    virtual int length()
+    {
+        return -1;
+    }
+
+    // position the source on the frame without decoding the ones before it, returns
+    // the frame it got to; the rest is skipped with grab() by SeekToFrame
+    virtual int seek(int frame_num)
+    {
+        return 0;
+    }
+
+    // whether the frames can be read again by opening the same name, for drawing the
+    // segmented trajectories on the video at the end
+    virtual bool replayable()
+    {
+        return false;
+    }
+};
+
+class CaptureSource : public FrameSource
+{
+public:
+    CaptureSource(const char* file)
+    {
+        capture.open(file);
+    }
+
+    bool isOpened()
+    {
+        return capture.isOpened();
+    }
+
+    bool read(Mat& frame)
+    {
+        capture >> frame;
+        return !frame.empty();
+    }
+
+    bool grab()
+    {
+        return capture.grab();
+    }
+
+    Size size()
+    {
+        return Size(cvRound(capture.get(CV_CAP_PROP_FRAME_WIDTH)), cvRound(capture.get(CV_CAP_PROP_FRAME_HEIGHT)));
+    }
+
+    // from the container and stream headers, no frame is decoded here
+    int length()
+    {
+        double count = capture.get(CV_CAP_PROP_FRAME_COUNT);
+        double fps = capture.get(CV_CAP_PROP_FPS);
+
+        // some containers (e.g. webm, streamed mp4) carry no frame count or a bogus one,
+        // the length is then only known at the end of the stream
+        if(!(count > 0) || count >= INT_MAX || !(fps > 0))
+            return -1;
+        return cvRound(count);
+    }
+
+    // the ffmpeg backend seeks to the nearest keyframe and decodes forward to the
+    // exact frame
+    int seek(int frame_num)
+    {
+        if(!capture.set(CV_CAP_PROP_POS_FRAMES, frame_num))
+            return 0;
+
+        // overshot or lost track of the position, restart from the beginning
+        int pos = cvRound(capture.get(CV_CAP_PROP_POS_FRAMES));
+        if(pos < 0 || pos > frame_num) {
+            capture.set(CV_CAP_PROP_POS_FRAMES, 0);
+            pos = 0;
+        }
+        return pos;
+    }
+
+    bool replayable()
+    {
+        return true;
+    }
+
+private:
+    VideoCapture capture;
+};
+
+// planar YUV 4:2:0 (I420, e.g. ffmpeg -f rawvideo -pix_fmt yuv420p) of a known
+// size, "-" reads stdin; the length is known for regular files only
+class RawYuvSource : public FrameSource
+{
+public:
+    RawYuvSource(const char* file, Size size_) : frame_size(size_), owned(false)
+    {
+        if(strcmp(file, "-") == 0)
+            input = stdin;
+        else {
+            input = fopen(file, "rb");
+            owned = input != NULL;
+        }
+        frame_bytes = (long)frame_size.width*frame_size.height*3/2;
+        if(frame_bytes > 0)
+            yuv.create(frame_size.height*3/2, frame_size.width, CV_8UC1);
+    }
+
+    ~RawYuvSource()
+    {
+        if(owned)
+            fclose(input);
+    }
+
+    // the chroma planes need an even size
+    bool isOpened()
+    {
+        return input && frame_size.width > 0 && frame_size.height > 0 &&
+            frame_size.width % 2 == 0 && frame_size.height % 2 == 0;
+    }
+
+    bool read(Mat& frame)
+    {
+        if(!grab())
+            return false;
+        cvtColor(yuv, frame, CV_YUV2BGR_I420);
+        return true;
+    }
+
+    bool grab()
+    {
+        return fread(yuv.data, 1, frame_bytes, input) == (size_t)frame_bytes;
+    }
+
+    Size size()
+    {
+        return frame_size;
+    }
+
+    int length()
+    {
+        struct stat st;
+        if(fstat(fileno(input), &st) != 0 || !S_ISREG(st.st_mode))
+            return -1;
+        return st.st_size/frame_bytes;
+    }
+
+    int seek(int frame_num)
+    {
+        struct stat st;
+        if(fstat(fileno(input), &st) != 0 || !S_ISREG(st.st_mode))
+            return 0;
+        frame_num = std::min<long>(frame_num, st.st_size/frame_bytes);
+        if(fseeko(input, (off_t)frame_num*frame_bytes, SEEK_SET) != 0)
+            return 0;
+        return frame_num;
+    }
+
+private:
+    Size frame_size;
+    long frame_bytes;
+    FILE* input;
+    bool owned;
+    Mat yuv; // one frame, the planes one after the other
+};
+
+// frames handed over by another thread of the process, e.g. a service that decodes
+// them itself. push() shares the data of the frame, so the caller must not write
+// to it afterwards, and blocks while capacity frames are waiting; close() ends the
+// stream once the waiting frames are read.
+class MemorySource : public FrameSource
+{
+public:
+    MemorySource(Size size_ = Size(), int capacity_ = 8)
+        : frame_size(size_), capacity(std::max(capacity_, 1)), closed(false)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    ~MemorySource()
+    {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // a BGR frame (CV_8UC3), all of the same size
+    void push(const Mat& frame)
+    {
+        pthread_mutex_lock(&mutex);
+        while(frames.size() >= capacity && !closed)
+            pthread_cond_wait(&cond, &mutex);
+        if(!closed) {
+            frames.push_back(frame);
+            pthread_cond_broadcast(&cond);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void close()
+    {
+        pthread_mutex_lock(&mutex);
+        closed = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    bool isOpened()
+    {
+        return true;
+    }
+
+    bool read(Mat& frame)
+    {
+        pthread_mutex_lock(&mutex);
+        while(frames.empty() && !closed)
+            pthread_cond_wait(&cond, &mutex);
+        bool ok = !frames.empty();
+        if(ok) {
+            frame = frames.front();
+            frames.pop_front();
+            pthread_cond_broadcast(&cond);
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    Size size()
+    {
+        return frame_size;
+    }
+
+private:
+    Size frame_size;
+    size_t capacity;
+    bool closed;
+    std::deque<Mat> frames;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// the source for the video argument: raw I420 frames if their size is given (-r),
+// otherwise a file decoded by VideoCapture
+FrameSource* OpenFrameSource(const char* video)
+{
+    FrameSource* source;
+    if(raw_width > 0 || raw_height > 0)
+        source = new RawYuvSource(video, Size(raw_width, raw_height));
+    else
+        source = new CaptureSource(video);
+
+    if(!source->isOpened()) {
+        delete source;
+        return NULL;
+    }
+    return source;
+}
+
+#endif /*FRAMESOURCE_H_*/
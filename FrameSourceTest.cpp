@@ -0,0 +1,181 @@
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "Pipeline.h"
+
+#include <signal.h>
+
+// MemorySource as the source of FramePipeline: another thread pushes numbered
+// frames into a small queue while the pipeline decodes, expands and computes
+// the flow. Every frame must come out of next() once, in order, with its pixels
+// and number, also after SeekToFrame skipped the first ones and when the window
+// ends before the stream. close() must end a blocked push() and the stream, and
+// a source in memory is of unknown length and cannot be replayed.
+//
+// usage: FrameSourceTest
+
+using namespace cv;
+
+static const int width = 160;
+static const int height = 120;
+
+// a textured frame moving by (t, t/2) pixels, numbered in its first pixel
+static Mat MakeFrame(int t)
+{
+	Mat frame(height, width, CV_8UC3);
+	for(int y = 0; y < height; y++) {
+		uchar* p = frame.ptr<uchar>(y);
+		for(int x = 0; x < width; x++) {
+			int u = x - t, v = y - t/2;
+			uchar c = (uchar)(128 + 60*sin(u*0.31)*cos(v*0.23) + 40*sin((u + v)*0.07));
+			p[3*x] = p[3*x+1] = p[3*x+2] = c;
+		}
+	}
+	frame.ptr<uchar>(0)[0] = (uchar)t;
+	return frame;
+}
+
+static bool SameFrame(const Mat& a, const Mat& b)
+{
+	if(a.size() != b.size() || a.type() != b.type())
+		return false;
+	for(int y = 0; y < a.rows; y++)
+		if(memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), a.cols*a.elemSize()) != 0)
+			return false;
+	return true;
+}
+
+typedef struct {
+	MemorySource* source;
+	int count;  // frames to push
+	bool close; // close the source after them
+}Producer;
+
+static void* Produce(void* arg)
+{
+	Producer* producer = (Producer*)arg;
+	for(int t = 0; t < producer->count; t++)
+		producer->source->push(MakeFrame(t));
+	if(producer->close)
+		producer->source->close();
+	return NULL;
+}
+
+// runs the frames of a producer through a pipeline from start_frame to
+// end_frame as ProcessFrames does, returns the number of errors
+static int RunPipeline(const TrackParams& params, int num_frames, int start_frame, int end_frame, int capacity)
+{
+	MemorySource source(Size(), capacity);
+	Producer producer = { &source, num_frames, true };
+	pthread_t thread;
+	pthread_create(&thread, NULL, Produce, &producer);
+
+	int errors = 0;
+	SeqInfo seqInfo;
+	InitSeqInfo(&seqInfo, (char*)"memory", source, PROBE_HEADER);
+	if(seqInfo.video != NULL || seqInfo.length != -1 || seqInfo.width != 0 || seqInfo.height != 0) {
+		fprintf(stderr, "the memory source is described as %dx%d, %d frames, %s\n",
+			seqInfo.width, seqInfo.height, seqInfo.length, seqInfo.video ? "replayable" : "not replayable");
+		errors++;
+	}
+
+	int first_frame = SeekToFrame(source, start_frame);
+	FramePipeline pipeline(params, source, first_frame, end_frame, 4);
+	pipeline.start();
+
+	int slot, prev_slot = -1, expected = first_frame;
+	while((slot = pipeline.next()) >= 0) {
+		FrameSlot& cur = pipeline.slots[slot];
+		if(cur.frame_num != expected || !SameFrame(cur.frame, MakeFrame(expected))) {
+			fprintf(stderr, "frames %d-%d: frame %d came out as frame %d (pixel %d)\n",
+				start_frame, end_frame, expected, cur.frame_num, cur.frame.ptr<uchar>(0)[0]);
+			errors++;
+		}
+		if(prev_slot >= 0 && (cur.flow_pyr.empty() || cur.flow_pyr[0].size() != cur.frame.size()))
+			errors++;
+		if(prev_slot >= 0)
+			pipeline.release(prev_slot);
+		prev_slot = slot;
+		expected++;
+	}
+	if(prev_slot >= 0)
+		pipeline.release(prev_slot);
+	pipeline.join();
+
+	// a window which ends before the stream leaves the producer waiting
+	source.close();
+	pthread_join(thread, NULL);
+
+	int last = std::min(end_frame, num_frames - 1);
+	bool to_end = end_frame >= num_frames;
+	if(expected != last + 1 || pipeline.frame_count != last + 1 - first_frame ||
+	   pipeline.flow_count != std::max(last - first_frame, 0) || pipeline.end_of_stream != to_end) {
+		fprintf(stderr, "frames %d-%d of %d: %d decoded up to %d, %d flows, %s\n", start_frame, end_frame,
+			num_frames, pipeline.frame_count, expected - 1, pipeline.flow_count, pipeline.end_of_stream ? "end of stream" : "stopped");
+		errors++;
+	}
+	return errors;
+}
+
+// a push() waiting for room returns on close(), the frames before it are read
+// and the frames pushed after it are dropped; returns the number of errors
+static int RunClose()
+{
+	MemorySource source(Size(width, height), 1);
+	Producer producer = { &source, 3, false };
+	pthread_t thread;
+	pthread_create(&thread, NULL, Produce, &producer);
+
+	// the second push waits until the first frame is read
+	Mat frame;
+	int errors = 0;
+	if(!source.read(frame) || !SameFrame(frame, MakeFrame(0)))
+		errors++;
+	source.close();
+	pthread_join(thread, NULL);
+
+	source.push(MakeFrame(9));
+	int left = 0;
+	while(source.read(frame))
+		left++;
+	if(left > 1 || source.size() != Size(width, height) || source.length() != -1 || source.replayable())
+		errors++;
+	return errors;
+}
+
+static void Timeout(int)
+{
+	fprintf(stderr, "a push or a read did not return\n");
+	_exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	signal(SIGALRM, Timeout);
+	alarm(60);
+
+	InitThreadPool(2);
+	TrackParams params;
+	InitTrackParams(&params);
+	params.scale_num = 2;
+
+	int errors = 0, runs = 0;
+	// whole streams through queues of one frame and of more than the slots
+	errors += RunPipeline(params, 12, 0, INT_MAX, 1);
+	errors += RunPipeline(params, 12, 0, INT_MAX, 8);
+	// a single frame and none at all
+	errors += RunPipeline(params, 1, 0, INT_MAX, 2);
+	errors += RunPipeline(params, 0, 0, INT_MAX, 2);
+	// -S skips frames with grab(), -E stops before the end of the stream
+	errors += RunPipeline(params, 12, 5, INT_MAX, 2);
+	errors += RunPipeline(params, 12, 0, 6, 2);
+	errors += RunPipeline(params, 12, 3, 8, 2);
+	runs += 7;
+
+	errors += RunClose();
+	runs++;
+
+	ReleaseThreadPool();
+
+	printf("FrameSource: %d runs, %d errors\n", runs, errors);
+	return errors == 0 ? 0 : 1;
+}
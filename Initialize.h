@@ -2,6 +2,7 @@
 #define INITIALIZE_H_
 
 #include "DenseTrack.h"
+#include "FrameSource.h"
 
 using namespace cv;
 
@@ -11,6 +12,25 @@ void InitTrackInfo(TrackInfo* trackInfo, int track_length, int init_gap)
 	trackInfo->gap = init_gap;
 }
 
+// the parameters of the command line
+void InitTrackParams(TrackParams* params)
+{
+	params->scale_num = scale_num;
+	params->patch_size = patch_size;
+	params->pyramid_cascade = pyramid_cascade;
+	params->cache_pyramid = cache_pyramid;
+	params->flow_winsize = flow_winsize;
+	params->flow_iterations = flow_iterations;
+	params->warm_iterations = warm_iterations;
+	params->warm_check_gap = warm_check_gap;
+	params->min_distance = min_distance;
+	params->quality = quality;
+	params->sparse_sample = sparse_sample;
+	params->track_bilinear = track_bilinear;
+	params->compute_desc = compute_desc;
+	params->compact_desc = compact_desc;
+}
+
 DescMat* InitDescMat(int height, int width, int nBins)
 {
 	DescMat* descMat = (DescMat*)malloc(sizeof(DescMat));
@@ -30,6 +50,34 @@ void ReleDescMat(DescMat* descMat)
 	free(descMat);
 }
 
+CompactDescMat* InitCompactDescMat(int height, int width, int nBins)
+{
+	CompactDescMat* descMat = (CompactDescMat*)malloc(sizeof(CompactDescMat));
+	descMat->height = height;
+	descMat->width = width;
+	descMat->nBins = nBins;
+	descMat->xTiles = (width + desc_tile - 1)/desc_tile;
+	descMat->yTiles = (height + desc_tile - 1)/desc_tile;
+
+	descMat->rows = (float*)malloc((long)descMat->yTiles*width*nBins*sizeof(float));
+	descMat->cols = (float*)malloc((long)descMat->xTiles*height*nBins*sizeof(float));
+	descMat->scale = (float*)malloc((long)descMat->yTiles*descMat->xTiles*nBins*sizeof(float));
+	descMat->offs = (unsigned short*)malloc((long)height*width*nBins*sizeof(unsigned short));
+	descMat->band = (float*)malloc((long)(desc_tile+1)*width*nBins*sizeof(float));
+	descMat->max_step = 0;
+	return descMat;
+}
+
+void ReleCompactDescMat(CompactDescMat* descMat)
+{
+	free(descMat->rows);
+	free(descMat->cols);
+	free(descMat->scale);
+	free(descMat->offs);
+	free(descMat->band);
+	free(descMat);
+}
+
 void InitDescInfo(DescInfo* descInfo, int nBins, bool isHof, int size, int nxy_cell, int nt_cell)
 {
 	descInfo->nBins = nBins;
@@ -42,39 +90,75 @@ void InitDescInfo(DescInfo* descInfo, int nBins, bool isHof, int size, int nxy_c
 	descInfo->width = size;
 }
 
-void InitSeqInfo(SeqInfo* seqInfo, char* video)
+// read the resolution and the number of frames from an already opened source, for
+// a video file from the container and stream headers, no frame is decoded here
+bool ProbeSeqInfo(FrameSource& source, SeqInfo* seqInfo)
 {
-	seqInfo->video = video;
+	Size size = source.size();
+	seqInfo->width = size.width;
+	seqInfo->height = size.height;
+	seqInfo->length = source.length();
+	return seqInfo->length >= 0;
+}
 
-	VideoCapture capture;
-	capture.open(video);
+// video is NULL for a stream which cannot be read again (stdin, memory)
+void InitSeqInfo(SeqInfo* seqInfo, char* video, FrameSource& source, int mode)
+{
+	seqInfo->video = source.replayable() ? video : NULL;
+	seqInfo->width = 0;
+	seqInfo->height = 0;
+	seqInfo->length = -1;
 
-	if(!capture.isOpened())
-		fprintf(stderr, "Could not initialize capturing..\n");
+	if(mode == PROBE_HEADER)
+		ProbeSeqInfo(source, seqInfo);
+	else {
+		Size size = source.size();
+		seqInfo->width = size.width;
+		seqInfo->height = size.height;
+	}
+}
 
-	// get the number of frames in the video
-	int frame_num = 0;
-	while(true) {
-		Mat frame;
-		capture >> frame;
+// the header may miss the resolution, take it from the first decoded frame then
+void UpdateSeqInfo(SeqInfo* seqInfo, const Mat& frame)
+{
+	if(seqInfo->width <= 0 || seqInfo->height <= 0) {
+		seqInfo->width = frame.cols;
+		seqInfo->height = frame.rows;
+	}
+}
 
-		if(frame.empty())
-			break;
+// called at the end of the stream, the number of decoded frames replaces
+// the estimate from the header (or fills it in the lazy mode); the header counts
+// the first_frame frames skipped by -S as well
+void FinalizeSeqInfo(SeqInfo* seqInfo, int first_frame, int frame_num)
+{
+	if(seqInfo->length >= 0 && seqInfo->length != first_frame + frame_num)
+		fprintf(stderr, "Container reports %d frames, decoded %d\n", seqInfo->length, first_frame + frame_num);
+	seqInfo->length = frame_num;
+}
 
-		if(frame_num == 0) {
-			seqInfo->width = frame.cols;
-			seqInfo->height = frame.rows;
-		}
+// position the source on the given frame without decoding the frames before it
+// where it can seek; the rest, or all of a stream which cannot seek, is skipped
+// with grab() (no retrieve/conversion)
+int SeekToFrame(FrameSource& source, int frame_num)
+{
+	if(frame_num <= 0)
+		return 0;
 
-		frame_num++;
-    }
-	seqInfo->length = frame_num;
+	int pos = source.seek(frame_num);
+	for(; pos < frame_num; pos++)
+		if(!source.grab())
+			break;
+
+	return pos;
 }
 
 void usage()
 {
 	fprintf(stderr, "Extract dense trajectories from a video\n\n");
 	fprintf(stderr, "Usage: DenseTrack video_file [options]\n");
+	fprintf(stderr, "       DenseTrack - -r WxH [options] < frames.yuv\n");
+	fprintf(stderr, "       DenseTrack -B manifest [options]\n");
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "  -h                        Display this message and exit\n");
 	fprintf(stderr, "  -S [start frame]          The start frame to compute feature (default: S=0 frame)\n");
@@ -84,8 +168,28 @@ void usage()
 	fprintf(stderr, "  -N [neighborhood size]    The neighborhood size for computing the descriptor (default: N=32 pixels)\n");
 	fprintf(stderr, "  -s [spatial cells]        The number of cells in the nxy axis (default: nxy=2 cells)\n");
 	fprintf(stderr, "  -t [temporal cells]       The number of cells in the nt axis (default: nt=3 cells)\n");
-	fprintf(stderr, "  -A [scale number]         The number of maximal spatial scales (default: 8 scales)\n");
+	fprintf(stderr, "  -A [scale number]         The number of maximal spatial scales (default: 1 scale)\n");
 	fprintf(stderr, "  -I [initial gap]          The gap for re-sampling feature points (default: 1 frame)\n");
+	fprintf(stderr, "  -M [sparse sampling]      Compute the corner response for new points in the empty cells, on the whole frame every L samplings (1), or always on the whole frame (0) (default: M=0)\n");
+	fprintf(stderr, "  -R [bilinear]             Interpolate the flow bilinearly when tracking (1) or take the nearest pixel (0) (default: R=0)\n");
+	fprintf(stderr, "  -Y [pyramid cascade]      Build each pyramid level from the one above (1) or from the full frame (0) (default: Y=1)\n");
+	fprintf(stderr, "  -C [cache pyramid]        Sample new points on the smoothed float pyramid of the flow (default: C=0)\n");
+	fprintf(stderr, "  -F [warm iterations]      Start the flow from the previous one with this many iterations, 0 to start from zero; use with -A > 1 (default: F=0)\n");
+	fprintf(stderr, "  -T [threads]              The number of worker threads, 0 for one per core (default: T=0)\n");
+	fprintf(stderr, "  -V [simd level]           Limit the flow, tracking and descriptor kernels to 0 scalar, 1 AVX2 or 2 AVX-512 (default: best available)\n");
+	fprintf(stderr, "  -O [output format]        The trajectory output: 0 text, 1 binary records, 2 columnar (default: O=0)\n");
+	fprintf(stderr, "  -o [output file]          The trajectory file (default: out_of_tracks.txt, out_of_tracks.bin for -O 1, out_of_tracks.cols for -O 2)\n");
+	fprintf(stderr, "  -D [debug file]           The file of the trajectory points for the text output (default: out_of_tracks_debug.txt)\n");
+	fprintf(stderr, "  -G [streaming]            Segment the hand trajectories window by window while tracking (1) or once at the end (0) (default: G=0)\n");
+	fprintf(stderr, "  -g [segment file]         The clusters of every window for -G 1 (default: out_of_segments.txt)\n");
+	fprintf(stderr, "  -X [descriptors]          Compute the HOG, HOF and MBH descriptors of the trajectories (default: X=0)\n");
+	fprintf(stderr, "  -x [feature file]         The file of the trajectory features for -X 1 (default: out_features.txt)\n");
+	fprintf(stderr, "  -H [compact histograms]   Keep the integral histograms of -X 1 in 16-bit tiles, for large frames (default: H=0)\n");
+	fprintf(stderr, "  -r [raw size]             Read the video as raw I420 (yuv420p) frames of this size, e.g. 640x480; '-' as video_file reads stdin\n");
+	fprintf(stderr, "  -P [probe mode]           How to get the video length: 0 from the container headers, 1 by counting at the end of the stream (default: 0)\n");
+	fprintf(stderr, "  -B [manifest]             Process the videos of the manifest, one per line as 'video_file output_dir [options]'; the output files of a video go to its directory, so -o, -D, -g and -x must be relative\n");
+	fprintf(stderr, "  -j [workers]              The number of videos processed at the same time with -B, 0 for one per core (default: j=0)\n");
+	fprintf(stderr, "  -b [report file]          The frames, seconds and frames per second of every video with -B (default: batch_report.txt)\n");
 }
 
 bool arg_parse(int argc, char** argv)
@@ -93,7 +197,7 @@ bool arg_parse(int argc, char** argv)
 	int c;
 	bool flag = false;
 	char* executable = basename(argv[0]);
-	while((c = getopt (argc, argv, "hS:E:L:W:N:s:t:A:I:")) != -1)
+	while((c = getopt (argc, argv, "hS:E:L:W:N:s:t:A:I:M:R:Y:C:O:o:D:G:g:X:x:H:P:T:V:F:B:j:b:r:")) != -1)
 	switch(c) {
 		case 'S':
 		start_frame = atoi(optarg);
@@ -124,6 +228,69 @@ bool arg_parse(int argc, char** argv)
 		case 'I':
 		init_gap = atoi(optarg);
 		break;	
+		case 'M':
+		sparse_sample = atoi(optarg);
+		break;
+		case 'R':
+		track_bilinear = atoi(optarg);
+		break;
+		case 'Y':
+		pyramid_cascade = atoi(optarg);
+		break;
+		case 'C':
+		cache_pyramid = atoi(optarg);
+		break;
+		case 'O':
+		output_format = atoi(optarg);
+		break;
+		case 'o':
+		track_file = optarg;
+		break;
+		case 'D':
+		debug_file = optarg;
+		break;
+		case 'G':
+		stream_segm = atoi(optarg);
+		break;
+		case 'g':
+		segm_file = optarg;
+		break;
+		case 'X':
+		compute_desc = atoi(optarg);
+		break;
+		case 'x':
+		feature_file = optarg;
+		break;
+		case 'H':
+		compact_desc = atoi(optarg);
+		break;
+		case 'P':
+		probe_mode = atoi(optarg);
+		break;
+		case 'T':
+		num_threads = atoi(optarg);
+		break;
+		case 'V':
+		simd_limit = atoi(optarg);
+		break;
+		case 'F':
+		warm_iterations = atoi(optarg);
+		break;
+		case 'B':
+		batch_file = optarg;
+		break;
+		case 'j':
+		batch_workers = atoi(optarg);
+		break;
+		case 'b':
+		batch_report = optarg;
+		break;
+		case 'r':
+		if(sscanf(optarg, "%dx%d", &raw_width, &raw_height) != 2) {
+			fprintf(stderr, "error parsing the raw frame size %s\n", optarg);
+			abort();
+		}
+		break;
 
 		case 'h':
 		usage();
@@ -2,6 +2,8 @@
 #define OPTICALFLOW_H_
 
 #include "DenseTrack.h"
+#include "ThreadPool.h"
+#include "FarnebackSIMD.h"
 
 #include <time.h>
 
@@ -10,67 +12,21 @@ using namespace cv;
 namespace my
 {
 
+// polynomial expansion of the rows [y0, y1), every caller owns its scratch row
+// (_row, (width + n*2)*3 floats) so that horizontal stripes of the image can be
+// processed concurrently
 static void
-FarnebackPolyExp( const Mat& src, Mat& dst, int n, double sigma )
+FarnebackPolyExpRows( const Mat& src, Mat& dst, int y0, int y1, int n,
+                      const float* g, const float* xg, const float* xxg,
+                      double ig11, double ig03, double ig33, double ig55, float* _row )
 {
     int k, x, y;
 
-    assert( src.type() == CV_32FC1 );
     int width = src.cols;
     int height = src.rows;
-    AutoBuffer<float> kbuf(n*6 + 3), _row((width + n*2)*3);
-    float* g = kbuf + n;
-    float* xg = g + n*2 + 1;
-    float* xxg = xg + n*2 + 1;
-    float *row = (float*)_row + n*3;
-
-    if( sigma < FLT_EPSILON )
-        sigma = n*0.3;
-
-    double s = 0.;
-    for( x = -n; x <= n; x++ )
-    {
-        g[x] = (float)std::exp(-x*x/(2*sigma*sigma));
-        s += g[x];
-    }
-
-    s = 1./s;
-    for( x = -n; x <= n; x++ )
-    {
-        g[x] = (float)(g[x]*s);
-        xg[x] = (float)(x*g[x]);
-        xxg[x] = (float)(x*x*g[x]);
-    }
-
-    Mat_<double> G = Mat_<double>::zeros(6, 6);
-
-    for( y = -n; y <= n; y++ )
-        for( x = -n; x <= n; x++ )
-        {
-            G(0,0) += g[y]*g[x];
-            G(1,1) += g[y]*g[x]*x*x;
-            G(3,3) += g[y]*g[x]*x*x*x*x;
-            G(5,5) += g[y]*g[x]*x*x*y*y;
-        }
-
-    //G[0][0] = 1.;
-    G(2,2) = G(0,3) = G(0,4) = G(3,0) = G(4,0) = G(1,1);
-    G(4,4) = G(3,3);
-    G(3,4) = G(4,3) = G(5,5);
-
-    // invG:
-    // [ x        e  e    ]
-    // [    y             ]
-    // [       y          ]
-    // [ e        z       ]
-    // [ e           z    ]
-    // [                u ]
-    Mat_<double> invG = G.inv(DECOMP_CHOLESKY);
-    double ig11 = invG(1,1), ig03 = invG(0,3), ig33 = invG(3,3), ig55 = invG(5,5);
-
-    dst.create( height, width, CV_32FC(5) );
+    float *row = _row + n*3;
 
-    for( y = 0; y < height; y++ )
+    for( y = y0; y < y1; y++ )
     {
         float g0 = g[0], g1, g2;
         float *srow0 = (float*)(src.data + src.step*y), *srow1 = 0;
@@ -136,105 +92,303 @@ FarnebackPolyExp( const Mat& src, Mat& dst, int n, double sigma )
             drow[x*5+4] = (float)(b6*ig55);
         }
     }
+}
 
-    row -= n*3;
+// the Gaussian kernels and the inverse moment matrix of the polynomial expansion,
+// they only depend on n and sigma and are kept in the workspace
+typedef struct {
+    int n;
+    double sigma;
+    std::vector<float> kbuf;   // g, xg and xxg, 2n+1 values each
+    double ig11, ig03, ig33, ig55;
+}PolyExpCoeffs;
+
+static void
+FarnebackPolyExpCoeffs( int n, double sigma, PolyExpCoeffs& coeffs )
+{
+    int x, y;
+
+    coeffs.n = n;
+    coeffs.sigma = sigma;
+    coeffs.kbuf.resize(n*6 + 3);
+    float* g = &coeffs.kbuf[0] + n;
+    float* xg = g + n*2 + 1;
+    float* xxg = xg + n*2 + 1;
+
+    if( sigma < FLT_EPSILON )
+        sigma = n*0.3;
+
+    double s = 0.;
+    for( x = -n; x <= n; x++ )
+    {
+        g[x] = (float)std::exp(-x*x/(2*sigma*sigma));
+        s += g[x];
+    }
+
+    s = 1./s;
+    for( x = -n; x <= n; x++ )
+    {
+        g[x] = (float)(g[x]*s);
+        xg[x] = (float)(x*g[x]);
+        xxg[x] = (float)(x*x*g[x]);
+    }
+
+    Mat_<double> G = Mat_<double>::zeros(6, 6);
+
+    for( y = -n; y <= n; y++ )
+        for( x = -n; x <= n; x++ )
+        {
+            G(0,0) += g[y]*g[x];
+            G(1,1) += g[y]*g[x]*x*x;
+            G(3,3) += g[y]*g[x]*x*x*x*x;
+            G(5,5) += g[y]*g[x]*x*x*y*y;
+        }
+
+    //G[0][0] = 1.;
+    G(2,2) = G(0,3) = G(0,4) = G(3,0) = G(4,0) = G(1,1);
+    G(4,4) = G(3,3);
+    G(3,4) = G(4,3) = G(5,5);
+
+    // invG:
+    // [ x        e  e    ]
+    // [    y             ]
+    // [       y          ]
+    // [ e        z       ]
+    // [ e           z    ]
+    // [                u ]
+    Mat_<double> invG = G.inv(DECOMP_CHOLESKY);
+    coeffs.ig11 = invG(1,1);
+    coeffs.ig03 = invG(0,3);
+    coeffs.ig33 = invG(3,3);
+    coeffs.ig55 = invG(5,5);
 }
 
+// scratch memory of the flow computation, kept from frame to frame so that the
+// frame loop does not allocate once the sizes are known; the polynomial expansion
+// and the flow use separate members and may run on different threads
+class FarnebackWorkspace
+{
+public:
+    // polynomial expansion
+    PolyExpCoeffs coeffs;
+    Mat blur;                  // smoothed float image
+    Mat level;                 // blurred pyramid level before downsampling
+    std::vector<float> smooth; // two rows for the vertical pass of the smoothing
+    std::vector<float> rows;   // one scratch row per stripe
+
+    // flow
+    Mat M;                     // matrices of FarnebackUpdateMatrices
+    std::vector<float> vsum, hsum;
+    Mat channels[2], medians[2];
+
+    // pyramid levels and upsampled flow
+    std::vector<float> gauss;  // kernel of FarnebackGaussianBlur
+    std::vector<float> brow;   // a source row with its reflected borders
+    std::vector<const float*> srows; // the source rows under the vertical kernel
+    Mat hblur;                 // horizontal pass of the blur
+    std::vector<int> xofs;     // source column of each value of a resized row
+    std::vector<float> alpha;  // and the weights of it and of its right neighbour
+    std::vector<float> hrows;  // two horizontally resized source rows
+
+    FarnebackWorkspace()
+    {
+        coeffs.n = -1;
+        coeffs.sigma = 0;
+    }
+};
+
+// processes nstripes horizontal stripes of the image, each with its own scratch row
+class FarnebackPolyExpInvoker : public ParallelBody
+{
+public:
+    FarnebackPolyExpInvoker( const Mat& _src, Mat& _dst, const PolyExpCoeffs& _coeffs, int _nstripes, float* _rows )
+        : src(_src), dst(_dst), coeffs(_coeffs), nstripes(_nstripes), rows(_rows) {}
+
+    void operator()( int s0, int s1 ) const
+    {
+        int n = coeffs.n;
+        const float* g = &coeffs.kbuf[0] + n;
+        const float* xg = g + n*2 + 1;
+        const float* xxg = xg + n*2 + 1;
+        int rowsize = (src.cols + n*2)*3;
+
+        for( int s = s0; s < s1; s++ )
+        {
+            int y0 = (int)((int64)src.rows*s/nstripes);
+            int y1 = (int)((int64)src.rows*(s+1)/nstripes);
+            float* row = rows + rowsize*s;
+
+            switch( FarnebackSimdLevel() )
+            {
+            case SIMD_AVX512:
+                FarnebackPolyExpRows_AVX512( src, dst, y0, y1, n, g, xg, xxg, coeffs.ig11, coeffs.ig03, coeffs.ig33, coeffs.ig55, row );
+                break;
+            case SIMD_AVX2:
+                FarnebackPolyExpRows_AVX2( src, dst, y0, y1, n, g, xg, xxg, coeffs.ig11, coeffs.ig03, coeffs.ig33, coeffs.ig55, row );
+                break;
+            default:
+                FarnebackPolyExpRows( src, dst, y0, y1, n, g, xg, xxg, coeffs.ig11, coeffs.ig03, coeffs.ig33, coeffs.ig55, row );
+            }
+        }
+    }
+
+private:
+    const Mat& src;
+    Mat& dst;
+    const PolyExpCoeffs& coeffs;
+    int nstripes;
+    float* rows;
+};
+
 static void
-FarnebackUpdateMatrices( const Mat& _R0, const Mat& _R1, const Mat& _flow, Mat& matM, int _y0, int _y1 )
+FarnebackPolyExp( const Mat& src, Mat& dst, int n, double sigma, FarnebackWorkspace& ws )
+{
+    assert( src.type() == CV_32FC1 );
+    int width = src.cols;
+    int height = src.rows;
+
+    if( ws.coeffs.n != n || ws.coeffs.sigma != sigma )
+        FarnebackPolyExpCoeffs( n, sigma, ws.coeffs );
+
+    // rows are independent, process them in horizontal stripes on the thread pool
+    int nstripes = std::max(std::min(thread_pool ? thread_pool->size() : 1, height), 1);
+    size_t size = (size_t)(width + n*2)*3*nstripes;
+    if( ws.rows.size() < size )
+        ws.rows.resize(size);
+
+    dst.create( height, width, CV_32FC(5) );
+
+    ParallelFor( 0, nstripes, FarnebackPolyExpInvoker(src, dst, ws.coeffs, nstripes, &ws.rows[0]) );
+}
+
+static void
+FarnebackPolyExp( const Mat& src, Mat& dst, int n, double sigma )
+{
+    FarnebackWorkspace ws;
+    FarnebackPolyExp( src, dst, n, sigma, ws );
+}
+
+// the scalar reference for the pixels [_x0, _x1) of the row y
+static void
+FarnebackUpdateMatricesRow( const Mat& _R0, const Mat& _R1, const Mat& _flow, Mat& matM, int y, int _x0, int _x1 )
 {
     const int BORDER = 5;
     static const float border[BORDER] = {0.14f, 0.14f, 0.4472f, 0.4472f, 0.4472f};
 
-    int x, y, width = _flow.cols, height = _flow.rows;
+    int x, width = _flow.cols, height = _flow.rows;
     const float* R1 = (float*)_R1.data;
     size_t step1 = _R1.step/sizeof(R1[0]);
 
-    matM.create(height, width, CV_32FC(5));
+    const float* flow = (float*)(_flow.data + y*_flow.step);
+    const float* R0 = (float*)(_R0.data + y*_R0.step);
+    float* M = (float*)(matM.data + y*matM.step);
 
-    for( y = _y0; y < _y1; y++ )
+    for( x = _x0; x < _x1; x++ )
     {
-        const float* flow = (float*)(_flow.data + y*_flow.step);
-        const float* R0 = (float*)(_R0.data + y*_R0.step);
-        float* M = (float*)(matM.data + y*matM.step);
+        float dx = flow[x*2], dy = flow[x*2+1];
+        float fx = x + dx, fy = y + dy;
 
-        for( x = 0; x < width; x++ )
+        int x1 = cvFloor(fx), y1 = cvFloor(fy);
+        const float* ptr = R1 + y1*step1 + x1*5;
+        float r2, r3, r4, r5, r6;
+
+        fx -= x1; fy -= y1;
+
+        if( (unsigned)x1 < (unsigned)(width-1) &&
+            (unsigned)y1 < (unsigned)(height-1) )
         {
-            float dx = flow[x*2], dy = flow[x*2+1];
-            float fx = x + dx, fy = y + dy;
+            float a00 = (1.f-fx)*(1.f-fy), a01 = fx*(1.f-fy),
+                  a10 = (1.f-fx)*fy, a11 = fx*fy;
+
+            r2 = a00*ptr[0] + a01*ptr[5] + a10*ptr[step1] + a11*ptr[step1+5];
+            r3 = a00*ptr[1] + a01*ptr[6] + a10*ptr[step1+1] + a11*ptr[step1+6];
+            r4 = a00*ptr[2] + a01*ptr[7] + a10*ptr[step1+2] + a11*ptr[step1+7];
+            r5 = a00*ptr[3] + a01*ptr[8] + a10*ptr[step1+3] + a11*ptr[step1+8];
+            r6 = a00*ptr[4] + a01*ptr[9] + a10*ptr[step1+4] + a11*ptr[step1+9];
+
+            r4 = (R0[x*5+2] + r4)*0.5f;
+            r5 = (R0[x*5+3] + r5)*0.5f;
+            r6 = (R0[x*5+4] + r6)*0.25f;
+        }
+        else
+        {
+            r2 = r3 = 0.f;
+            r4 = R0[x*5+2];
+            r5 = R0[x*5+3];
+            r6 = R0[x*5+4]*0.5f;
+        }
 
-            int x1 = cvFloor(fx), y1 = cvFloor(fy);
-            const float* ptr = R1 + y1*step1 + x1*5;
-            float r2, r3, r4, r5, r6;
+        r2 = (R0[x*5] - r2)*0.5f;
+        r3 = (R0[x*5+1] - r3)*0.5f;
 
-            fx -= x1; fy -= y1;
+        r2 += r4*dy + r6*dx;
+        r3 += r6*dy + r5*dx;
 
-            if( (unsigned)x1 < (unsigned)(width-1) &&
-                (unsigned)y1 < (unsigned)(height-1) )
-            {
-                float a00 = (1.f-fx)*(1.f-fy), a01 = fx*(1.f-fy),
-                      a10 = (1.f-fx)*fy, a11 = fx*fy;
-
-                r2 = a00*ptr[0] + a01*ptr[5] + a10*ptr[step1] + a11*ptr[step1+5];
-                r3 = a00*ptr[1] + a01*ptr[6] + a10*ptr[step1+1] + a11*ptr[step1+6];
-                r4 = a00*ptr[2] + a01*ptr[7] + a10*ptr[step1+2] + a11*ptr[step1+7];
-                r5 = a00*ptr[3] + a01*ptr[8] + a10*ptr[step1+3] + a11*ptr[step1+8];
-                r6 = a00*ptr[4] + a01*ptr[9] + a10*ptr[step1+4] + a11*ptr[step1+9];
-
-                r4 = (R0[x*5+2] + r4)*0.5f;
-                r5 = (R0[x*5+3] + r5)*0.5f;
-                r6 = (R0[x*5+4] + r6)*0.25f;
-            }
-            else
-            {
-                r2 = r3 = 0.f;
-                r4 = R0[x*5+2];
-                r5 = R0[x*5+3];
-                r6 = R0[x*5+4]*0.5f;
-            }
+        if( (unsigned)(x - BORDER) >= (unsigned)(width - BORDER*2) ||
+            (unsigned)(y - BORDER) >= (unsigned)(height - BORDER*2))
+        {
+            float scale = (x < BORDER ? border[x] : 1.f)*
+                (x >= width - BORDER ? border[width - x - 1] : 1.f)*
+                (y < BORDER ? border[y] : 1.f)*
+                (y >= height - BORDER ? border[height - y - 1] : 1.f);
 
-            r2 = (R0[x*5] - r2)*0.5f;
-            r3 = (R0[x*5+1] - r3)*0.5f;
+            r2 *= scale; r3 *= scale; r4 *= scale;
+            r5 *= scale; r6 *= scale;
+        }
 
-            r2 += r4*dy + r6*dx;
-            r3 += r6*dy + r5*dx;
+        M[x*5]   = r4*r4 + r6*r6; // G(1,1)
+        M[x*5+1] = (r4 + r5)*r6;  // G(1,2)=G(2,1)
+        M[x*5+2] = r5*r5 + r6*r6; // G(2,2)
+        M[x*5+3] = r4*r2 + r6*r3; // h(1)
+        M[x*5+4] = r6*r2 + r5*r3; // h(2)
+    }
+}
 
-            if( (unsigned)(x - BORDER) >= (unsigned)(width - BORDER*2) ||
-                (unsigned)(y - BORDER) >= (unsigned)(height - BORDER*2))
-            {
-                float scale = (x < BORDER ? border[x] : 1.f)*
-                    (x >= width - BORDER ? border[width - x - 1] : 1.f)*
-                    (y < BORDER ? border[y] : 1.f)*
-                    (y >= height - BORDER ? border[height - y - 1] : 1.f);
+static void
+FarnebackUpdateMatrices( const Mat& _R0, const Mat& _R1, const Mat& _flow, Mat& matM, int _y0, int _y1 )
+{
+    const int BORDER = 5;
 
-                r2 *= scale; r3 *= scale; r4 *= scale;
-                r5 *= scale; r6 *= scale;
-            }
+    int y, width = _flow.cols, height = _flow.rows;
+    int level = FarnebackSimdLevel();
 
-            M[x*5]   = r4*r4 + r6*r6; // G(1,1)
-            M[x*5+1] = (r4 + r5)*r6;  // G(1,2)=G(2,1)
-            M[x*5+2] = r5*r5 + r6*r6; // G(2,2)
-            M[x*5+3] = r4*r2 + r6*r3; // h(1)
-            M[x*5+4] = r6*r2 + r5*r3; // h(2)
+    matM.create(height, width, CV_32FC(5));
+
+    for( y = _y0; y < _y1; y++ )
+    {
+        int x = 0;
+
+        // the vector kernels only cover the inner part without border weights
+        if( level != SIMD_NONE && y >= BORDER && y < height - BORDER && width > BORDER*2 )
+        {
+            FarnebackUpdateMatricesRow( _R0, _R1, _flow, matM, y, 0, BORDER );
+            if( level == SIMD_AVX512 )
+                x = FarnebackUpdateMatricesRow_AVX512( _R0, _R1, _flow, matM, y, BORDER, width - BORDER );
+            else
+                x = FarnebackUpdateMatricesRow_AVX2( _R0, _R1, _flow, matM, y, BORDER, width - BORDER );
         }
+
+        FarnebackUpdateMatricesRow( _R0, _R1, _flow, matM, y, x, width );
     }
 }
 
 static void
 FarnebackUpdateFlow_GaussianBlur( const Mat& _R0, const Mat& _R1,
                                   Mat& _flow, Mat& matM, int block_size,
-                                  bool update_matrices )
+                                  bool update_matrices, FarnebackWorkspace& ws )
 {
     int x, y, i, width = _flow.cols, height = _flow.rows;
     int m = block_size/2;
+    int level = FarnebackSimdLevel();
     int y0 = 0, y1;
     int min_update_stripe = std::max((1 << 10)/width, block_size);
     double sigma = m*0.3, s = 1;
 
-    AutoBuffer<float> _vsum((width+m*2+2)*5 + 16), _hsum(width*5 + 16);
+    ws.vsum.resize((width+m*2+2)*5 + 16);
+    ws.hsum.resize(width*5 + 16);
     AutoBuffer<float, 4096> _kernel((m+1)*5 + 16);
     AutoBuffer<float*, 1024> _srow(m*2+1);
-    float *vsum = alignPtr((float*)_vsum + (m+1)*5, 16), *hsum = alignPtr((float*)_hsum, 16);
+    float *vsum = alignPtr(&ws.vsum[0] + (m+1)*5, 16), *hsum = alignPtr(&ws.hsum[0], 16);
     float* kernel = (float*)_kernel;
     const float** srow = (const float**)&_srow[0];
     kernel[0] = (float)s;
@@ -273,7 +427,12 @@ FarnebackUpdateFlow_GaussianBlur( const Mat& _R0, const Mat& _R1,
             srow[m+i] = (const float*)(matM.data + matM.step*std::min(y+i,height-1));
         }
 
+        // the AVX kernels leave the tail to the SSE and the scalar loops
         x = 0;
+        if( level == SIMD_AVX512 )
+            x = FarnebackBlurVertRow_AVX512( srow, kernel, m, vsum, width*5 );
+        else if( level == SIMD_AVX2 )
+            x = FarnebackBlurVertRow_AVX2( srow, kernel, m, vsum, width*5 );
 #if CV_SSE2
         if( useSIMD )
         {
@@ -342,6 +501,10 @@ FarnebackUpdateFlow_GaussianBlur( const Mat& _R0, const Mat& _R1,
 
         // horizontal blur
         x = 0;
+        if( level == SIMD_AVX512 )
+            x = FarnebackBlurHorzRow_AVX512( vsum, kernel, m, hsum, width*5 );
+        else if( level == SIMD_AVX2 )
+            x = FarnebackBlurHorzRow_AVX2( vsum, kernel, m, hsum, width*5 );
 #if CV_SSE2
         if( useSIMD )
         {
@@ -375,7 +538,13 @@ FarnebackUpdateFlow_GaussianBlur( const Mat& _R0, const Mat& _R1,
             hsum[x] = sum;
         }
 
-        for( x = 0; x < width; x++ )
+        x = 0;
+        if( level == SIMD_AVX512 )
+            x = FarnebackSolveFlowRow_AVX512( hsum, flow, width );
+        else if( level == SIMD_AVX2 )
+            x = FarnebackSolveFlowRow_AVX2( hsum, flow, width );
+
+        for( ; x < width; x++ )
         {
             g11 = hsum[x*5];
             g12 = hsum[x*5+1];
@@ -408,6 +577,82 @@ void MedianBlurFlow(Mat& flow, const int ksize)
 	merge(channels, 2, flow);
 }
 
+// the same without temporary images: the channels are split into and merged from
+// the workspace, and the median is not computed in place (which would copy)
+void MedianBlurFlow(Mat& flow, const int ksize, FarnebackWorkspace& ws)
+{
+	int width = flow.cols, height = flow.rows;
+	for(int i = 0; i < 2; i++) {
+		ws.channels[i].create(height, width, CV_32FC1);
+		ws.medians[i].create(height, width, CV_32FC1);
+	}
+
+	for(int y = 0; y < height; y++) {
+		const float* f = flow.ptr<float>(y);
+		float* cx = ws.channels[0].ptr<float>(y);
+		float* cy = ws.channels[1].ptr<float>(y);
+		for(int x = 0; x < width; x++) {
+			cx[x] = f[2*x];
+			cy[x] = f[2*x+1];
+		}
+	}
+
+	medianBlur(ws.channels[0], ws.medians[0], ksize);
+	medianBlur(ws.channels[1], ws.medians[1], ksize);
+
+	for(int y = 0; y < height; y++) {
+		float* f = flow.ptr<float>(y);
+		const float* mx = ws.medians[0].ptr<float>(y);
+		const float* my = ws.medians[1].ptr<float>(y);
+		for(int x = 0; x < width; x++) {
+			f[2*x] = mx[x];
+			f[2*x+1] = my[x];
+		}
+	}
+}
+
+// 3x3 Gaussian smoothing with sigma 0 (kernel 1/4 1/2 1/4, reflected border) from
+// 8 bit straight to float; all sums are exact, so this equals convertTo + GaussianBlur
+static void
+FarnebackSmooth3x3(const Mat& img, Mat& dst, std::vector<float>& buf)
+{
+	int width = img.cols, height = img.rows;
+	dst.create(height, width, CV_32FC1);
+	buf.resize(width*2);
+
+	// horizontal pass
+	for(int y = 0; y < height; y++) {
+		const uchar* s = img.ptr<uchar>(y);
+		float* d = dst.ptr<float>(y);
+		if(width == 1) {
+			d[0] = s[0];
+			continue;
+		}
+		d[0] = s[0]*0.5f + (s[1] + s[1])*0.25f;
+		for(int x = 1; x < width-1; x++)
+			d[x] = s[x]*0.5f + (s[x-1] + s[x+1])*0.25f;
+		d[width-1] = s[width-1]*0.5f + (s[width-2] + s[width-2])*0.25f;
+	}
+
+	// vertical pass in place, keeping copies of the unfiltered rows y-1 and y
+	float* prev = &buf[0];
+	float* cur = &buf[width];
+	memcpy(cur, dst.ptr<float>(0), width*sizeof(float));
+	memcpy(prev, dst.ptr<float>(height > 1 ? 1 : 0), width*sizeof(float));
+
+	for(int y = 0; y < height; y++) {
+		float* d = dst.ptr<float>(y);
+		const float* next = y+1 < height ? dst.ptr<float>(y+1) : (height > 1 ? prev : cur);
+		for(int x = 0; x < width; x++)
+			d[x] = cur[x]*0.5f + (prev[x] + next[x])*0.25f;
+
+		if(y+1 < height) {
+			std::swap(prev, cur);
+			memcpy(cur, next, width*sizeof(float));
+		}
+	}
+}
+
 void FarnebackPolyExpPyr(const Mat& img, std::vector<Mat>& poly_exp_pyr,
 						 std::vector<float>& fscales, int poly_n, double poly_sigma)
 {
@@ -460,8 +705,9 @@ void calcOpticalFlowFarneback(std::vector<Mat>& prev_poly_exp_pyr, std::vector<M
 
         FarnebackUpdateMatrices( R[0], R[1], flow, M, 0, flow.rows );
 
+        FarnebackWorkspace ws;
         for( i = 0; i < iterations; i++ )
-            FarnebackUpdateFlow_GaussianBlur( R[0], R[1], flow, M, winsize, i < iterations - 1 );
+            FarnebackUpdateFlow_GaussianBlur( R[0], R[1], flow, M, winsize, i < iterations - 1, ws );
 		
 		MedianBlurFlow(flow, 5);
         prevFlow = flow;
@@ -470,59 +716,326 @@ void calcOpticalFlowFarneback(std::vector<Mat>& prev_poly_exp_pyr, std::vector<M
 }
 
 
+// single scale polynomial expansion of a 8 bit image, without allocations
+// once the workspace has seen the frame size
+void FarnebackPolyExp2(const Mat& img, Mat& poly_exp_pyr, int poly_n, double poly_sigma, FarnebackWorkspace& ws)
+{
+    int width = poly_exp_pyr.cols;
+    int height = poly_exp_pyr.rows;
+
+    if(img.type() == CV_8UC1)
+        FarnebackSmooth3x3(img, ws.blur, ws.smooth);
+    else {
+        img.convertTo(ws.blur, CV_32F);
+        GaussianBlur(ws.blur, ws.blur, Size(3, 3), 0, 0);
+    }
+
+    if(ws.blur.cols == width && ws.blur.rows == height)
+        FarnebackPolyExp(ws.blur, poly_exp_pyr, poly_n, poly_sigma, ws);
+    else {
+        Mat I;
+        resize(ws.blur, I, Size(width, height), CV_INTER_LINEAR);
+        FarnebackPolyExp(I, poly_exp_pyr, poly_n, poly_sigma, ws);
+    }
+}
+
 void FarnebackPolyExp2(const Mat& img, Mat& poly_exp_pyr, int poly_n, double poly_sigma)
 {
-    Mat fimg;
+    FarnebackWorkspace ws;
+    FarnebackPolyExp2(img, poly_exp_pyr, poly_n, poly_sigma, ws);
+}
 
-    double sigma = 0;
-    int smooth_sz = cvRound(sigma*5)|1;
-    smooth_sz = std::max(smooth_sz, 3);
+// the flow is computed in place in flow_pyr, the polynomial expansions are only read;
+// init_flow (if given) is used as the initial estimate instead of zero flow, e.g.
+// the flow of the previous frame pair, which then needs fewer iterations
+void calcOpticalFlowFarneback2(const Mat& prev_poly_exp_pyr, const Mat& poly_exp_pyr, Mat& flow_pyr, int winsize, int iterations,
+                               FarnebackWorkspace& ws, const Mat& init_flow = Mat())
+{
+    int i;
+    Mat& flow = flow_pyr;
 
-    int width = poly_exp_pyr.cols;
-    int height = poly_exp_pyr.rows;
+    flow.create( prev_poly_exp_pyr.size(), CV_32FC2 );
 
-    Mat R, I;
+    if( init_flow.data && init_flow.size() == flow.size() && init_flow.type() == CV_32FC2 ) {
+        if( init_flow.data != flow.data )
+            init_flow.copyTo(flow);
+    }
+    else
+        flow.setTo(Scalar::all(0));
 
-    img.convertTo(fimg, CV_32F);
-    GaussianBlur(fimg, fimg, Size(smooth_sz, smooth_sz), sigma, sigma);
-    resize(fimg, I, Size(width, height), CV_INTER_LINEAR);
+    FarnebackUpdateMatrices( prev_poly_exp_pyr, poly_exp_pyr, flow, ws.M, 0, flow.rows );
 
-    FarnebackPolyExp(I, R, poly_n, poly_sigma);
-    R.copyTo(poly_exp_pyr);
+    for( i = 0; i < iterations; i++ )
+        FarnebackUpdateFlow_GaussianBlur( prev_poly_exp_pyr, poly_exp_pyr, flow, ws.M, winsize, i < iterations - 1, ws );
+    
+    MedianBlurFlow(flow, 5, ws);
+}
 
+void calcOpticalFlowFarneback2(const Mat& prev_poly_exp_pyr, const Mat& poly_exp_pyr, Mat& flow_pyr, int winsize, int iterations,
+                               const Mat& init_flow = Mat())
+{
+    FarnebackWorkspace ws;
+    calcOpticalFlowFarneback2(prev_poly_exp_pyr, poly_exp_pyr, flow_pyr, winsize, iterations, ws, init_flow);
 }
 
-void calcOpticalFlowFarneback2(Mat& prev_poly_exp_pyr, Mat& poly_exp_pyr, Mat& flow_pyr, int winsize, int iterations)
+// cv::GaussianBlur(src, dst, Size(ksize, ksize), sigma, sigma) of a float image with
+// the same kernel, reflected border and order of the sums, but with the kernel and the
+// intermediate image kept in the workspace instead of a new filter engine per call
+static void
+FarnebackGaussianBlur( const Mat& src, Mat& dst, int ksize, double sigma, FarnebackWorkspace& ws )
 {
-    int i, k;
-    Mat prevFlow, flow;
+    assert( src.type() == CV_32FC1 && src.data != dst.data );
+    int x, y, k, width = src.cols, height = src.rows;
+    int m = ksize/2;
+
+    // getGaussianKernel(ksize, sigma, CV_32F)
+    ws.gauss.resize(ksize);
+    float* kernel = &ws.gauss[0];
+    double scale2X = -0.5/(sigma*sigma), sum = 0;
+    for( k = 0; k < ksize; k++ )
+    {
+        double t = k - (ksize-1)*0.5;
+        kernel[k] = (float)std::exp(scale2X*t*t);
+        sum += kernel[k];
+    }
+    sum = 1./sum;
+    for( k = 0; k < ksize; k++ )
+        kernel[k] = (float)(kernel[k]*sum);
+    const float* kc = kernel + m;
+
+    // horizontal pass; OpenCV sums the symmetric pairs of kernels up to 5 taps and
+    // goes from left to right over the longer ones
+    ws.hblur.create(height, width, CV_32FC1);
+    ws.brow.resize(width + m*2);
+    float* row = &ws.brow[0] + m;
+    for( y = 0; y < height; y++ )
+    {
+        const float* s = src.ptr<float>(y);
+        float* d = ws.hblur.ptr<float>(y);
+        memcpy(row, s, width*sizeof(float));
+        for( k = 1; k <= m; k++ )
+        {
+            row[-k] = s[borderInterpolate(-k, width, BORDER_REFLECT_101)];
+            row[width-1+k] = s[borderInterpolate(width-1+k, width, BORDER_REFLECT_101)];
+        }
 
+        if( ksize <= 5 )
+            for( x = 0; x < width; x++ )
+            {
+                float t = kc[0]*row[x];
+                for( k = 1; k <= m; k++ )
+                    t += kc[k]*(row[x-k] + row[x+k]);
+                d[x] = t;
+            }
+        else
+            for( x = 0; x < width; x++ )
+            {
+                const float* r = row + x - m;
+                float t = kernel[0]*r[0];
+                for( k = 1; k < ksize; k++ )
+                    t += kernel[k]*r[k];
+                d[x] = t;
+            }
+    }
 
-    int width = flow_pyr.cols;
-    int height = flow_pyr.rows;
+    // vertical pass, always over the symmetric pairs
+    dst.create(height, width, CV_32FC1);
+    ws.srows.resize(ksize);
+    const float** srow = &ws.srows[0] + m;
+    for( y = 0; y < height; y++ )
+    {
+        for( k = -m; k <= m; k++ )
+            srow[k] = ws.hblur.ptr<float>(borderInterpolate(y+k, height, BORDER_REFLECT_101));
 
-    flow.create( height, width, CV_32FC2 );
+        float* d = dst.ptr<float>(y);
+        for( x = 0; x < width; x++ )
+        {
+            float t = kc[0]*srow[0][x];
+            for( k = 1; k <= m; k++ )
+                t += kc[k]*(srow[-k][x] + srow[k][x]);
+            d[x] = t;
+        }
+    }
+}
 
-    if( !prevFlow.data )
-        flow = Mat::zeros( height, width, CV_32FC2 );
+// bilinear resize of a float image with any number of channels to the size of dst, with
+// the coordinates and weights of cv::resize with INTER_LINEAR and the tables kept in the
+// workspace. cv::resize averages the pixels instead when it halves an image exactly,
+// which the sqrt(2) steps of the pyramid never do.
+static void
+FarnebackResize( const Mat& src, Mat& dst, FarnebackWorkspace& ws )
+{
+    assert( src.depth() == CV_32F && dst.type() == src.type() );
+    int cn = src.channels();
+    int swidth = src.cols, sheight = src.rows, dwidth = dst.cols, dheight = dst.rows;
+    int x, y, k, xmax = dwidth;
+
+    if( swidth == dwidth && sheight == dheight )
+    {
+        src.copyTo(dst);
+        return;
+    }
+
+    double scale_x = 1./((double)dwidth/swidth), scale_y = 1./((double)dheight/sheight);
+
+    // the columns are clamped to the image, the last ones only read one pixel
+    ws.xofs.resize(dwidth*cn);
+    ws.alpha.resize(dwidth*cn*2);
+    for( x = 0; x < dwidth; x++ )
+    {
+        float fx = (float)((x+0.5)*scale_x - 0.5);
+        int sx = cvFloor(fx);
+        fx -= sx;
+        if( sx < 0 )
+            fx = 0, sx = 0;
+        if( sx + 1 >= swidth )
+        {
+            xmax = std::min(xmax, x);
+            if( sx >= swidth-1 )
+                fx = 0, sx = swidth-1;
+        }
+        for( k = 0; k < cn; k++ )
+        {
+            ws.xofs[x*cn+k] = sx*cn + k;
+            ws.alpha[(x*cn+k)*2] = 1.f - fx;
+            ws.alpha[(x*cn+k)*2+1] = fx;
+        }
+    }
+    xmax *= cn;
+
+    int len = dwidth*cn;
+    ws.hrows.resize(len*2);
+    float* h0 = &ws.hrows[0];
+    float* h1 = h0 + len;
+    const int* xofs = &ws.xofs[0];
+    const float* alpha = &ws.alpha[0];
+
+    // the rows are clamped but keep their weights, as in cv::resize
+    for( y = 0; y < dheight; y++ )
+    {
+        float fy = (float)((y+0.5)*scale_y - 0.5);
+        int sy = cvFloor(fy);
+        fy -= sy;
+        float b0 = 1.f - fy, b1 = fy;
+
+        for( k = 0; k < 2; k++ )
+        {
+            const float* s = src.ptr<float>(std::min(std::max(sy + k, 0), sheight-1));
+            float* h = k == 0 ? h0 : h1;
+            for( x = 0; x < xmax; x++ )
+                h[x] = s[xofs[x]]*alpha[x*2] + s[xofs[x]+cn]*alpha[x*2+1];
+            for( ; x < len; x++ )
+                h[x] = s[xofs[x]];
+        }
+
+        float* d = dst.ptr<float>(y);
+        for( x = 0; x < len; x++ )
+            d[x] = h0[x]*b0 + h1[x]*b1;
+    }
+}
+
+// float pyramid with the smoothing of FarnebackPolyExpPyr: level k is blurred with
+// sigma (scale-1)/2 of the full frame and downsampled, level 0 gets the 3x3 smoothing
+// of FarnebackPolyExp2. The cascade derives each level from the one above, blurring
+// only by the sigma still missing, which is a small kernel on a small image; without
+// it every level is blurred from the full frame as FarnebackPolyExpPyr does.
+// The levels must have their sizes already (BuildPry).
+void FarnebackBuildPyr(const Mat& img, std::vector<Mat>& fimg_pyr, const std::vector<float>& fscales,
+                       bool cascade, FarnebackWorkspace& ws)
+{
+    int nlayers = fimg_pyr.size();
+
+    if(img.type() == CV_8UC1)
+        FarnebackSmooth3x3(img, fimg_pyr[0], ws.smooth);
     else {
-        resize( prevFlow, flow, Size(width, height), 0, 0, INTER_LINEAR );
-        flow *= scale_stride;
+        img.convertTo(fimg_pyr[0], CV_32F);
+        GaussianBlur(fimg_pyr[0], fimg_pyr[0], Size(3, 3), 0, 0);
     }
 
-    Mat R[2], M;
+    if(!cascade && nlayers > 1)
+        img.convertTo(ws.blur, CV_32F);
 
-    prev_poly_exp_pyr.copyTo(R[0]);
-    poly_exp_pyr.copyTo(R[1]);
+    double var = 0.5; // variance of the 3x3 kernel, in pixels of the full frame
+    for(int k = 1; k < nlayers; k++) {
+        double sigma = (fscales[k]-1)*0.5;
+        const Mat* src = &fimg_pyr[k-1];
 
-    FarnebackUpdateMatrices( R[0], R[1], flow, M, 0, flow.rows );
+        if(!cascade) {
+            int smooth_sz = std::max(cvRound(sigma*5)|1, 3);
+            FarnebackGaussianBlur(ws.blur, ws.level, smooth_sz, sigma, ws);
+            src = &ws.level;
+        }
+        else if(sigma*sigma > var) {
+            // the missing blur in pixels of the level above
+            double sigma_k = sqrt(sigma*sigma - var)/fscales[k-1];
+            int smooth_sz = std::max(cvRound(sigma_k*5)|1, 3);
+            FarnebackGaussianBlur(fimg_pyr[k-1], ws.level, smooth_sz, sigma_k, ws);
+            src = &ws.level;
+            var = sigma*sigma;
+        }
 
-    for( i = 0; i < iterations; i++ )
-        FarnebackUpdateFlow_GaussianBlur( R[0], R[1], flow, M, winsize, i < iterations - 1 );
-    
-    MedianBlurFlow(flow, 5);
-    prevFlow = flow;
-    flow.copyTo(flow_pyr);
+        FarnebackResize(*src, fimg_pyr[k], ws);
+    }
+}
+
+// polynomial expansion of every level of a pyramid, 8 bit levels (e.g. from BuildPry)
+// are smoothed on their own size, float levels (FarnebackBuildPyr) are used as they are
+void FarnebackPolyExpPyr(const std::vector<Mat>& grey_pyr, std::vector<Mat>& poly_exp_pyr,
+                         int poly_n, double poly_sigma, std::vector<FarnebackWorkspace>& ws)
+{
+    int nlayers = grey_pyr.size();
+    poly_exp_pyr.resize(nlayers);
+    ws.resize(nlayers);
+
+    for(int k = 0; k < nlayers; k++) {
+        poly_exp_pyr[k].create(grey_pyr[k].size(), CV_32FC(5));
+        if(grey_pyr[k].type() == CV_32FC1)
+            FarnebackPolyExp(grey_pyr[k], poly_exp_pyr[k], poly_n, poly_sigma, ws[k]);
+        else
+            FarnebackPolyExp2(grey_pyr[k], poly_exp_pyr[k], poly_n, poly_sigma, ws[k]);
+    }
+}
+
+// pyramidal flow from the coarsest level to the finest one, each level starts from
+// the upsampled flow of the level above; init_flow (if given) starts the coarsest
+// level. With a single level this is calcOpticalFlowFarneback2.
+void calcOpticalFlowFarneback(const std::vector<Mat>& prev_poly_exp_pyr, const std::vector<Mat>& poly_exp_pyr,
+                              std::vector<Mat>& flow_pyr, int winsize, int iterations,
+                              std::vector<FarnebackWorkspace>& ws, const Mat& init_flow = Mat())
+{
+    int nlayers = poly_exp_pyr.size();
+    flow_pyr.resize(nlayers);
+    ws.resize(nlayers);
+
+    for(int k = nlayers - 1; k >= 0; k--) {
+        Mat& flow = flow_pyr[k];
+        flow.create(poly_exp_pyr[k].size(), CV_32FC2);
+
+        if(k == nlayers - 1) {
+            calcOpticalFlowFarneback2(prev_poly_exp_pyr[k], poly_exp_pyr[k], flow, winsize, iterations, ws[k], init_flow);
+            continue;
+        }
+
+        FarnebackResize(flow_pyr[k+1], flow, ws[k]);
+        flow *= scale_stride;
+        calcOpticalFlowFarneback2(prev_poly_exp_pyr[k], poly_exp_pyr[k], flow, winsize, iterations, ws[k], flow);
+    }
+}
+
+// mean end-point error between two flow fields
+double FlowEndPointError(const Mat& flow0, const Mat& flow1)
+{
+    double sum = 0;
+    for(int y = 0; y < flow0.rows; y++) {
+        const float* f0 = flow0.ptr<float>(y);
+        const float* f1 = flow1.ptr<float>(y);
+        for(int x = 0; x < flow0.cols; x++) {
+            float dx = f0[2*x] - f1[2*x];
+            float dy = f0[2*x+1] - f1[2*x+1];
+            sum += sqrt(dx*dx + dy*dy);
+        }
+    }
+    return flow0.rows*flow0.cols > 0 ? sum/(flow0.rows*flow0.cols) : 0;
 }
 
 }
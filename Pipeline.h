@@ -0,0 +1,314 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "DenseTrack.h"
+#include "Descriptors.h"
+#include "OpticalFlow.h"
+#include "FrameSource.h"
+
+#include <pthread.h>
+
+using namespace cv;
+
+// all buffers belonging to one frame, reused from frame to frame; the pyramids
+// have one level per scale, level 0 is the full resolution
+typedef struct {
+    Mat frame;                  // decoded BGR image, also used for drawing
+    std::vector<Mat> grey_pyr;
+    std::vector<Mat> float_pyr; // smoothed float pyramid, kept for sampling with cache_pyramid
+    std::vector<Mat> poly_pyr;  // polynomial expansion of float_pyr
+    std::vector<Mat> flow_pyr;  // flow from the previous frame to this one
+    int frame_num;
+}FrameSlot;
+
+// blocking FIFO of slot indices, -1 marks the end of the stream
+class SlotQueue
+{
+public:
+    SlotQueue() : first(0), count(0), stopped(false)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    ~SlotQueue()
+    {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // a fixed ring of capacity indices, set before the first push
+    void reserve(int capacity)
+    {
+        ring.resize(capacity);
+    }
+
+    void push(int index)
+    {
+        pthread_mutex_lock(&mutex);
+        assert(count < (int)ring.size());
+        ring[(first + count) % ring.size()] = index;
+        count++;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // -1 once stopped, also if indices are left
+    int pop()
+    {
+        pthread_mutex_lock(&mutex);
+        while(count == 0 && !stopped)
+            pthread_cond_wait(&cond, &mutex);
+        int index = -1;
+        if(!stopped) {
+            index = ring[first];
+            first = (first + 1) % ring.size();
+            count--;
+        }
+        pthread_mutex_unlock(&mutex);
+        return index;
+    }
+
+    // wakes up a waiting pop(), under the same mutex as the queue
+    void stop()
+    {
+        pthread_mutex_lock(&mutex);
+        stopped = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+private:
+    std::vector<int> ring;
+    int first;
+    int count;
+    bool stopped;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// The work of the stages on one slot: the grey pyramid of a decoded frame, the
+// polynomial expansion and the flow from the previous frame. FramePipeline runs
+// the three on their own threads, DenseTrajectoryExtractor one after the other
+// on the pushed frames. The scratch buffers are kept per stage, so the steady
+// state does not allocate; each method must only be called from one thread.
+class FrameStages
+{
+public:
+    std::vector<float> fscales; // scale of each pyramid level, known after the first Prepare()
+    std::vector<Size> sizes;    // of the first decoded frame, the header of a video may differ
+
+    // statistics of the warm-started flow
+    int flow_count;      // frames with a flow field
+    int iteration_count; // Farneback iterations spent on them
+    double epe_sum;      // end-point difference to the cold-started flow on the checked frames
+    int epe_count;
+
+    double poly_time;    // seconds spent on the float pyramid and the polynomial expansion
+
+    FrameStages(const TrackParams& params_)
+        : flow_count(0), iteration_count(0), epe_sum(0), epe_count(0), poly_time(0), params(params_) {}
+
+    void BuildPyramids(FrameSlot& slot)
+    {
+        BuildPry(sizes, CV_8UC1, slot.grey_pyr);
+        BuildPry(sizes, CV_32FC(5), slot.poly_pyr);
+        BuildPry(sizes, CV_32FC2, slot.flow_pyr);
+    }
+
+    // the grey pyramid of slot.frame
+    void Prepare(FrameSlot& slot, int frame_num)
+    {
+        // the pyramid is laid out on the first frame and kept, the later stages
+        // read it from other threads
+        if(sizes.empty())
+            InitPry(slot.frame.size(), params.scale_num, params.patch_size, fscales, sizes);
+        BuildPyramids(slot);
+
+        // the upper grey levels are only needed for sampling
+        cvtColor(slot.frame, slot.grey_pyr[0], CV_BGR2GRAY);
+        if(!params.cache_pyramid)
+            for(size_t k = 1; k < slot.grey_pyr.size(); k++)
+                resize(slot.grey_pyr[0], slot.grey_pyr[k], slot.grey_pyr[k].size(), 0, 0, INTER_LINEAR);
+        slot.frame_num = frame_num;
+    }
+
+    void Expand(FrameSlot& slot)
+    {
+        std::vector<Mat>& fimg_pyr = params.cache_pyramid ? slot.float_pyr : float_pyr;
+        BuildPry(sizes, CV_32FC1, fimg_pyr);
+
+        int64 start = getTickCount();
+        my::FarnebackBuildPyr(slot.grey_pyr[0], fimg_pyr, fscales, params.pyramid_cascade != 0, pyr_workspace);
+        my::FarnebackPolyExpPyr(fimg_pyr, slot.poly_pyr, 7, 1.5, poly_workspaces);
+        poly_time += (getTickCount() - start)/getTickFrequency();
+    }
+
+    // the flow from prev to slot, both expanded
+    void Flow(FrameSlot& prev, FrameSlot& slot)
+    {
+        // start the coarsest level from the flow of the previous frame pair, if there is one
+        if(params.warm_iterations > 0 && flow_count > 0) {
+            my::calcOpticalFlowFarneback(prev.poly_pyr, slot.poly_pyr, slot.flow_pyr, params.flow_winsize, params.warm_iterations,
+                                         flow_workspaces, prev.flow_pyr.back());
+            iteration_count += params.warm_iterations;
+
+            // compare to the cold start on a few frames to report the accuracy
+            if(params.warm_check_gap > 0 && flow_count % params.warm_check_gap == 0) {
+                my::calcOpticalFlowFarneback(prev.poly_pyr, slot.poly_pyr, cold_flow, params.flow_winsize, params.flow_iterations, flow_workspaces);
+                epe_sum += my::FlowEndPointError(slot.flow_pyr[0], cold_flow[0]);
+                epe_count++;
+            }
+        }
+        else {
+            my::calcOpticalFlowFarneback(prev.poly_pyr, slot.poly_pyr, slot.flow_pyr, params.flow_winsize, params.flow_iterations, flow_workspaces);
+            iteration_count += params.flow_iterations;
+        }
+        flow_count++;
+    }
+
+private:
+    TrackParams params;
+
+    // scratch buffers of the poly and the flow stage, one per pyramid level
+    std::vector<my::FarnebackWorkspace> poly_workspaces;
+    std::vector<my::FarnebackWorkspace> flow_workspaces;
+    my::FarnebackWorkspace pyr_workspace;
+    std::vector<Mat> float_pyr; // the float pyramid when it is not kept in the slots
+    std::vector<Mat> cold_flow;
+};
+
+// Runs decoding + colour conversion, polynomial expansion and optical flow on
+// three threads, the caller (tracker) takes the finished slots in frame order
+// with next() and gives them back with release(). A slot is only refilled after
+// it is released, so the tracker must keep the previous slot until the current
+// one is done: its poly is the input of the flow stage for the current frame.
+// The grey pyramid is built once per frame by the decoder and shared by the
+// polynomial expansion, the flow and the sampling of every scale. The prev/current
+// frames are swapped by passing slot indices.
+class FramePipeline : public FrameStages
+{
+public:
+    FrameSlot* slots;
+    int num_slots;
+    int frame_count;     // frames decoded so far
+    bool end_of_stream;  // the decoder hit the end of the video (not end_frame)
+
+    FramePipeline(const TrackParams& params_, FrameSource& source_, int first_frame_, int last_frame_, int num_slots_)
+        : FrameStages(params_), num_slots(num_slots_), frame_count(0), end_of_stream(false),
+          source(source_), first_frame(first_frame_), last_frame(last_frame_)
+    {
+        // every slot and the -1 at the end fit into each queue
+        free_slots.reserve(num_slots + 1);
+        poly_slots.reserve(num_slots + 1);
+        flow_slots.reserve(num_slots + 1);
+        track_slots.reserve(num_slots + 1);
+
+        slots = new FrameSlot[num_slots];
+        for(int i = 0; i < num_slots; i++)
+            free_slots.push(i);
+    }
+
+    ~FramePipeline()
+    {
+        delete []slots;
+    }
+
+    void start()
+    {
+        pthread_create(&decode_thread, NULL, DecodeStage, this);
+        pthread_create(&poly_thread, NULL, PolyStage, this);
+        pthread_create(&flow_thread, NULL, FlowStage, this);
+    }
+
+    // index of the next slot ready for tracking, -1 at the end
+    int next()
+    {
+        return track_slots.pop();
+    }
+
+    void release(int index)
+    {
+        free_slots.push(index);
+    }
+
+    // stop decoding early, the slots in flight are still delivered by next()
+    void stop()
+    {
+        free_slots.stop();
+    }
+
+    void join()
+    {
+        pthread_join(decode_thread, NULL);
+        pthread_join(poly_thread, NULL);
+        pthread_join(flow_thread, NULL);
+    }
+
+private:
+    FrameSource& source;
+    int first_frame;
+    int last_frame;
+
+    SlotQueue free_slots, poly_slots, flow_slots, track_slots;
+    pthread_t decode_thread, poly_thread, flow_thread;
+
+    static void* DecodeStage(void* arg)
+    {
+        FramePipeline* p = (FramePipeline*)arg;
+
+        for(int frame_num = p->first_frame; frame_num <= p->last_frame; frame_num++) {
+            // -1 after stop()
+            int index = p->free_slots.pop();
+            if(index < 0)
+                break;
+            FrameSlot& slot = p->slots[index];
+
+            if(!p->source.read(slot.frame)) {
+                p->free_slots.push(index);
+                p->end_of_stream = true;
+                break;
+            }
+
+            p->Prepare(slot, frame_num);
+            p->frame_count++;
+            p->poly_slots.push(index);
+        }
+
+        p->poly_slots.push(-1);
+        return NULL;
+    }
+
+    static void* PolyStage(void* arg)
+    {
+        FramePipeline* p = (FramePipeline*)arg;
+
+        int index;
+        while((index = p->poly_slots.pop()) >= 0) {
+            p->Expand(p->slots[index]);
+            p->flow_slots.push(index);
+        }
+
+        p->flow_slots.push(-1);
+        return NULL;
+    }
+
+    static void* FlowStage(void* arg)
+    {
+        FramePipeline* p = (FramePipeline*)arg;
+
+        // the first frame has no flow, it only seeds the tracks
+        int index, prev_index = -1;
+        while((index = p->flow_slots.pop()) >= 0) {
+            if(prev_index >= 0)
+                p->Flow(p->slots[prev_index], p->slots[index]);
+            prev_index = index;
+            p->track_slots.push(index);
+        }
+
+        p->track_slots.push(-1);
+        return NULL;
+    }
+};
+
+#endif /*PIPELINE_H_*/
@@ -0,0 +1,89 @@
+#include "DenseTrack.h"
+#include "Descriptors.h"
+
+// The samplers of the tracker against DenseSample with the point list, which
+// counts the points per cell itself: DenseSample on the occupancy of a
+// SampleGrid and SparseSample refreshing the maximum on every call must return
+// the same new points. The images mix flat and textured blocks, so that some
+// empty cells are below the threshold, and the old points leave some cells
+// occupied.
+//
+// usage: SampleTest
+
+using namespace cv;
+
+static void RandomImage(Mat& grey, int width, int height)
+{
+	grey.create(height, width, CV_8UC1);
+	const int block = 6;
+	for(int by = 0; by < height; by += block)
+	for(int bx = 0; bx < width; bx += block) {
+		bool flat = rand()%3 == 0;
+		int level = rand()%256;
+		for(int y = by; y < std::min(by + block, height); y++)
+			for(int x = bx; x < std::min(bx + block, width); x++)
+				grey.ptr<uchar>(y)[x] = flat ? level : rand()%256;
+	}
+}
+
+static bool SamePoints(const std::vector<Point2f>& a, const std::vector<Point2f>& b)
+{
+	if(a.size() != b.size())
+		return false;
+	for(size_t i = 0; i < a.size(); i++)
+		if(a[i].x != b[i].x || a[i].y != b[i].y)
+			return false;
+	return true;
+}
+
+// returns the number of samplers which differ from the reference
+static int Check(int width, int height, int min_distance, int num_points)
+{
+	Mat grey;
+	RandomImage(grey, width, height);
+
+	std::vector<Point2f> points;
+	for(int i = 0; i < num_points; i++)
+		points.push_back(Point2f(width*(rand()/(RAND_MAX + 1.f)), height*(rand()/(RAND_MAX + 1.f))));
+
+	SampleGrid grid;
+	grid.init(width, height, min_distance);
+	for(size_t i = 0; i < points.size(); i++)
+		grid.add(points[i].x, points[i].y);
+
+	std::vector<Point2f> expected(points), dense, sparse;
+	DenseSample(grey, expected, quality, min_distance);
+	DenseSample(grey, grid, dense, quality);
+	SparseSample(grey, grid, sparse, quality, 1);
+
+	int failed = 0;
+	if(!SamePoints(expected, dense)) {
+		fprintf(stderr, "%dx%d, cells of %d: DenseSample on the grid gives %d points instead of %d\n",
+			width, height, min_distance, (int)dense.size(), (int)expected.size());
+		failed++;
+	}
+	if(!SamePoints(expected, sparse)) {
+		fprintf(stderr, "%dx%d, cells of %d: SparseSample gives %d points instead of %d\n",
+			width, height, min_distance, (int)sparse.size(), (int)expected.size());
+		failed++;
+	}
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	static const int sizes[][2] = { {320, 240}, {83, 60}, {17, 9}, {7, 5}, {4, 4} };
+
+	int failed = 0, runs = 0;
+	srand(0);
+	for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		int cells = (sizes[i][0]/min_distance)*(sizes[i][1]/min_distance);
+		for(int fill = 0; fill <= 2; fill++, runs++)
+			failed += Check(sizes[i][0], sizes[i][1], min_distance, cells*fill/2);
+		failed += Check(sizes[i][0], sizes[i][1], 8, 0);
+		runs++;
+	}
+
+	printf("Sampling: %d images, %d failed\n", runs, failed);
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+// work on the range [begin, end), called concurrently on disjoint ranges
+class ParallelBody
+{
+public:
+    virtual ~ParallelBody() {}
+    virtual void operator()(int begin, int end) const = 0;
+};
+
+// a fixed set of worker threads shared by the whole program, several threads
+// may submit work at the same time (e.g. the stages of FramePipeline)
+class ThreadPool
+{
+public:
+    ThreadPool(int num_threads) : first_job(0), num_jobs(0), quit(false)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&work_cond, NULL);
+        pthread_cond_init(&done_cond, NULL);
+
+        // the submitting thread works as well, so one worker less
+        workers.resize(std::max(num_threads, 1) - 1);
+        jobs.resize(size());
+        for(size_t i = 0; i < workers.size(); i++)
+            pthread_create(&workers[i], NULL, Worker, this);
+    }
+
+    ~ThreadPool()
+    {
+        pthread_mutex_lock(&mutex);
+        quit = true;
+        pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&mutex);
+
+        for(size_t i = 0; i < workers.size(); i++)
+            pthread_join(workers[i], NULL);
+
+        pthread_cond_destroy(&done_cond);
+        pthread_cond_destroy(&work_cond);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    int size() const
+    {
+        return workers.size() + 1;
+    }
+
+    // split [begin, end) into nstripes ranges and return when all of them are done,
+    // must not be called from inside a body
+    void run(const ParallelBody& body, int begin, int end, int nstripes)
+    {
+        int total = end - begin;
+        nstripes = std::min(nstripes, total);
+        if(nstripes <= 1 || workers.empty()) {
+            if(total > 0)
+                body(begin, end);
+            return;
+        }
+
+        // the rounded up stripes may cover the range in fewer than nstripes
+        int stripe = (total + nstripes - 1)/nstripes;
+        nstripes = (total + stripe - 1)/stripe;
+        Job job = { &body, end, stripe, begin + stripe, nstripes - 1 };
+
+        // the ring holds one job per submitter, if it is full the caller does
+        // the whole range itself instead of growing it
+        pthread_mutex_lock(&mutex);
+        if(num_jobs == (int)jobs.size()) {
+            pthread_mutex_unlock(&mutex);
+            body(begin, end);
+            return;
+        }
+        jobs[(first_job + num_jobs) % jobs.size()] = &job;
+        num_jobs++;
+        pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&mutex);
+
+        body(begin, std::min(begin + stripe, end));
+
+        pthread_mutex_lock(&mutex);
+        while(job.pending > 0)
+            pthread_cond_wait(&done_cond, &mutex);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    void run(const ParallelBody& body, int begin, int end)
+    {
+        run(body, begin, end, size());
+    }
+
+private:
+    // the stripes of one run(), on the stack of the submitting thread
+    typedef struct {
+        const ParallelBody* body;
+        int end;
+        int stripe;
+        int next;    // begin of the next stripe to hand out
+        int pending; // stripes left to the workers and not done yet
+    }Job;
+
+    std::vector<pthread_t> workers;
+    std::vector<Job*> jobs; // fixed ring of the jobs with stripes left
+    int first_job;
+    int num_jobs;
+    bool quit;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    static void* Worker(void* arg)
+    {
+        ThreadPool* pool = (ThreadPool*)arg;
+
+        pthread_mutex_lock(&pool->mutex);
+        while(true) {
+            while(pool->num_jobs == 0 && !pool->quit)
+                pthread_cond_wait(&pool->work_cond, &pool->mutex);
+            if(pool->num_jobs == 0)
+                break;
+
+            // the job leaves the ring with its last stripe, it stays valid until
+            // pending drops to zero
+            Job* job = pool->jobs[pool->first_job];
+            int begin = job->next;
+            job->next += job->stripe;
+            if(job->next >= job->end) {
+                pool->first_job = (pool->first_job + 1) % pool->jobs.size();
+                pool->num_jobs--;
+            }
+            pthread_mutex_unlock(&pool->mutex);
+
+            (*job->body)(begin, std::min(begin + job->stripe, job->end));
+
+            pthread_mutex_lock(&pool->mutex);
+            if(--job->pending == 0)
+                pthread_cond_broadcast(&pool->done_cond);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        return NULL;
+    }
+};
+
+ThreadPool* thread_pool = NULL;
+
+// number of threads for a thread-count option, 0 means one per core
+int GetNumThreads(int num_threads)
+{
+    if(num_threads > 0)
+        return num_threads;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? int(cores) : 1;
+}
+
+void InitThreadPool(int num_threads)
+{
+    delete thread_pool;
+    thread_pool = new ThreadPool(GetNumThreads(num_threads));
+}
+
+void ReleaseThreadPool()
+{
+    delete thread_pool;
+    thread_pool = NULL;
+}
+
+// run body over [begin, end) on the shared pool, or inline if there is none
+void ParallelFor(int begin, int end, const ParallelBody& body)
+{
+    if(thread_pool)
+        thread_pool->run(body, begin, end);
+    else if(end > begin)
+        body(begin, end);
+}
+
+#endif /*THREADPOOL_H_*/
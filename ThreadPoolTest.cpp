@@ -0,0 +1,72 @@
+#include "ThreadPool.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// ParallelFor on pools of 1 to 16 threads over ranges of 0 to 64 items, with the
+// default and with explicit stripe counts: every item must be visited exactly
+// once and run() must return. A hang is caught by the alarm.
+//
+// usage: ThreadPoolTest
+
+// counts the visits of every item of the range
+class CountBody : public ParallelBody
+{
+public:
+	CountBody(std::vector<int>& hits_, int begin_) : hits(hits_), begin(begin_) {}
+
+	void operator()(int b, int e) const
+	{
+		for(int i = b; i < e; i++)
+			__sync_fetch_and_add(&hits[i - begin], 1);
+	}
+
+private:
+	std::vector<int>& hits;
+	int begin;
+};
+
+static void Timeout(int)
+{
+	fprintf(stderr, "ThreadPool::run did not return\n");
+	_exit(1);
+}
+
+// returns the number of failed runs
+static int Check(ThreadPool& pool, int threads, int begin, int total, int nstripes)
+{
+	std::vector<int> hits(total, 0);
+	CountBody body(hits, begin);
+	if(nstripes > 0)
+		pool.run(body, begin, begin + total, nstripes);
+	else
+		pool.run(body, begin, begin + total);
+
+	for(int i = 0; i < total; i++) {
+		if(hits[i] != 1) {
+			fprintf(stderr, "%d threads, %d items from %d, %d stripes: item %d visited %d times\n",
+				threads, total, begin, nstripes, i, hits[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	signal(SIGALRM, Timeout);
+	alarm(30);
+
+	int failed = 0, runs = 0;
+	for(int threads = 1; threads <= 16; threads++) {
+		ThreadPool pool(threads);
+		for(int total = 0; total <= 64; total++) {
+			for(int nstripes = 0; nstripes <= total + 2; nstripes++, runs++)
+				failed += Check(pool, threads, 3, total, nstripes);
+		}
+	}
+
+	printf("ThreadPool: %d runs, %d failed\n", runs, failed);
+	return failed == 0 ? 0 : 1;
+}
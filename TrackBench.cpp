@@ -0,0 +1,172 @@
+#include "DenseTrack.h"
+#include "Advection.h"
+
+// Microbenchmark of the tracking loop: the old std::list<Track> store against
+// TrackStore. Both follow the same points through a synthetic flow field, drop
+// the ones leaving the frame or reaching the track length, and re-seed the same
+// number of points every frame, so only the memory layout differs. The store is
+// also run with the batched AdvectPoints used by the tracker.
+//
+// usage: TrackBench [width] [height] [frames]
+
+using namespace cv;
+
+// the list layout main used before TrackStore
+class ListTrack
+{
+public:
+	std::vector<Point2f> point;
+	int index;
+
+	ListTrack(const Point2f& point_) : index(0)
+	{
+		point.push_back(point_);
+	}
+
+	void addPoint(const Point2f& point_)
+	{
+		index++;
+		point.push_back(point_);
+	}
+};
+
+// point i of a dense grid with stride min_distance
+static Point2f SeedPoint(int i, int width, int height)
+{
+	int cols = width/min_distance, rows = height/min_distance;
+	i %= cols*rows;
+	return Point2f(float((i % cols)*min_distance + min_distance/2), float((i / cols)*min_distance + min_distance/2));
+}
+
+static inline bool Advect(const Mat& flow, const Point2f& prev_point, Point2f& point)
+{
+	int width = flow.cols, height = flow.rows;
+	int x = std::min<int>(std::max<int>(cvRound(prev_point.x), 0), width-1);
+	int y = std::min<int>(std::max<int>(cvRound(prev_point.y), 0), height-1);
+
+	point.x = prev_point.x + flow.ptr<float>(y)[2*x];
+	point.y = prev_point.y + flow.ptr<float>(y)[2*x+1];
+
+	return point.x > 0 && point.x < width && point.y > 0 && point.y < height;
+}
+
+// run the list version, returns the sum of all finished track ends
+static double RunList(const Mat& flow, int frames, int seeds, double& seconds)
+{
+	std::list<ListTrack> tracks;
+	double checksum = 0;
+	int next_seed = 0;
+
+	for(int i = 0; i < seeds; i++)
+		tracks.push_back(ListTrack(SeedPoint(next_seed++, flow.cols, flow.rows)));
+
+	int64 start = getTickCount();
+	for(int frame = 0; frame < frames; frame++) {
+		int dropped = 0;
+		for(std::list<ListTrack>::iterator iTrack = tracks.begin(); iTrack != tracks.end(); ) {
+			Point2f point;
+			if(!Advect(flow, iTrack->point[iTrack->index], point)) {
+				iTrack = tracks.erase(iTrack);
+				dropped++;
+				continue;
+			}
+
+			iTrack->addPoint(point);
+			if(iTrack->index >= track_length) {
+				checksum += point.x + point.y;
+				iTrack = tracks.erase(iTrack);
+				dropped++;
+				continue;
+			}
+			++iTrack;
+		}
+
+		for(int i = 0; i < dropped; i++)
+			tracks.push_back(ListTrack(SeedPoint(next_seed++, flow.cols, flow.rows)));
+	}
+	seconds = (getTickCount() - start)/getTickFrequency();
+
+	return checksum;
+}
+
+static double RunStore(const Mat& flow, int frames, int seeds, bool batched, double& seconds)
+{
+	TrackStore tracks(track_length);
+	double checksum = 0;
+	int next_seed = 0;
+
+	for(int i = 0; i < seeds; i++)
+		tracks.add(SeedPoint(next_seed++, flow.cols, flow.rows));
+
+	int64 start = getTickCount();
+	for(int frame = 0; frame < frames; frame++) {
+		int size = tracks.size();
+		if(batched) {
+			tracks.next_x.resize(size);
+			tracks.next_y.resize(size);
+			tracks.inside.resize(size);
+			AdvectPoints(flow, &tracks.x[0], &tracks.y[0], &tracks.next_x[0], &tracks.next_y[0], &tracks.inside[0], size, false);
+		}
+
+		for(int iTrack = 0; iTrack < size; iTrack++) {
+			Point2f point;
+			if(batched) {
+				point = Point2f(tracks.next_x[iTrack], tracks.next_y[iTrack]);
+				if(!tracks.inside[iTrack]) {
+					tracks.active[iTrack] = 0;
+					continue;
+				}
+			}
+			else if(!Advect(flow, Point2f(tracks.x[iTrack], tracks.y[iTrack]), point)) {
+				tracks.active[iTrack] = 0;
+				continue;
+			}
+
+			tracks.addPoint(iTrack, point);
+			if(tracks.index[iTrack] >= track_length) {
+				checksum += point.x + point.y;
+				tracks.active[iTrack] = 0;
+			}
+		}
+		tracks.Compact();
+
+		for(int i = tracks.size(); i < size; i++)
+			tracks.add(SeedPoint(next_seed++, flow.cols, flow.rows));
+	}
+	seconds = (getTickCount() - start)/getTickFrequency();
+
+	return checksum;
+}
+
+int main(int argc, char** argv)
+{
+	int width = argc > 1 ? atoi(argv[1]) : 1280;
+	int height = argc > 2 ? atoi(argv[2]) : 720;
+	int frames = argc > 3 ? atoi(argv[3]) : 100;
+
+	// smooth motion with some noise, so tracks leave the frame now and then
+	Mat flow(height, width, CV_32FC2);
+	srand(0);
+	for(int y = 0; y < height; y++) {
+		float* f = flow.ptr<float>(y);
+		for(int x = 0; x < width; x++) {
+			f[2*x] = 1.5f*sin(y*0.01f) + (rand()%100)*0.01f - 0.5f;
+			f[2*x+1] = 1.5f*cos(x*0.01f) + (rand()%100)*0.01f - 0.5f;
+		}
+	}
+
+	int seeds = (width/min_distance)*(height/min_distance);
+	double list_seconds, store_seconds, batch_seconds;
+	double list_sum = RunList(flow, frames, seeds, list_seconds);
+	double store_sum = RunStore(flow, frames, seeds, false, store_seconds);
+	double batch_sum = RunStore(flow, frames, seeds, true, batch_seconds);
+
+	printf("%d tracks, %dx%d, %d frames\n", seeds, width, height, frames);
+	printf("std::list<Track>: %f ms per frame\n", list_seconds*1000/frames);
+	printf("TrackStore:       %f ms per frame\n", store_seconds*1000/frames);
+	printf("AdvectPoints:     %f ms per frame\n", batch_seconds*1000/frames);
+	if(list_sum != store_sum || list_sum != batch_sum)
+		printf("checksums differ: %f %f %f\n", list_sum, store_sum, batch_sum);
+
+	return 0;
+}
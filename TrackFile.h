@@ -0,0 +1,176 @@
+#ifndef TRACKFILE_H_
+#define TRACKFILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// Columnar trajectory file, written by DenseTrack -O 2. Every field of the
+// trajectories is one contiguous little-endian array, so the file can be mapped
+// and used in place, from C++ with TrackFileReader or from numpy with
+// python/trackfile.py:
+//
+//   header                        TrackFileHeader, 128 bytes
+//   points     float32[count][length+1][2]  the track points (x, y)
+//   frame_num  int32[count]                 frame where the trajectory ended
+//   mean       float32[count][2]            mean of the points (x, y)
+//   var        float32[count][2]            standard deviation of the points (x, y)
+//   shape      float32[count][length][2]    displacements normalized by IsValid
+//   index      TrackFileFrame[num_frames]   records per end frame
+//
+// Each array starts at the offset given in the header, aligned to 64 bytes. The
+// records are in the order they were written, which is by end frame, and the
+// index (the footer) gives the first record and the number of records of every
+// end frame in increasing frame order.
+
+typedef struct {
+    char magic[8];             // "DTCOLS\0\0"
+    uint32_t version;          // 1
+    uint32_t length;           // track length, the shape has length points and a track length+1
+    uint64_t count;            // number of trajectories
+    uint64_t num_frames;       // entries of the index
+    uint64_t frame_num_offset; // byte offsets of the arrays
+    uint64_t mean_offset;
+    uint64_t var_offset;
+    uint64_t shape_offset;
+    uint64_t points_offset;
+    uint64_t index_offset;
+    uint64_t reserved[6];
+}TrackFileHeader;
+
+typedef struct {
+    int32_t frame;
+    uint32_t count;            // records of this frame
+    uint64_t first;            // index of the first one
+}TrackFileFrame;
+
+static const char track_file_magic[8] = { 'D', 'T', 'C', 'O', 'L', 'S', 0, 0 };
+static const size_t track_file_align = 64;
+
+// the arrays are used in place, so the host must have the byte order of the file
+static inline bool TrackFileByteOrderOk()
+{
+    const uint32_t one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+// read-only view of a mapped columnar trajectory file
+class TrackFileReader
+{
+public:
+    TrackFileReader() : data(NULL), data_size(0), header(NULL) {}
+
+    ~TrackFileReader()
+    {
+        close();
+    }
+
+    // map the file and check its header and bounds, false if it is not a valid file
+    bool open(const char* path)
+    {
+        close();
+        if(!TrackFileByteOrderOk())
+            return false;
+
+        int fd = ::open(path, O_RDONLY);
+        if(fd < 0)
+            return false;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TrackFileHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(map == MAP_FAILED)
+            return false;
+
+        data = (const unsigned char*)map;
+        data_size = st.st_size;
+        header = (const TrackFileHeader*)data;
+
+        if(!valid()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if(data)
+            munmap((void*)data, data_size);
+        data = NULL;
+        data_size = 0;
+        header = NULL;
+    }
+
+    int length() const { return header->length; }
+    size_t size() const { return header->count; }
+    size_t frames() const { return header->num_frames; }
+
+    // the columns, indexed by record
+    const int32_t* frame_nums() const { return (const int32_t*)(data + header->frame_num_offset); }
+    const float* means() const { return (const float*)(data + header->mean_offset); }
+    const float* vars() const { return (const float*)(data + header->var_offset); }
+    const float* shapes() const { return (const float*)(data + header->shape_offset); }
+    const float* points() const { return (const float*)(data + header->points_offset); }
+    const TrackFileFrame* index() const { return (const TrackFileFrame*)(data + header->index_offset); }
+
+    // the length (x, y) pairs of the shape and the length+1 points of record i
+    const float* shape(size_t i) const { return shapes() + i*header->length*2; }
+    const float* point(size_t i) const { return points() + i*(header->length+1)*2; }
+
+    // the records ending at frame, false if there are none
+    bool find(int frame, size_t& first, size_t& count) const
+    {
+        const TrackFileFrame* begin = index();
+        const TrackFileFrame* end = begin + header->num_frames;
+        const TrackFileFrame* it = std::lower_bound(begin, end, frame, FrameLess());
+        if(it == end || it->frame != frame)
+            return false;
+        first = it->first;
+        count = it->count;
+        return true;
+    }
+
+private:
+    const unsigned char* data;
+    size_t data_size;
+    const TrackFileHeader* header;
+
+    struct FrameLess
+    {
+        bool operator()(const TrackFileFrame& entry, int frame) const { return entry.frame < frame; }
+    };
+
+    bool fits(uint64_t offset, uint64_t elems, uint64_t elem_size) const
+    {
+        if(offset % track_file_align != 0 || offset > data_size)
+            return false;
+        return elem_size == 0 || elems <= (data_size - offset)/elem_size;
+    }
+
+    bool valid() const
+    {
+        if(memcmp(header->magic, track_file_magic, sizeof(track_file_magic)) != 0 || header->version != 1)
+            return false;
+
+        uint64_t n = header->count, len = header->length;
+        return fits(header->frame_num_offset, n, 4) &&
+               fits(header->mean_offset, n, 8) &&
+               fits(header->var_offset, n, 8) &&
+               fits(header->shape_offset, n, len*8) &&
+               fits(header->points_offset, n, (len+1)*8) &&
+               fits(header->index_offset, header->num_frames, sizeof(TrackFileFrame));
+    }
+};
+
+#endif /*TRACKFILE_H_*/
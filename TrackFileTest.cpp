@@ -0,0 +1,241 @@
+#include "DenseTrack.h"
+#include "Trajectories.h"
+
+// ColumnarTrackSink to TrackFileReader: trajectories of length 1, 2 and 15 are
+// written over frames with gaps, frames without records and enough records for
+// the spill files to be copied in several chunks; the file must come back with
+// every column, the index and find() as they were written. No trajectory at all
+// gives a valid empty file. Copies cut short anywhere, or with another magic or
+// version, must be refused by open().
+//
+// With a file name the fixed file checked by python/trackfile_test.py is
+// written there as well.
+//
+// usage: TrackFileTest [file]
+
+using namespace cv;
+
+// the values of record r, exact in float so the reader can compare them with ==
+static Point2f PointValue(int r, int j) { return Point2f(r + 0.5f*j, r - 0.5f*j); }
+static Point2f ShapeValue(int r, int j) { return Point2f(0.25f*j - r, 0.25f*j + r); }
+static Point2f MeanValue(int r) { return Point2f(r + 0.125f, r + 0.375f); }
+static Point2f VarValue(int r) { return Point2f(0.5f*r, 0.25f*r); }
+
+// a temporary file name, removed by the caller
+static std::string TempFile()
+{
+	char name[] = "/tmp/TrackFileTestXXXXXX";
+	int fd = mkstemp(name);
+	if(fd < 0)
+		return std::string();
+	close(fd);
+	return name;
+}
+
+// writes num_frames frames of records through the sink, frame f ending at
+// frame_nums[f] with counts[f] records, returns false if the file was not created
+static bool WriteFile(const char* file, int length, const std::vector<int>& frame_nums, const std::vector<int>& counts)
+{
+	ColumnarTrackSink sink(length);
+	if(!sink.open(file))
+		return false;
+
+	std::vector<Point2f> point(length+1), trajectory(length);
+	int r = 0;
+	for(size_t f = 0; f < frame_nums.size(); f++)
+		for(int c = 0; c < counts[f]; c++, r++) {
+			for(int j = 0; j <= length; j++)
+				point[j] = PointValue(r, j);
+			for(int j = 0; j < length; j++)
+				trajectory[j] = ShapeValue(r, j);
+			Point2f mean = MeanValue(r), var = VarValue(r);
+			sink.write(&point[0], trajectory, mean.x, mean.y, var.x, var.y, frame_nums[f]);
+		}
+	return true;
+}
+
+static bool SamePoint(const float* p, const Point2f& q)
+{
+	return p[0] == q.x && p[1] == q.y;
+}
+
+// returns the number of fields of the file which differ from what was written
+static int Compare(const char* file, int length, const std::vector<int>& frame_nums, const std::vector<int>& counts)
+{
+	TrackFileReader reader;
+	if(!reader.open(file)) {
+		fprintf(stderr, "length %d: the file could not be read back\n", length);
+		return 1;
+	}
+
+	int failed = 0;
+	size_t total = 0, num_frames = 0;
+	for(size_t f = 0; f < counts.size(); f++) {
+		total += counts[f];
+		num_frames += counts[f] > 0;
+	}
+	if(reader.length() != length || reader.size() != total || reader.frames() != num_frames) {
+		fprintf(stderr, "length %d: header says length %d, %d records, %d frames instead of %d, %d\n",
+			length, reader.length(), (int)reader.size(), (int)reader.frames(), (int)total, (int)num_frames);
+		return 1;
+	}
+
+	size_t r = 0, i = 0;
+	for(size_t f = 0; f < frame_nums.size(); f++) {
+		// the index skips the frames without records
+		size_t first = 0, count = 0;
+		bool found = reader.find(frame_nums[f], first, count);
+		if(found != (counts[f] > 0) || (found && (first != r || count != (size_t)counts[f]))) {
+			fprintf(stderr, "length %d: frame %d found at %d+%d instead of %d+%d\n",
+				length, frame_nums[f], (int)first, (int)count, (int)r, counts[f]);
+			failed++;
+		}
+		if(counts[f] > 0) {
+			const TrackFileFrame& entry = reader.index()[i++];
+			if(entry.frame != frame_nums[f] || entry.first != r || entry.count != (uint32_t)counts[f])
+				failed++;
+		}
+
+		for(int c = 0; c < counts[f]; c++, r++) {
+			bool same = reader.frame_nums()[r] == frame_nums[f] &&
+				SamePoint(reader.means() + 2*r, MeanValue(r)) && SamePoint(reader.vars() + 2*r, VarValue(r));
+			for(int j = 0; j <= length; j++)
+				same = same && SamePoint(reader.point(r) + 2*j, PointValue(r, j));
+			for(int j = 0; j < length; j++)
+				same = same && SamePoint(reader.shape(r) + 2*j, ShapeValue(r, j));
+			if(!same) {
+				fprintf(stderr, "length %d: record %d of frame %d differs\n", length, (int)r, frame_nums[f]);
+				failed++;
+			}
+		}
+	}
+
+	// between and around the frames which were written
+	size_t first, count;
+	if(reader.find(INT_MIN, first, count) || reader.find(INT_MAX, first, count))
+		failed++;
+	for(size_t f = 1; f < frame_nums.size(); f++)
+		if(frame_nums[f] > frame_nums[f-1] + 1 && reader.find(frame_nums[f] - 1, first, count))
+			failed++;
+	return failed;
+}
+
+static bool ReadAll(const char* file, std::vector<char>& data)
+{
+	FILE* in = fopen(file, "rb");
+	if(!in)
+		return false;
+	char buffer[1 << 16];
+	size_t n;
+	while((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+	fclose(in);
+	return true;
+}
+
+static bool WriteAll(const char* file, const char* data, size_t size)
+{
+	FILE* out = fopen(file, "wb");
+	if(!out)
+		return false;
+	bool ok = size == 0 || fwrite(data, 1, size, out) == size;
+	return fclose(out) == 0 && ok;
+}
+
+// returns the number of damaged copies of the file which open() accepts
+static int CheckDamaged(const char* file)
+{
+	std::vector<char> data;
+	std::string copy = TempFile();
+	if(!ReadAll(file, data) || copy.empty())
+		return 1;
+
+	int failed = 0;
+	TrackFileReader reader;
+	size_t sizes[] = { 0, 64, sizeof(TrackFileHeader) - 1, sizeof(TrackFileHeader),
+		data.size()/2, data.size() - sizeof(TrackFileFrame), data.size() - 1 };
+	for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+		if(!WriteAll(copy.c_str(), &data[0], sizes[s]) || reader.open(copy.c_str())) {
+			fprintf(stderr, "a copy cut to %d of %d bytes was accepted\n", (int)sizes[s], (int)data.size());
+			failed++;
+		}
+
+	std::vector<char> damaged = data;
+	damaged[0] = 'X';
+	if(!WriteAll(copy.c_str(), &damaged[0], damaged.size()) || reader.open(copy.c_str()))
+		failed++;
+	damaged = data;
+	damaged[offsetof(TrackFileHeader, version)] = 2;
+	if(!WriteAll(copy.c_str(), &damaged[0], damaged.size()) || reader.open(copy.c_str()))
+		failed++;
+
+	// the reader is still usable after the refused files
+	if(!WriteAll(copy.c_str(), &data[0], data.size()) || !reader.open(copy.c_str()))
+		failed++;
+
+	unlink(copy.c_str());
+	return failed;
+}
+
+// random frames with gaps and frames without records, returns the failures
+static int Check(int length, int num_frames, int max_count)
+{
+	std::vector<int> frame_nums(num_frames), counts(num_frames);
+	int frame = rand()%10;
+	for(int f = 0; f < num_frames; f++) {
+		frame += 1 + (rand()%4 == 0 ? rand()%5 : 0);
+		frame_nums[f] = frame;
+		counts[f] = rand()%3 == 0 ? 0 : rand()%(max_count + 1);
+	}
+
+	std::string file = TempFile();
+	if(file.empty() || !WriteFile(file.c_str(), length, frame_nums, counts)) {
+		fprintf(stderr, "could not write a temporary file\n");
+		return 1;
+	}
+
+	int failed = Compare(file.c_str(), length, frame_nums, counts);
+	int total = 0;
+	for(int f = 0; f < num_frames; f++)
+		total += counts[f];
+	if(total > 0)
+		failed += CheckDamaged(file.c_str());
+
+	unlink(file.c_str());
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	int failed = 0, files = 0;
+	srand(0);
+
+	// the empty file
+	failed += Check(15, 0, 0);
+	files++;
+
+	static const int lengths[] = { 1, 2, 15 };
+	for(size_t l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++) {
+		failed += Check(lengths[l], 1, 1);
+		failed += Check(lengths[l], 30, 6);
+		// the shape column spans several chunks of the copy
+		failed += Check(lengths[l], 200, 60);
+		files += 3;
+	}
+
+	// frame f of 0 ... 100 ends f%4 records, so the frames 0, 4, ... 100 none
+	if(argc > 1) {
+		std::vector<int> frame_nums, counts;
+		for(int f = 0; f < 101; f++) {
+			frame_nums.push_back(f);
+			counts.push_back(f%4);
+		}
+		if(!WriteFile(argv[1], 15, frame_nums, counts)) {
+			fprintf(stderr, "Could not create %s\n", argv[1]);
+			failed++;
+		}
+	}
+
+	printf("TrackFile: %d files, %d failed\n", files, failed);
+	return failed == 0 ? 0 : 1;
+}
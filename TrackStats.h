@@ -0,0 +1,292 @@
+#ifndef TRACKSTATS_H_
+#define TRACKSTATS_H_
+
+#include "DenseTrack.h"
+#include "FarnebackSIMD.h"
+
+#include <immintrin.h>
+
+using namespace cv;
+
+// IsValid for a batch of trajectories with the same number of points. The points
+// are kept in structure-of-arrays layout, point i of trajectory t at x[i*count+t],
+// so that 8 or 16 trajectories go side by side through one pass for the mean, the
+// standard deviation, the length and the largest step. Each lane adds its points
+// in the order of IsValid, so the statistics, the tests and the normalized steps
+// match it bit for bit.
+class TrackBatch
+{
+public:
+    int count;                  // trajectories
+    int points;                 // points of each trajectory
+    std::vector<float> x;       // point i of trajectory t at i*count+t
+    std::vector<float> y;
+    std::vector<float> mean_x;  // per trajectory
+    std::vector<float> mean_y;
+    std::vector<float> var_x;   // standard deviations, as IsValid returns them
+    std::vector<float> var_y;
+    std::vector<float> length;  // sum of the steps, also for the trajectories IsValid stops at before
+    std::vector<float> max_step;
+    std::vector<uchar> valid;   // set by ValidateTracks
+    std::vector<float> shape_x; // step i of trajectory t at i*count+t, normalized by the length if valid
+    std::vector<float> shape_y;
+
+    TrackBatch() : count(0), points(0) {}
+
+    void resize(int count_, int points_)
+    {
+        count = count_;
+        points = points_;
+        x.resize((size_t)count*points);
+        y.resize((size_t)count*points);
+        mean_x.resize(count);
+        mean_y.resize(count);
+        var_x.resize(count);
+        var_y.resize(count);
+        length.resize(count);
+        max_step.resize(count);
+        valid.resize(count);
+        shape_x.resize((size_t)count*(points-1));
+        shape_y.resize((size_t)count*(points-1));
+    }
+
+    void set(int t, int i, const Point2f& point)
+    {
+        x[(size_t)i*count + t] = point.x;
+        y[(size_t)i*count + t] = point.y;
+    }
+
+    // the steps of trajectory t, as IsValid leaves the trajectory
+    void shape(int t, std::vector<Point2f>& track) const
+    {
+        track.resize(points-1);
+        for(int i = 0; i < points-1; i++)
+            track[i] = Point2f(shape_x[(size_t)i*count + t], shape_y[(size_t)i*count + t]);
+    }
+};
+
+// scalar reference for the trajectories [begin, end), also the tail of the vector kernels
+static void
+TrackStatsRange( TrackBatch& batch, int begin, int end )
+{
+    int n = batch.count;
+    float norm = 1./batch.points;
+    const float* x = &batch.x[0];
+    const float* y = &batch.y[0];
+
+    for( int t = begin; t < end; t++ )
+    {
+        float mean_x = 0, mean_y = 0;
+        for( int i = 0; i < batch.points; i++ )
+        {
+            mean_x += x[i*n + t];
+            mean_y += y[i*n + t];
+        }
+        mean_x *= norm;
+        mean_y *= norm;
+
+        float var_x = 0, var_y = 0;
+        for( int i = 0; i < batch.points; i++ )
+        {
+            float temp_x = x[i*n + t] - mean_x;
+            float temp_y = y[i*n + t] - mean_y;
+            var_x += temp_x*temp_x;
+            var_y += temp_y*temp_y;
+        }
+        var_x *= norm;
+        var_y *= norm;
+
+        float length = 0, cur_max = 0;
+        for( int i = 0; i < batch.points-1; i++ )
+        {
+            float dx = x[(i+1)*n + t] - x[i*n + t];
+            float dy = y[(i+1)*n + t] - y[i*n + t];
+            float temp = sqrt(dx*dx + dy*dy);
+            length += temp;
+            if( temp > cur_max )
+                cur_max = temp;
+            batch.shape_x[i*n + t] = dx;
+            batch.shape_y[i*n + t] = dy;
+        }
+
+        batch.mean_x[t] = mean_x;
+        batch.mean_y[t] = mean_y;
+        batch.var_x[t] = sqrt(var_x);
+        batch.var_y[t] = sqrt(var_y);
+        batch.length[t] = length;
+        batch.max_step[t] = cur_max;
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+TrackStats_AVX2( TrackBatch& batch )
+{
+    int n = batch.count;
+    const __m256 norm = _mm256_set1_ps((float)(1./batch.points));
+    const float* x = &batch.x[0];
+    const float* y = &batch.y[0];
+
+    int t = 0;
+    for( ; t <= n - 8; t += 8 )
+    {
+        __m256 mean_x = _mm256_setzero_ps(), mean_y = _mm256_setzero_ps();
+        for( int i = 0; i < batch.points; i++ )
+        {
+            mean_x = _mm256_add_ps(mean_x, _mm256_loadu_ps(x + i*n + t));
+            mean_y = _mm256_add_ps(mean_y, _mm256_loadu_ps(y + i*n + t));
+        }
+        mean_x = _mm256_mul_ps(mean_x, norm);
+        mean_y = _mm256_mul_ps(mean_y, norm);
+
+        __m256 var_x = _mm256_setzero_ps(), var_y = _mm256_setzero_ps();
+        for( int i = 0; i < batch.points; i++ )
+        {
+            __m256 temp_x = _mm256_sub_ps(_mm256_loadu_ps(x + i*n + t), mean_x);
+            __m256 temp_y = _mm256_sub_ps(_mm256_loadu_ps(y + i*n + t), mean_y);
+            var_x = _mm256_add_ps(var_x, _mm256_mul_ps(temp_x, temp_x));
+            var_y = _mm256_add_ps(var_y, _mm256_mul_ps(temp_y, temp_y));
+        }
+        var_x = _mm256_sqrt_ps(_mm256_mul_ps(var_x, norm));
+        var_y = _mm256_sqrt_ps(_mm256_mul_ps(var_y, norm));
+
+        __m256 length = _mm256_setzero_ps(), cur_max = _mm256_setzero_ps();
+        __m256 px = _mm256_loadu_ps(x + t), py = _mm256_loadu_ps(y + t);
+        for( int i = 0; i < batch.points-1; i++ )
+        {
+            __m256 qx = _mm256_loadu_ps(x + (i+1)*n + t), qy = _mm256_loadu_ps(y + (i+1)*n + t);
+            __m256 dx = _mm256_sub_ps(qx, px), dy = _mm256_sub_ps(qy, py);
+            __m256 temp = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+            length = _mm256_add_ps(length, temp);
+            cur_max = _mm256_max_ps(temp, cur_max);
+            _mm256_storeu_ps(&batch.shape_x[i*n + t], dx);
+            _mm256_storeu_ps(&batch.shape_y[i*n + t], dy);
+            px = qx;
+            py = qy;
+        }
+
+        _mm256_storeu_ps(&batch.mean_x[t], mean_x);
+        _mm256_storeu_ps(&batch.mean_y[t], mean_y);
+        _mm256_storeu_ps(&batch.var_x[t], var_x);
+        _mm256_storeu_ps(&batch.var_y[t], var_y);
+        _mm256_storeu_ps(&batch.length[t], length);
+        _mm256_storeu_ps(&batch.max_step[t], cur_max);
+    }
+
+    TrackStatsRange( batch, t, n );
+}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void
+TrackStats_AVX512( TrackBatch& batch )
+{
+    int n = batch.count;
+    const __m512 norm = _mm512_set1_ps((float)(1./batch.points));
+    const float* x = &batch.x[0];
+    const float* y = &batch.y[0];
+
+    int t = 0;
+    for( ; t <= n - 16; t += 16 )
+    {
+        __m512 mean_x = _mm512_setzero_ps(), mean_y = _mm512_setzero_ps();
+        for( int i = 0; i < batch.points; i++ )
+        {
+            mean_x = _mm512_add_ps(mean_x, _mm512_loadu_ps(x + i*n + t));
+            mean_y = _mm512_add_ps(mean_y, _mm512_loadu_ps(y + i*n + t));
+        }
+        mean_x = _mm512_mul_ps(mean_x, norm);
+        mean_y = _mm512_mul_ps(mean_y, norm);
+
+        __m512 var_x = _mm512_setzero_ps(), var_y = _mm512_setzero_ps();
+        for( int i = 0; i < batch.points; i++ )
+        {
+            __m512 temp_x = _mm512_sub_ps(_mm512_loadu_ps(x + i*n + t), mean_x);
+            __m512 temp_y = _mm512_sub_ps(_mm512_loadu_ps(y + i*n + t), mean_y);
+            var_x = _mm512_add_ps(var_x, _mm512_mul_ps(temp_x, temp_x));
+            var_y = _mm512_add_ps(var_y, _mm512_mul_ps(temp_y, temp_y));
+        }
+        var_x = _mm512_sqrt_ps(_mm512_mul_ps(var_x, norm));
+        var_y = _mm512_sqrt_ps(_mm512_mul_ps(var_y, norm));
+
+        __m512 length = _mm512_setzero_ps(), cur_max = _mm512_setzero_ps();
+        __m512 px = _mm512_loadu_ps(x + t), py = _mm512_loadu_ps(y + t);
+        for( int i = 0; i < batch.points-1; i++ )
+        {
+            __m512 qx = _mm512_loadu_ps(x + (i+1)*n + t), qy = _mm512_loadu_ps(y + (i+1)*n + t);
+            __m512 dx = _mm512_sub_ps(qx, px), dy = _mm512_sub_ps(qy, py);
+            __m512 temp = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)));
+            length = _mm512_add_ps(length, temp);
+            cur_max = _mm512_max_ps(temp, cur_max);
+            _mm512_storeu_ps(&batch.shape_x[i*n + t], dx);
+            _mm512_storeu_ps(&batch.shape_y[i*n + t], dy);
+            px = qx;
+            py = qy;
+        }
+
+        _mm512_storeu_ps(&batch.mean_x[t], mean_x);
+        _mm512_storeu_ps(&batch.mean_y[t], mean_y);
+        _mm512_storeu_ps(&batch.var_x[t], var_x);
+        _mm512_storeu_ps(&batch.var_y[t], var_y);
+        _mm512_storeu_ps(&batch.length[t], length);
+        _mm512_storeu_ps(&batch.max_step[t], cur_max);
+    }
+
+    TrackStatsRange( batch, t, n );
+}
+
+// the statistics of all trajectories of the batch on the best instruction set
+// allowed by simd_limit, the steps are not normalized
+static void
+ComputeTrackStats( TrackBatch& batch )
+{
+    if( batch.count == 0 )
+        return;
+
+    switch( my::FarnebackSimdLevel() )
+    {
+    case my::SIMD_AVX512:
+        TrackStats_AVX512( batch );
+        break;
+    case my::SIMD_AVX2:
+        TrackStats_AVX2( batch );
+        break;
+    default:
+        TrackStatsRange( batch, 0, batch.count );
+    }
+}
+
+// the statistics and the tests of IsValid for all trajectories of the batch, the
+// steps of the valid ones are normalized by their length
+static void
+ValidateTracks( TrackBatch& batch )
+{
+    ComputeTrackStats( batch );
+
+    int n = batch.count;
+    std::vector<float> norm(n);
+    for( int t = 0; t < n; t++ )
+    {
+        float var_x = batch.var_x[t], var_y = batch.var_y[t];
+        float length = batch.length[t], cur_max = batch.max_step[t];
+
+        // remove static, random and jumping trajectories
+        bool valid = !(var_x < min_var && var_y < min_var) &&
+                     !(var_x > max_var || var_y > max_var) &&
+                     !(cur_max > max_dis && cur_max > length*0.7);
+        batch.valid[t] = valid;
+        norm[t] = valid ? (float)(1./length) : 1.f;
+    }
+
+    for( int i = 0; i < batch.points-1; i++ )
+    {
+        float* sx = &batch.shape_x[(size_t)i*n];
+        float* sy = &batch.shape_y[(size_t)i*n];
+        for( int t = 0; t < n; t++ )
+        {
+            sx[t] *= norm[t];
+            sy[t] *= norm[t];
+        }
+    }
+}
+
+#endif /*TRACKSTATS_H_*/
@@ -0,0 +1,88 @@
+#include "DenseTrack.h"
+#include "Descriptors.h"
+#include "TrackStats.h"
+
+// ValidateTracks against IsValid at -V 0, 1 and 2: random trajectories, static,
+// moving, noisy and with jumps, in batches of every size up to 40, including the
+// odd ones which leave a scalar tail after the vector lanes. The validity, the
+// statistics and the normalized steps must match bit for bit.
+//
+// usage: TrackStatsTest
+
+using namespace cv;
+
+static float RandomFloat(float low, float high)
+{
+	return low + (high - low)*(rand()/(float)RAND_MAX);
+}
+
+// returns the number of trajectories which differ from IsValid, counts the valid ones
+static int Check(int count, int points, int& num_valid)
+{
+	std::vector<std::vector<Point2f> > tracks(count);
+	TrackBatch batch;
+	batch.resize(count, points);
+
+	for(int t = 0; t < count; t++) {
+		// no motion, small noise, random motion beyond max_var
+		static const float noise[] = { 0.f, 0.5f, 5.f, 60.f };
+		float step = noise[rand()%4];
+		Point2f point(RandomFloat(0, 500), RandomFloat(0, 500));
+		Point2f velocity(RandomFloat(-3, 3), RandomFloat(-3, 3));
+		for(int i = 0; i < points; i++) {
+			point.x += velocity.x + RandomFloat(-step, step);
+			point.y += velocity.y + RandomFloat(-step, step);
+			// a jump of more than max_dis now and then
+			if(rand()%25 == 0) {
+				point.x += RandomFloat(-40, 40);
+				point.y += RandomFloat(-40, 40);
+			}
+			tracks[t].push_back(point);
+			batch.set(t, i, point);
+		}
+	}
+	ValidateTracks(batch);
+
+	int failed = 0;
+	std::vector<Point2f> shape;
+	for(int t = 0; t < count; t++) {
+		// IsValid adds to its outputs
+		float mean_x = 0, mean_y = 0, var_x = 0, var_y = 0, length = 0;
+		bool valid = IsValid(tracks[t], mean_x, mean_y, var_x, var_y, length);
+
+		bool same = valid == (batch.valid[t] != 0) &&
+			mean_x == batch.mean_x[t] && mean_y == batch.mean_y[t] &&
+			var_x == batch.var_x[t] && var_y == batch.var_y[t];
+		if(valid) {
+			num_valid++;
+			batch.shape(t, shape);
+			same = same && length == batch.length[t] && shape.size() == tracks[t].size();
+			for(size_t i = 0; same && i < shape.size(); i++)
+				same = shape[i].x == tracks[t][i].x && shape[i].y == tracks[t][i].y;
+		}
+		if(!same) {
+			fprintf(stderr, "-V %d, %d trajectories of %d points: trajectory %d differs\n",
+				simd_limit, count, points, t);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	static const int points[] = { 2, 3, 9, 16, 21 };
+
+	int failed = 0, total = 0, num_valid = 0;
+	srand(0);
+	for(int level = my::SIMD_NONE; level <= my::SIMD_AVX512; level++) {
+		simd_limit = level;
+		for(int count = 0; count <= 40; count++)
+			for(size_t p = 0; p < sizeof(points)/sizeof(points[0]); p++, total += count)
+				failed += Check(count, points[p], num_valid);
+	}
+	simd_limit = INT_MAX;
+
+	printf("ValidateTracks: %d trajectories, %d valid, %d failed\n", total, num_valid, failed);
+	return failed == 0 ? 0 : 1;
+}
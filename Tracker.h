@@ -0,0 +1,70 @@
+#ifndef TRACKER_H_
+#define TRACKER_H_
+
+#include "DenseTrack.h"
+#include "Initialize.h"
+#include "Trajectories.h"
+#include "Features.h"
+#include "Pipeline.h"
+
+using namespace cv;
+
+// the tracking of one video frame by frame on the slots of FrameStages: seeds the
+// points on the first frame, then computes the descriptors, moves the points by the
+// flow and re-samples every trackInfo.gap frames. The accepted trajectories of a
+// frame are left in results for the caller, which clears them.
+class FrameTracker
+{
+public:
+	std::vector<TrackStore> xyScaleTracks;  // in the coordinates of their pyramid level
+	std::vector<TrackStore> finishedTracks; // accepted trajectories of each scale, in frame coordinates
+	std::vector<std::vector<TrackResult> > results;
+	DescExtractor descExtractor;
+
+	FrameTracker(const TrackInfo& trackInfo_, const DescLayout& descLayout_, const TrackParams& params_)
+		: descExtractor(descLayout_, params_.compact_desc != 0), trackInfo(trackInfo_), descLayout(descLayout_),
+		  params(params_), init_counter(0) {}
+
+	// the first frame, the number of scales is fixed by its size
+	void seed(FrameSlot& cur, const std::vector<float>& fscales, Mat* draw_image)
+	{
+		xyScaleTracks.assign(fscales.size(), TrackStore(trackInfo.length, params.compute_desc ? descLayout.size : 0));
+		finishedTracks.assign(fscales.size(), TrackStore(trackInfo.length));
+		results.assign(fscales.size(), std::vector<TrackResult>());
+		init_counter = 0;
+
+		// save the feature points
+		ParallelFor(0, xyScaleTracks.size(), ScaleTracker(xyScaleTracks, finishedTracks, results, SamplePyr(cur), cur.flow_pyr,
+			fscales, trackInfo, params, cur.frame_num, false, true, draw_image));
+	}
+
+	// cur holds the flow from prev
+	void track(FrameSlot& prev, FrameSlot& cur, const std::vector<float>& fscales, Mat* draw_image)
+	{
+		init_counter++;
+
+		// the descriptors at the points of the previous frame, where the flow starts
+		if(params.compute_desc)
+			descExtractor.Compute(SamplePyr(prev), cur.flow_pyr, xyScaleTracks);
+
+		// track feature points of all scales, and detect new ones every initGap frames
+		bool resample = init_counter == trackInfo.gap;
+		ParallelFor(0, xyScaleTracks.size(), ScaleTracker(xyScaleTracks, finishedTracks, results, SamplePyr(cur), cur.flow_pyr,
+			fscales, trackInfo, params, cur.frame_num, true, resample, draw_image));
+		if(resample)
+			init_counter = 0;
+	}
+
+private:
+	TrackInfo trackInfo;
+	DescLayout descLayout;
+	TrackParams params;
+	int init_counter; // indicate when to detect new feature points
+
+	const std::vector<Mat>& SamplePyr(const FrameSlot& slot) const
+	{
+		return params.cache_pyramid ? slot.float_pyr : slot.grey_pyr;
+	}
+};
+
+#endif /*TRACKER_H_*/
@@ -3,6 +3,9 @@
 
 #include "DenseTrack.h"
 #include "Constants.h"
+#include "TrackStats.h"
+
+#include <algorithm>
 
 using namespace std;
 
@@ -46,49 +49,73 @@ public:
     }
 };
 
-list<TrackSegm> ExtractTrajectories(list<Track> xyTracks, int frame_num, int length)
+list<TrackSegm> ExtractTrajectories(const TrackStore& xyTracks, int frame_num, int length)
 {
 	list<TrackSegm> segmTracks; 
 
-	for(list<Track>::iterator iTrack = xyTracks.begin(); iTrack != xyTracks.end(); iTrack++)
+	// the segments of step+1 points in the window, their statistics in one batch
+	vector<int> tracks;
+	for(int iTrack = 0; iTrack < xyTracks.size(); iTrack++)
 	{		
-		if(frame_num <= iTrack->frame_num && iTrack->frame_num <= frame_num + length - step)
-		{
-			TrackSegm track;
-			track.setFrameNum(iTrack->frame_num);			
+		int track_frame = xyTracks.frame_num[iTrack];
+		if(frame_num <= track_frame && track_frame <= frame_num + length - step)
+			tracks.push_back(iTrack);
+	}
+
+	TrackBatch batch;
+	batch.resize(tracks.size(), step+1);
+	for(size_t k = 0; k < tracks.size(); k++)
+	{
+		const Point2f* point = xyTracks.row(tracks[k]);
+		int index = length - (xyTracks.frame_num[tracks[k]] - frame_num) - step;
+		for(int i = 0; i <= step; i++)
+			batch.set(k, i, point[index + i]);
+	}
+	ComputeTrackStats(batch);
 
-			int shift = iTrack->frame_num - frame_num;
-			int index = length - shift - step;
-			vector<Point2f> trajectory(step);
+	for(size_t k = 0; k < tracks.size(); k++)
+	{
+		const Point2f* point = xyTracks.row(tracks[k]);
+		int track_frame = xyTracks.frame_num[tracks[k]];
+		TrackSegm track;
+		track.setFrameNum(track_frame);			
 
-			for(int i = index, j = 0; i <= index + step; i++, j++)
-			{
-				track.addPoint(iTrack->point[i]);
-				trajectory[j] = iTrack->point[i];
-			}
+		int index = length - (track_frame - frame_num) - step;
+		for(int i = index; i <= index + step; i++)
+			track.addPoint(point[i]);
 
-			float mean_x(0), mean_y(0), var_x(0), var_y(0), length(0);
-			IsValid(trajectory, mean_x, mean_y, var_x, var_y, length);
-			track.setMean(mean_x, mean_y);
-			track.setVariance(var_x, var_y);
+		track.setMean(batch.mean_x[k], batch.mean_y[k]);
+		track.setVariance(batch.var_x[k], batch.var_y[k]);
 
-			segmTracks.push_back(track);
-		}		
+		segmTracks.push_back(track);
 	}
 
 	return segmTracks;
 }
 
 
-int CountTraj(list<Track> xyTracks, int frame_num, int length)
+// number of trajectories ending at each frame, accumulated: ends[f+1] - ends[g] is
+// the number ending in frames g..f
+void CountTrajEnds(const TrackStore& xyTracks, vector<int>& ends)
 {
-	int sum = 0;
-
-	for(list<Track>::iterator iTrack = xyTracks.begin(); iTrack != xyTracks.end(); iTrack++)
-		if(frame_num <= iTrack->frame_num && iTrack->frame_num <= frame_num + length - step)
-			sum++;
+	int last_frame = -1;
+	for(int iTrack = 0; iTrack < xyTracks.size(); iTrack++)
+		last_frame = std::max<int>(last_frame, xyTracks.frame_num[iTrack]);
+
+	ends.assign(last_frame + 2, 0);
+	for(int iTrack = 0; iTrack < xyTracks.size(); iTrack++)
+		ends[xyTracks.frame_num[iTrack] + 1]++;
+	for(size_t f = 1; f < ends.size(); f++)
+		ends[f] += ends[f-1];
+}
 
-	return sum;
+// trajectories ending in frame_num..frame_num+length-step, the ones ExtractTrajectories takes
+int CountTraj(const vector<int>& ends, int frame_num, int length)
+{
+	int last = std::min<int>(frame_num + length - step, ends.size() - 2);
+	if(last < frame_num)
+		return 0;
+	return ends[last + 1] - ends[frame_num];
 }
 
 void DrawTrajetory(const std::vector<Point2f>& point, Mat& image, int index)
@@ -127,7 +154,7 @@ void DrawTrajetories(SeqInfo* seqInfo, list<TrackSegm> segmTracks, int indexOfMa
         if(frame.empty())
             break;
 
-        if(indexOfMax - stepmake == frame_num)
+        if(indexOfMax - step == frame_num)
         {
         	// draw all segmented trajectories
         	int index = 0;
@@ -155,7 +182,7 @@ void DrawTrajetories(SeqInfo* seqInfo, list<TrackSegm> segmTracks, int indexOfMa
     destroyWindow("SegmentedTrajectories");
 }
 
-bool DoesTrajSame(list<TrackSegm>::iterator track0, list<TrackSegm>::iterator track1)
+bool DoesTrajSame(list<TrackSegm>::const_iterator track0, list<TrackSegm>::const_iterator track1)
 {
 	bool issame = true;
 
@@ -172,110 +199,78 @@ bool DoesTrajSame(list<TrackSegm>::iterator track0, list<TrackSegm>::iterator tr
 	return issame;
 }
 
-void BFS(int** arr, bool* visited, int* clusters, int size, int unit, int clus)
-{
-	int count = 0, head = 0;
-
-	int *queue = new int[size];	
-	for(int i = 0; i < size; i++) queue[i] = 0;
-	
-	queue[count++] = unit;
-	visited[unit] = true;
-	clusters[unit] = clus;
-
-	while (head < count)
-	{
-		unit = queue[head++];
-
-		for(int i = 0; i < size; i++)
-			if (arr[unit][i] && !visited[i])
-			{
-				queue[count++] = i;
-				visited[i] = true;
-				clusters[i] = clus;
-			}
-	}
-	delete []queue;
-}
-
-int* GetMatrixOfTrajectories(list<TrackSegm> segmTracks)
+// Clusters of DoesTrajSame, as found by a BFS from every unvisited trajectory in
+// list order which only follows the pairs to later trajectories. Two trajectories
+// can only be the same if their means are within delta_mean, so they are binned in
+// a grid of (mean_x, mean_y) cells slightly larger than delta_mean, and each one is
+// only tested against the trajectories of its own and the 8 neighbouring cells
+// instead of all others. Memory and time are linear in the number of trajectories
+// plus the number of pairs in neighbouring cells.
+int* ClusterTrajectories(const list<TrackSegm>& segmTracks, int& clus)
 {
 	int size = segmTracks.size();
 
-	// create double array of zeros
-	int** arr = 0;
-	arr = new int*[size];
-
-	for (int i = 0; i < size; i++)
-	{
-		arr[i] = new int[size];
-
-		for (int j = 0; j < size; j++)
-		{
-			arr[i][j] = 0;
-		}
+	vector<list<TrackSegm>::const_iterator> tracks;
+	tracks.reserve(size);
+	for(list<TrackSegm>::const_iterator iTrack = segmTracks.begin(); iTrack != segmTracks.end(); iTrack++)
+		tracks.push_back(iTrack);
+
+	// the margin covers the rounding of the differences in DoesTrajSame
+	const double cell_size = delta_mean*1.001;
+	vector<std::pair<std::pair<int, int>, int> > cells(size);
+	vector<std::pair<int, int> > keys(size);
+	for(int i = 0; i < size; i++) {
+		int cx = cvFloor(tracks[i]->mean_x/cell_size);
+		int cy = cvFloor(tracks[i]->mean_y/cell_size);
+		keys[i] = std::make_pair(cy, cx);
+		cells[i] = std::make_pair(keys[i], i);
 	}
+	std::sort(cells.begin(), cells.end());
 
-	// compute connections between trajectories
-	int i = 0, j;
-
-	for(list<TrackSegm>::iterator iTrack0 = segmTracks.begin(); iTrack0 != segmTracks.end(); iTrack0++)
-	{
-		j = 0;
+	int* clusters = new int[size];
+	vector<bool> visited(size, false);
+	vector<int> queue(size);
+	clus = 0;
 
-		for(list<TrackSegm>::iterator iTrack1 = segmTracks.begin(); iTrack1 != segmTracks.end(); iTrack1++)
-		{
-			if(j > i)
-				if(DoesTrajSame(iTrack0, iTrack1))
-					arr[i][j] = 1;
+	for(int root = 0; root < size; root++) {
+		if(visited[root])
+			continue;
 
-			j++;
+		int head = 0, count = 0;
+		queue[count++] = root;
+		visited[root] = true;
+		clusters[root] = clus;
+
+		while(head < count) {
+			int i = queue[head++];
+
+			for(int dy = -1; dy <= 1; dy++)
+			for(int dx = -1; dx <= 1; dx++) {
+				std::pair<int, int> key(keys[i].first + dy, keys[i].second + dx);
+				int k = std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, i + 1)) - cells.begin();
+				for(; k < size && cells[k].first == key; k++) {
+					int j = cells[k].second;
+					if(!visited[j] && DoesTrajSame(tracks[i], tracks[j])) {
+						queue[count++] = j;
+						visited[j] = true;
+						clusters[j] = clus;
+					}
+				}
+			}
 		}
-		i++;
-	}
-
-	// print array
-	/*
-	for (int i = 0; i < size; i++)
-	{
-	    for (int j = 0; j < size; j++)
-	    {
-	    	printf("%i,", arr[i][j]);
-	    }
-	    printf("\n");
+		clus++;
 	}
-	*/
 
-	// find connected components with BFS
-	bool* visited = new bool[size];
-	int* clusters = new int[size];
-	
-	for (int i = 0; i < size; ++i) 
-	{
-		visited[i] = false;
-		clusters[i] = 0;
-	}
+	return clusters;
+}
 
-	int clus = 0;
-	for (int i = 0; i < size; ++i)
-	{
-		if (!visited[i])
-		{
-			BFS(arr, visited, clusters, size, i, clus);
-			clus++;
-		}
-	}
+int* GetMatrixOfTrajectories(const list<TrackSegm>& segmTracks)
+{
+	int clus;
+	int* clusters = ClusterTrajectories(segmTracks, clus);
 
 	printf("Number of clusters: %d\n", clus);
 
-	// Clean up memory
-	for (int i = 0; i < size; i++)
-		delete []arr[i];
-
-	delete []arr;
-	delete []visited;
-	arr = 0;	
-
 	return clusters;
 }
 
@@ -360,16 +355,20 @@ list<TrackSegm> Thresholding(list<TrackSegm> segmTracks)
 	return segmTracks_thresholded;
 }
 
-void ComputeTrajGraphs(list<Track> xyTracks, const int length, SeqInfo* seqInfo)
+void ComputeTrajGraphs(const TrackStore& xyTracks, const int length, SeqInfo* seqInfo)
 {
 	printf("Number of trajectories: %d \n", xyTracks.size());
 
 	int maxnum = 0;
 	int indexOfMax = 0;
 
-	for(int i = step; i<=159; ++i)
+	// the window with the most trajectories, over the whole video
+	vector<int> ends;
+	CountTrajEnds(xyTracks, ends);
+
+	for(int i = step; i < (int)ends.size() - 1; ++i)
 	{
-		int num = CountTraj(xyTracks, i, length);
+		int num = CountTraj(ends, i, length);
 		//printf("Number of trajectories from %d to %d: %d \n", i - step, i, num);
 
 		if(maxnum < num)
@@ -400,11 +399,87 @@ void ComputeTrajGraphs(list<Track> xyTracks, const int length, SeqInfo* seqInfo)
 	// compute the matrix of connections between segmented trajectories and cluster them
 	int* clusters = GetMatrixOfTrajectories(segmTracks);	
 
-	// draw segmented trajectories
-	DrawTrajetories(seqInfo, segmTracks, indexOfMax, clusters);
+	// draw segmented trajectories, on the video again if it can be read twice
+	if(seqInfo->video)
+		DrawTrajetories(seqInfo, segmTracks, indexOfMax, clusters);
 
 	// Clean up memory
 	delete []clusters;			
 }
 
+// Online version of ComputeTrajGraphs for streams: instead of the densest window
+// at the end of the video, every window of step frames is segmented as soon as
+// all trajectories crossing it are finished, i.e. length - step frames after its
+// end. The clusters are written to a text file, one line per trajectory
+//   window  cluster  mean_x  mean_y  var_x  var_y
+// where window is the last frame of the window. Trajectories ending before the
+// next window are dropped, so only about length frames of them are kept.
+class StreamSegmenter
+{
+public:
+	StreamSegmenter(int length_) : length(length_), tracks(length_), next_window(step), outfile(NULL) {}
+
+	~StreamSegmenter()
+	{
+		if(outfile)
+			fclose(outfile);
+	}
+
+	bool open(const char* file)
+	{
+		outfile = fopen(file, "w");
+		return outfile != NULL;
+	}
+
+	// take the trajectories finished in the last frame
+	void add(TrackStore& finished)
+	{
+		tracks.add(finished);
+		finished.clear();
+	}
+
+	// frame_num is tracked, segment the windows which are complete now
+	void update(int frame_num)
+	{
+		while(next_window + length - step <= frame_num)
+			Segment();
+	}
+
+	// end of the stream, no trajectory finishes anymore
+	void finish(int frame_num)
+	{
+		while(next_window <= frame_num)
+			Segment();
+		fflush(outfile);
+	}
+
+private:
+	int length;
+	TrackStore tracks;
+	int next_window; // last frame of the next window to segment
+	FILE* outfile;
+
+	void Segment()
+	{
+		list<TrackSegm> segmTracks = ExtractTrajectories(tracks, next_window, length);
+		if(!segmTracks.empty()) {
+			int clus;
+			int* clusters = ClusterTrajectories(segmTracks, clus);
+
+			int index = 0;
+			for(list<TrackSegm>::iterator iTrack = segmTracks.begin(); iTrack != segmTracks.end(); iTrack++, index++)
+				fprintf(outfile, "%d\t%d\t%g\t%g\t%g\t%g\n", next_window, clusters[index],
+					iTrack->mean_x, iTrack->mean_y, iTrack->var_x, iTrack->var_y);
+
+			delete []clusters;
+		}
+		next_window += step;
+
+		// the later windows only take trajectories ending at or after their last frame
+		for(int iTrack = 0; iTrack < tracks.size(); iTrack++)
+			tracks.active[iTrack] = tracks.frame_num[iTrack] >= next_window;
+		tracks.Compact();
+	}
+};
+
 #endif /*TRAJHANDSEGM_H_*/
\ No newline at end of file
@@ -2,6 +2,12 @@
 #define TRAJECTORIES_H_
 
 #include "DenseTrack.h"
+#include "Descriptors.h"
+#include "Constants.h"
+#include "ThreadPool.h"
+#include "Advection.h"
+#include "TrackFile.h"
+#include "TrackStats.h"
 
 using namespace cv;
 
@@ -23,69 +29,487 @@ void SaveTrajectoriesToFile(std::vector<std::list<Track>> xyScaleTracks, int sca
 		}
 	}
 }*/
-void ClearTrackPoints(const int length)
+// receives the accepted trajectories: the points of the track, its shape normalized
+// by IsValid and the statistics of the points, all in frame coordinates
+class TrackSink
 {
-	std::ofstream outfile;
-	outfile.open("out_of_tracks.txt");
-	outfile << "";
-	outfile.close();
-
-	std::ofstream outfile2;
-	outfile2.open("out_of_tracks_debug.txt");
-	outfile2 << length << std::endl;
-	outfile2.close();
-}
+public:
+	virtual ~TrackSink() {}
+	virtual void write(const Point2f* point, const std::vector<Point2f>& trajectory,
+					   float mean_x, float mean_y, float var_x, float var_y, int frame_num) = 0;
+};
 
-void SaveTrackPointsForDebug(const std::vector<Point2f>& point, const int length, int frame_num)
+// the text files read by the python tools: one line per trajectory in track_file
+// (frame, length, mean, variance, shape) and its points in debug_file, whose first
+// line is the length; written through large stdio buffers instead of reopening
+// the files for every trajectory
+class TextTrackSink : public TrackSink
 {
-	std::ofstream outfile;
-	outfile.open("out_of_tracks_debug.txt", std::ios_base::app);
+public:
+	TextTrackSink(int length_) : length(length_), outfile(NULL), debugfile(NULL) {}
 
-	outfile << frame_num << "\t";
+	~TextTrackSink()
+	{
+		if(outfile)
+			fclose(outfile);
+		if(debugfile)
+			fclose(debugfile);
+	}
 
-	for (int j = 0; j <= length; j++)
+	bool open(const char* file, const char* debug_file)
 	{
-		Point2f point0 = point[j];		
+		outfile = fopen(file, "w");
+		debugfile = fopen(debug_file, "w");
+		if(!outfile || !debugfile)
+			return false;
 
-		outfile << point0.x << "\t";;
-		outfile << point0.y << "\t";;
+		setvbuf(outfile, NULL, _IOFBF, 1 << 20);
+		setvbuf(debugfile, NULL, _IOFBF, 1 << 20);
+		fprintf(debugfile, "%d\n", length);
+		return true;
 	}
 
-	outfile << std::endl;
-	outfile.close();
-}
+	void write(const Point2f* point, const std::vector<Point2f>& trajectory,
+			   float mean_x, float mean_y, float var_x, float var_y, int frame_num)
+	{
+		// %g is the default formatting of the streams used before
+		fprintf(outfile, "%d\t%d\t%g\t%g\t%g\t%g\t", frame_num, length, mean_x, mean_y, var_x, var_y);
+		for(int i = 0; i < length; ++i)
+			fprintf(outfile, "%g\t%g\t", trajectory[i].x, trajectory[i].y);
+		fputc('\n', outfile);
+
+		fprintf(debugfile, "%d\t", frame_num);
+		for(int j = 0; j <= length; j++)
+			fprintf(debugfile, "%g\t%g\t", point[j].x, point[j].y);
+		fputc('\n', debugfile);
+	}
 
-void SaveTrackPoints(const std::vector<Point2f>& point, std::vector<Point2f> trajectory, const int length, float mean_x, float mean_y, float var_x, float var_y, int frame_num)
+private:
+	int length;
+	FILE* outfile;
+	FILE* debugfile;
+};
+
+// Binary trajectory file, all numbers little-endian. A 32 byte header
+//   char     magic[8]       "DTRACKS\0"
+//   uint32   version        1
+//   uint32   length         track length L
+//   uint32   record_size    bytes per record, 4*(5 + 2*L + 2*(L+1))
+//   uint32   shape_offset   byte offset of the shape in a record, 20
+//   uint32   points_offset  byte offset of the points in a record, 20 + 8*L
+//   uint32   reserved       0
+// is followed by one fixed-size record per trajectory
+//   int32    frame_num
+//   float32  mean_x, mean_y, var_x, var_y
+//   float32  shape[L][2]    normalized displacements (x, y)
+//   float32  points[L+1][2] track points (x, y)
+class BinaryTrackSink : public TrackSink
 {
-	std::ofstream outfile;
-	outfile.open("out_of_tracks.txt", std::ios_base::app);
-
-	outfile << frame_num << "\t";
-	outfile << length << "\t";
-	outfile << mean_x << "\t";
-	outfile << mean_y << "\t";
-	outfile << var_x << "\t";
-	outfile << var_y << "\t";
-	
-	for (int i = 0; i < length; ++i)
+public:
+	BinaryTrackSink(int length_) : length(length_), outfile(NULL) {}
+
+	~BinaryTrackSink()
 	{
-		outfile << trajectory[i].x << "\t";
-		outfile << trajectory[i].y << "\t";
+		if(outfile)
+			fclose(outfile);
 	}
-	
-    /*
-	for (int j = 0; j <= length; j++)
+
+	bool open(const char* file)
+	{
+		outfile = fopen(file, "wb");
+		if(!outfile)
+			return false;
+		setvbuf(outfile, NULL, _IOFBF, 1 << 20);
+
+		record.resize(4*(5 + 2*length + 2*(length+1)));
+
+		unsigned char header[32] = { 'D', 'T', 'R', 'A', 'C', 'K', 'S', 0 };
+		PutU32(header + 8, 1);
+		PutU32(header + 12, length);
+		PutU32(header + 16, record.size());
+		PutU32(header + 20, 20);
+		PutU32(header + 24, 20 + 8*length);
+		PutU32(header + 28, 0);
+		return fwrite(header, sizeof(header), 1, outfile) == 1;
+	}
+
+	void write(const Point2f* point, const std::vector<Point2f>& trajectory,
+			   float mean_x, float mean_y, float var_x, float var_y, int frame_num)
+	{
+		unsigned char* p = &record[0];
+		PutU32(p, (unsigned int)frame_num);
+		PutF32(p + 4, mean_x);
+		PutF32(p + 8, mean_y);
+		PutF32(p + 12, var_x);
+		PutF32(p + 16, var_y);
+		p += 20;
+
+		for(int i = 0; i < length; i++, p += 8) {
+			PutF32(p, trajectory[i].x);
+			PutF32(p + 4, trajectory[i].y);
+		}
+		for(int j = 0; j <= length; j++, p += 8) {
+			PutF32(p, point[j].x);
+			PutF32(p + 4, point[j].y);
+		}
+
+		fwrite(&record[0], record.size(), 1, outfile);
+	}
+
+	static void PutU32(unsigned char* p, unsigned int v)
+	{
+		p[0] = v & 0xff;
+		p[1] = (v >> 8) & 0xff;
+		p[2] = (v >> 16) & 0xff;
+		p[3] = (v >> 24) & 0xff;
+	}
+
+	static void PutF32(unsigned char* p, float f)
+	{
+		unsigned int v;
+		memcpy(&v, &f, sizeof(v));
+		PutU32(p, v);
+	}
+
+private:
+	int length;
+	FILE* outfile;
+	std::vector<unsigned char> record;
+};
+
+// the columnar file of TrackFile.h. The number of trajectories is only known at
+// the end, so the points, the largest column, go straight to the file after the
+// header, the other columns are spilled to temporary files and appended behind
+// them with the frame index when the sink is destroyed
+class ColumnarTrackSink : public TrackSink
+{
+public:
+	ColumnarTrackSink(int length_) : length(length_), count(0), outfile(NULL), ready(false), failed(false)
+	{
+		for(int i = 0; i < num_spills; i++)
+			spills[i] = NULL;
+	}
+
+	~ColumnarTrackSink()
+	{
+		if(ready && !finish())
+			fprintf(stderr, "Could not write the trajectory file\n");
+		if(outfile)
+			fclose(outfile);
+		for(int i = 0; i < num_spills; i++)
+			if(spills[i])
+				fclose(spills[i]);
+	}
+
+	bool open(const char* file)
+	{
+		// the columns are written as they are in memory
+		if(!TrackFileByteOrderOk())
+			return false;
+
+		outfile = fopen(file, "wb");
+		if(!outfile)
+			return false;
+		setvbuf(outfile, NULL, _IOFBF, 1 << 20);
+
+		for(int i = 0; i < num_spills; i++) {
+			spills[i] = tmpfile();
+			if(!spills[i])
+				return false;
+			setvbuf(spills[i], NULL, _IOFBF, 1 << 18);
+		}
+
+		// the header is rewritten at the end
+		TrackFileHeader header;
+		memset(&header, 0, sizeof(header));
+		ready = fwrite(&header, sizeof(header), 1, outfile) == 1;
+		return ready;
+	}
+
+	void write(const Point2f* point, const std::vector<Point2f>& trajectory,
+			   float mean_x, float mean_y, float var_x, float var_y, int frame_num)
+	{
+		// the columns would not line up any more after a short write
+		if(failed)
+			return;
+
+		int32_t frame = frame_num;
+		float mean[2] = { mean_x, mean_y };
+		float var[2] = { var_x, var_y };
+
+		if(fwrite(point, sizeof(float)*2, length+1, outfile) != (size_t)length+1 ||
+		   fwrite(&frame, sizeof(frame), 1, spills[SPILL_FRAME_NUM]) != 1 ||
+		   fwrite(mean, sizeof(mean), 1, spills[SPILL_MEAN]) != 1 ||
+		   fwrite(var, sizeof(var), 1, spills[SPILL_VAR]) != 1 ||
+		   fwrite(&trajectory[0], sizeof(float)*2, length, spills[SPILL_SHAPE]) != (size_t)length) {
+			failed = true;
+			return;
+		}
+
+		// the trajectories arrive by end frame
+		if(index.empty() || index.back().frame != frame) {
+			TrackFileFrame entry = { frame, 0, count };
+			index.push_back(entry);
+		}
+		index.back().count++;
+		count++;
+	}
+
+private:
+	enum { SPILL_FRAME_NUM, SPILL_MEAN, SPILL_VAR, SPILL_SHAPE, num_spills };
+
+	int length;
+	uint64_t count;
+	FILE* outfile;
+	FILE* spills[num_spills];
+	bool ready; // opened, the file is completed on destruction
+	bool failed; // a write came up short, finish() fails
+	std::vector<TrackFileFrame> index;
+
+	// zero bytes up to the next column
+	uint64_t Align(uint64_t offset)
 	{
-		Point2f point0 = point[j];
+		static const char zeros[track_file_align] = { 0 };
+		size_t pad = (track_file_align - offset % track_file_align) % track_file_align;
+		if(fwrite(zeros, 1, pad, outfile) != pad)
+			failed = true;
+		return offset + pad;
+	}
+
+	// append a spill file, returns its offset in the output
+	uint64_t Append(FILE* spill, uint64_t& offset)
+	{
+		offset = Align(offset);
+		uint64_t start = offset;
+
+		char buffer[1 << 16];
+		size_t n;
+		rewind(spill);
+		while((n = fread(buffer, 1, sizeof(buffer), spill)) > 0) {
+			if(fwrite(buffer, 1, n, outfile) != n)
+				failed = true;
+			offset += n;
+		}
+		if(ferror(spill))
+			failed = true;
+		return start;
+	}
+
+	bool finish()
+	{
+		if(failed)
+			return false;
+
+		TrackFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, track_file_magic, sizeof(header.magic));
+		header.version = 1;
+		header.length = length;
+		header.count = count;
+		header.num_frames = index.size();
+		header.points_offset = sizeof(header);
+
+		uint64_t offset = sizeof(header) + count*(length+1)*sizeof(float)*2;
+		for(int i = 0; i < num_spills; i++)
+			if(ferror(spills[i]) || fflush(spills[i]) != 0)
+				return false;
+		header.frame_num_offset = Append(spills[SPILL_FRAME_NUM], offset);
+		header.mean_offset = Append(spills[SPILL_MEAN], offset);
+		header.var_offset = Append(spills[SPILL_VAR], offset);
+		header.shape_offset = Append(spills[SPILL_SHAPE], offset);
 
-		outfile << point0.x << "\t";;
-		outfile << point0.y << "\t";;
-	}*/
+		header.index_offset = Align(offset);
+		if(!index.empty() && fwrite(&index[0], sizeof(TrackFileFrame), index.size(), outfile) != index.size())
+			failed = true;
 
-	outfile << std::endl;
-	outfile.close();
+		if(fseek(outfile, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, outfile) != 1)
+			failed = true;
+		return !failed && !ferror(outfile) && fflush(outfile) == 0;
+	}
+};
 
-	SaveTrackPointsForDebug(point, length, frame_num);
+// the sink for output_format with the configured file names, NULL if a file
+// cannot be created
+TrackSink* CreateTrackSink(int length)
+{
+	if(output_format == OUTPUT_COLUMNAR) {
+		ColumnarTrackSink* sink = new ColumnarTrackSink(length);
+		const char* file = track_file ? track_file : "out_of_tracks.cols";
+		if(!sink->open(file)) {
+			fprintf(stderr, "Could not create %s\n", file);
+			delete sink;
+			return NULL;
+		}
+		return sink;
+	}
+
+	if(output_format == OUTPUT_BINARY) {
+		BinaryTrackSink* sink = new BinaryTrackSink(length);
+		const char* file = track_file ? track_file : "out_of_tracks.bin";
+		if(!sink->open(file)) {
+			fprintf(stderr, "Could not create %s\n", file);
+			delete sink;
+			return NULL;
+		}
+		return sink;
+	}
+
+	TextTrackSink* sink = new TextTrackSink(length);
+	const char* file = track_file ? track_file : "out_of_tracks.txt";
+	if(!sink->open(file, debug_file)) {
+		fprintf(stderr, "Could not create %s or %s\n", file, debug_file);
+		delete sink;
+		return NULL;
+	}
+	return sink;
 }
 
+// a finished trajectory to be saved, in the coordinates of the full frame
+typedef struct {
+	int track;                       // index in the finished tracks of its scale
+	std::vector<Point2f> trajectory; // normalized by ValidateTracks
+	float mean_x;
+	float mean_y;
+	float var_x;
+	float var_y;
+	float length;                    // of the trajectory before normalizing
+	std::vector<float> desc;         // the descriptors of the track, if it has any
+}TrackResult;
+
+// tracks and re-samples the points of each scale with its own pyramid level; the
+// scales share nothing, so they run in parallel. The accepted trajectories move to
+// the finished tracks of their scale in frame coordinates, and are saved by the
+// caller from the results; only scale 0 draws on the image.
+class ScaleTracker : public ParallelBody
+{
+public:
+	ScaleTracker(std::vector<TrackStore>& xyScaleTracks_, std::vector<TrackStore>& finishedTracks_,
+				 std::vector<std::vector<TrackResult> >& results_,
+				 const std::vector<Mat>& grey_pyr_, const std::vector<Mat>& flow_pyr_, const std::vector<float>& fscales_,
+				 const TrackInfo& trackInfo_, const TrackParams& params_, int frame_num_, bool track_, bool sample_, Mat* image_)
+		: xyScaleTracks(xyScaleTracks_), finishedTracks(finishedTracks_), results(results_),
+		  grey_pyr(grey_pyr_), flow_pyr(flow_pyr_), fscales(fscales_),
+		  trackInfo(trackInfo_), params(params_), frame_num(frame_num_), track(track_), sample(sample_), image(image_) {}
+
+	void operator()(int begin, int end) const
+	{
+		for(int iScale = begin; iScale < end; iScale++) {
+			if(track)
+				TrackScale(iScale);
+			if(sample)
+				SampleScale(iScale);
+		}
+	}
+
+private:
+	std::vector<TrackStore>& xyScaleTracks;
+	std::vector<TrackStore>& finishedTracks;
+	std::vector<std::vector<TrackResult> >& results;
+	const std::vector<Mat>& grey_pyr;
+	const std::vector<Mat>& flow_pyr;
+	const std::vector<float>& fscales;
+	const TrackInfo& trackInfo;
+	const TrackParams& params;
+	int frame_num;
+	bool track;
+	bool sample;
+	Mat* image; // NULL if nothing is drawn
+
+	void TrackScale(int iScale) const
+	{
+		TrackStore& xyTracks = xyScaleTracks[iScale];
+		const Mat& flow = flow_pyr[iScale];
+		float fscale = fscales[iScale];
+
+		// move all feature points by the flow at once
+		int size = xyTracks.size();
+		xyTracks.next_x.resize(size);
+		xyTracks.next_y.resize(size);
+		xyTracks.inside.resize(size);
+		if(size > 0)
+			AdvectPoints(flow, &xyTracks.x[0], &xyTracks.y[0], &xyTracks.next_x[0], &xyTracks.next_y[0],
+				&xyTracks.inside[0], size, params.track_bilinear != 0);
+
+		// the tracks which achieve the maximal length are checked together
+		std::vector<int> finished;
+		for(int iTrack = 0; iTrack < size; iTrack++)
+		{
+			if(!xyTracks.inside[iTrack])
+			{
+				xyTracks.active[iTrack] = 0;
+				continue;
+			}
+
+			xyTracks.addPoint(iTrack, Point2f(xyTracks.next_x[iTrack], xyTracks.next_y[iTrack]));
+
+			if(xyTracks.index[iTrack] >= trackInfo.length)
+				finished.push_back(iTrack);
+		}
+
+		// the trajectories are checked and saved at the size of the full frame
+		TrackBatch batch;
+		batch.resize(finished.size(), trackInfo.length+1);
+		for(size_t k = 0; k < finished.size(); k++) {
+			const Point2f* points = xyTracks.row(finished[k]);
+			for(int i = 0; i <= trackInfo.length; ++i)
+				batch.set(k, i, points[i]*fscale);
+		}
+		ValidateTracks(batch);
+
+		for(size_t k = 0; k < finished.size(); k++)
+		{
+			int iTrack = finished[k];
+			const Point2f* points = xyTracks.row(iTrack);
+
+			// draw the trajectories at the first scale
+			if(image && iScale == 0)
+				DrawTrack(points, xyTracks.index[iTrack], fscale, 10, *image);
+
+			// Here we are trying to segment trajectories belonding to hands
+			if(batch.valid[k] && (batch.var_x[k] > var_threshold || batch.var_y[k] > var_threshold))
+			{
+				finishedTracks[iScale].add(points, fscale, frame_num);
+
+				TrackResult result;
+				result.track = finishedTracks[iScale].size() - 1;
+				batch.shape(k, result.trajectory);
+				result.mean_x = batch.mean_x[k];
+				result.mean_y = batch.mean_y[k];
+				result.var_x = batch.var_x[k];
+				result.var_y = batch.var_y[k];
+				result.length = batch.length[k];
+				if(xyTracks.desc_size) {
+					const float* desc = xyTracks.descRow(iTrack);
+					result.desc.assign(desc, desc + trackInfo.length*xyTracks.desc_size);
+				}
+				results[iScale].push_back(result);
+			}
+
+			xyTracks.active[iTrack] = 0;
+		}
+
+		xyTracks.Compact();
+	}
+
+	// detect new feature points away from the ones still tracked
+	void SampleScale(int iScale) const
+	{
+		TrackStore& xyTracks = xyScaleTracks[iScale];
+		const Mat& grey = grey_pyr[iScale];
+
+		// the tracks are counted in the grid from the first sampling on
+		if(xyTracks.grid.cell_size != params.min_distance)
+			xyTracks.initGrid(grey.cols, grey.rows, params.min_distance);
+
+		std::vector<Point2f> points;
+		if(params.sparse_sample)
+			SparseSample(grey, xyTracks.grid, points, params.quality, trackInfo.length);
+		else
+			DenseSample(grey, xyTracks.grid, points, params.quality);
+		// save the new feature points
+		for(size_t i = 0; i < points.size(); i++)
+			xyTracks.add(points[i]);
+	}
+};
+
 #endif /*TRAJECTORIES_H_*/
\ No newline at end of file
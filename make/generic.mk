@@ -31,6 +31,7 @@
 #   CXXFLAGS  flags for compiling
 #   LDFLAGS   flags used for linking
 #   LDLIBS    list of libraries to be linked
+#   NOLINK_x  objects not to be linked into target x (optional)
 #   CXX       compiler linker (should be g++ by default)
 #
 
@@ -98,13 +99,13 @@ $(BUILDDIR)/%.o: %.cpp
 $(BINDIR)/%.so:
 	@echo "=== linking: $@ ==="
 	@rm -f $@
-	$(CXX) -shared $(LDFLAGS) -o $@ $(filter %.o, $^) $(LDLIBS)
+	$(CXX) -shared $(LDFLAGS) -o $@ $(filter-out $(NOLINK_$(notdir $*)), $(filter %.o, $^)) $(LDLIBS)
 
 # linking
 $(BINDIR)/%:
 	@echo "=== linking: $@ ==="
 	@rm -f $@
-	$(CXX) $(LDFLAGS) -o $@ $(filter %.o, $^) $(LDLIBS)
+	$(CXX) $(LDFLAGS) -o $@ $(filter-out $(NOLINK_$(notdir $*)), $(filter %.o, $^)) $(LDLIBS)
 
 %: %.o
 %.h: ;
@@ -0,0 +1,46 @@
+# loads the columnar trajectory file of DenseTrack -O 2 (see TrackFile.h) as
+# numpy arrays mapped from the file, nothing is parsed or copied
+#
+#   tracks = trackfile.load('out_of_tracks.cols')
+#   tracks['points'][i]           the length+1 points of trajectory i, shape (length+1, 2)
+#   trackfile.frame(tracks, 100)  the records of the trajectories ending at frame 100
+
+import numpy as np
+
+HEADER = np.dtype([('magic', 'S8'), ('version', '<u4'), ('length', '<u4'),
+                   ('count', '<u8'), ('num_frames', '<u8'),
+                   ('frame_num_offset', '<u8'), ('mean_offset', '<u8'), ('var_offset', '<u8'),
+                   ('shape_offset', '<u8'), ('points_offset', '<u8'), ('index_offset', '<u8'),
+                   ('reserved', '<u8', (6,))])
+
+INDEX = np.dtype([('frame', '<i4'), ('count', '<u4'), ('first', '<u8')])
+
+def load(path):
+	data = np.memmap(path, dtype=np.uint8, mode='r')
+	header = data[:HEADER.itemsize].view(HEADER)[0]
+	if header['magic'] != b'DTCOLS' or header['version'] != 1:
+		raise ValueError('%s is not a columnar trajectory file' % path)
+
+	n = int(header['count'])
+	l = int(header['length'])
+
+	def column(name, dtype, shape):
+		offset = int(header[name + '_offset'])
+		count = int(np.prod(shape))
+		return np.frombuffer(data, dtype=dtype, count=count, offset=offset).reshape(shape)
+
+	return {'length': l,
+	        'frame_num': column('frame_num', '<i4', (n,)),
+	        'mean': column('mean', '<f4', (n, 2)),
+	        'var': column('var', '<f4', (n, 2)),
+	        'shape': column('shape', '<f4', (n, l, 2)),
+	        'points': column('points', '<f4', (n, l+1, 2)),
+	        'index': column('index', INDEX, (int(header['num_frames']),))}
+
+def frame(tracks, frame_num):
+	index = tracks['index']
+	i = np.searchsorted(index['frame'], frame_num)
+	if i == len(index) or index['frame'][i] != frame_num:
+		return slice(0, 0)
+	first = int(index['first'][i])
+	return slice(first, first + int(index['count'][i]))
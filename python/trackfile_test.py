@@ -0,0 +1,71 @@
+# reads the file written by TrackFileTest with trackfile.py and checks it against
+# the values TrackFileTest gives record r, then checks that copies cut short are
+# refused; run by 'make test' when numpy is installed
+#
+#   python3 trackfile_test.py ../release/TrackFileTest
+
+import os
+import subprocess
+import sys
+import tempfile
+
+import numpy as np
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import trackfile
+
+def expected(n, l):
+	r = np.arange(n, dtype=np.float32)[:, None]
+	j = np.arange(l+1, dtype=np.float32)[None, :]
+	points = np.stack([r + 0.5*j, r - 0.5*j], axis=-1)
+	shape = np.stack([0.25*j[:, :l] - r, 0.25*j[:, :l] + r], axis=-1)
+	mean = np.hstack([r + 0.125, r + 0.375])
+	var = np.hstack([0.5*r, 0.25*r])
+	return points, shape, mean, var
+
+def check(path):
+	tracks = trackfile.load(path)
+	l = tracks['length']
+	counts = [f % 4 for f in range(101)]
+	n = sum(counts)
+	assert l == 15 and len(tracks['frame_num']) == n
+
+	points, shape, mean, var = expected(n, l)
+	assert np.array_equal(tracks['points'], points)
+	assert np.array_equal(tracks['shape'], shape)
+	assert np.array_equal(tracks['mean'], mean)
+	assert np.array_equal(tracks['var'], var)
+
+	first = 0
+	for f, count in enumerate(counts):
+		records = trackfile.frame(tracks, f)
+		if count == 0:
+			assert records == slice(0, 0)
+			continue
+		assert records == slice(first, first + count)
+		assert (tracks['frame_num'][records] == f).all()
+		first += count
+	assert len(tracks['index']) == sum(1 for c in counts if c > 0)
+	return os.path.getsize(path)
+
+def check_cut(path, size):
+	data = open(path, 'rb').read()
+	for cut in (0, 127, 128, size//2, size - 1):
+		with tempfile.NamedTemporaryFile(suffix='.cols') as copy:
+			copy.write(data[:cut])
+			copy.flush()
+			try:
+				trackfile.load(copy.name)
+			except ValueError:
+				continue
+			raise AssertionError('a copy cut to %d of %d bytes was loaded' % (cut, size))
+
+def main():
+	with tempfile.NamedTemporaryFile(suffix='.cols') as f:
+		subprocess.check_call([sys.argv[1], f.name], stdout=subprocess.DEVNULL)
+		size = check(f.name)
+		check_cut(f.name, size)
+	print('trackfile.py: read the file of TrackFileTest')
+
+if __name__ == '__main__':
+	main()